@@ -0,0 +1,125 @@
+#ifndef AFFINETFORM_H
+#define AFFINETFORM_H
+
+#include <cassert>
+#include <cmath>
+
+#include "cvec.h"
+#include "matrix4.h"
+#include "quat.h"
+#include "rigtform.h"
+
+// An affine transform made of a nonuniform scale, then a rotation, then a
+// translation: T R S. Like RigTForm, it composes, inverts and gives its normal
+// matrix in closed form, without the general 4x4 matrix inverse.
+class AffineTForm {
+    Cvec3 t_; // translation component
+    Quat r_;  // rotation component represented as a quaternion
+    Cvec3 s_; // scale along each axis, applied first
+
+  public:
+    constexpr AffineTForm() : t_(0), s_(1) {}
+
+    constexpr AffineTForm(const Cvec3 &t, const Quat &r,
+                          const Cvec3 &s = Cvec3(1))
+        : t_(t), r_(r), s_(s) {}
+
+    constexpr explicit AffineTForm(const RigTForm &tform)
+        : t_(tform.getTranslation()), r_(tform.getRotation()), s_(1) {}
+
+    constexpr Cvec3 getTranslation() const { return t_; }
+
+    constexpr Quat getRotation() const { return r_; }
+
+    constexpr Cvec3 getScale() const { return s_; }
+
+    constexpr AffineTForm &setTranslation(const Cvec3 &t) {
+        t_ = t;
+        return *this;
+    }
+
+    constexpr AffineTForm &setRotation(const Quat &r) {
+        r_ = r;
+        return *this;
+    }
+
+    constexpr AffineTForm &setScale(const Cvec3 &s) {
+        s_ = s;
+        return *this;
+    }
+
+    constexpr Cvec4 operator*(const Cvec4 &a) const {
+        const Cvec4 scaled(a[0] * s_[0], a[1] * s_[1], a[2] * s_[2], a[3]);
+        return Cvec4(t_, 0.0) * a[3] + r_ * scaled;
+    }
+
+    // The transform of shape nodes, from a translation and rotations about
+    // x, then y, then z, in degrees
+    static AffineTForm makeFromEuler(const Cvec3 &translation,
+                                     const Cvec3 &eulerAngles,
+                                     const Cvec3 &scales) {
+        return AffineTForm(translation,
+                           Quat::makeXRotation(eulerAngles[0]) *
+                               Quat::makeYRotation(eulerAngles[1]) *
+                               Quat::makeZRotation(eulerAngles[2]),
+                           scales);
+    }
+};
+
+// A rigid body transform after an affine one is still of the form T R S
+constexpr AffineTForm operator*(const RigTForm &a,
+                                 const AffineTForm &b) {
+    const Quat r = a.getRotation();
+    return AffineTForm(a.getTranslation() +
+                           Cvec3(r * Cvec4(b.getTranslation(), 0)),
+                       r * b.getRotation(), b.getScale());
+}
+
+// The matrices below come out as M, a Matrix4 or a Matrix4f, with no
+// intermediate products, e.g., affineTFormToMatrix<Matrix4f>(tform)
+
+template <class M> inline M affineTFormToMatrix(const AffineTForm &tform) {
+    const Matrix4 r = quatToMatrix(tform.getRotation());
+    const Cvec3 s = tform.getScale(), t = tform.getTranslation();
+    M m;
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            m(i, j) = r(i, j) * s[j];
+        }
+        m(i, 3) = t[i];
+    }
+    return m;
+}
+
+// (R S)^-T = R S^-1, as R is orthogonal
+template <class M> inline M normalMatrix(const AffineTForm &tform) {
+    const Matrix4 r = quatToMatrix(tform.getRotation());
+    const Cvec3 s = tform.getScale();
+    assert(std::abs(s[0] * s[1] * s[2]) > CS175_EPS3);
+    M m;
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            m(i, j) = r(i, j) / s[j];
+        }
+    }
+    return m;
+}
+
+// S^-1 R^-1 T^-1, which in general is not of the form T R S
+template <class M> inline M inverseMatrix(const AffineTForm &tform) {
+    const Matrix4 r = quatToMatrix(tform.getRotation());
+    const Cvec3 s = tform.getScale(), t = tform.getTranslation();
+    assert(std::abs(s[0] * s[1] * s[2]) > CS175_EPS3);
+    M m;
+    for (int i = 0; i < 3; ++i) {
+        double ti = 0;
+        for (int j = 0; j < 3; ++j) {
+            m(i, j) = r(j, i) / s[i];
+            ti -= r(j, i) * t[j];
+        }
+        m(i, 3) = ti / s[i];
+    }
+    return m;
+}
+
+#endif
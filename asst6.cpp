@@ -6,6 +6,8 @@
 //   Professor Steven Gortler
 //
 ////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <chrono>
 #include <cstddef>
 #include <cstring>
 #include <stdlib.h>
@@ -31,8 +33,14 @@
 #include "scenegraph.h"
 #include "sgutils.h"
 #include "asstcommon.h"
+#include "capture.h"
 #include "drawer.h"
+#include "eglcontext.h"
+#include "frameblock.h"
+#include "glstate.h"
 #include "picker.h"
+#include "texstream.h"
+#include "vtexture.h"
 using namespace std;
 // G L O B A L S ///////////////////////////////////////////////////
 static const float g_frustMinFov = 60.0; // A minimal of 60 degree field of view
@@ -43,7 +51,7 @@ static const float g_frustFar = -50.0;  // far plane
 static const float g_groundY = -2.0;    // y coordinate of the ground
 static const float g_groundSize = 10.0; // half the ground length
 enum SkyMode { WORLD_SKY = 0, SKY_SKY = 1 };
-static GLFWwindow *g_window;
+static GLFWwindow *g_window; // NULL in headless runs on Linux, see g_egl
 static int g_windowWidth = 512;
 static int g_windowHeight = 512;
 static double g_wScale = 1;
@@ -63,6 +71,8 @@ static bool g_playingAnimation = true;
 static shared_ptr<Material> g_planetMat, g_astMat, g_sunMat, g_bumpFloorMat,
     g_arcballMat, g_pickingMat, g_lightMat;
 shared_ptr<Material> g_overridingMaterial;
+// per frame uniforms (projection, lights, time) shared by all programs
+static shared_ptr<FrameBlock> g_frameBlock;
 // --------- Geometry
 typedef SgGeometryShapeNode MyShapeNode;
 // Vertex buffer and index buffer associated with the ground and cube geometry
@@ -77,9 +87,23 @@ static shared_ptr<SgRbtNode> g_currentCameraNode;
 static shared_ptr<SgRbtNode> g_currentPickedRbtNode;
 static double g_lastFrameClock;
 static int g_framesPerSecond = 60; // frames to render per second during animation playback
+// With --headless, frames are drawn offscreen at a fixed time step of
+// 1 / g_framesPerSecond, see headlessLoop
+static bool g_headless = false;
+static int g_headlessFrame = 0;
+#ifdef __linux__
+// The context of headless runs on Linux, which need no X display. Never
+// destroyed, since GL objects held by globals are freed during static
+// destruction.
+static EglContext *g_egl = NULL;
+#endif
 /// PLANET GLOBALS
 ///
-static RigTForm initSkyRbt = RigTForm(Cvec3(-1.12, 4.5, -5.91), Quat(.0419, -0.0166, -0.65599, -0.26));
+static constexpr RigTForm initSkyRbt = RigTForm(Cvec3(-1.12, 4.5, -5.91), Quat(.0419, -0.0166, -0.65599, -0.26));
+// The quarter turn about x of every planet, that is,
+// Quat::makeXRotation(90), computed by the compiler
+static constexpr Quat g_planetRotation =
+    Quat::makeXRotation(CS175_SQRT1_2, CS175_SQRT1_2);
 struct PlanetInfo {
     // FROM https://nssdc.gsfc.nasa.gov/planetary/factsheet/
     float diameter;
@@ -107,6 +131,8 @@ static bool toScale = false;
 static bool inLine = false;
 static string planetNames[NUM_PLANETS] = {"Mercury", "Venus", "Earth", "Mars", "Jupiter", "Saturn", "Uranus", "Neptune", "Pluto"
 };
+// Earth's map when tiled as earth.vtex, see initMaterials
+static shared_ptr<VirtualTexture> g_earthVt;
 static shared_ptr<Material> g_mercMat, g_venusMat, g_earthMat, g_marsMat, g_jupiterMat, g_saturnMat, g_neptuneMat, g_uranusMat, g_plutoMat, g_asteroidMat;
 
 default_random_engine generator;
@@ -145,9 +171,9 @@ static void initSphere() {
     g_sphere.reset(new SimpleIndexedGeometryPNTBX(&vtx[0], &idx[0], vtx.size(),
                                                   idx.size()));
 }
-static void sendProjectionMatrix(Uniforms &uniforms,
+static void sendProjectionMatrix(FrameBlock &frameBlock,
                                  const Matrix4 &projMatrix) {
-    uniforms.put("uProjMatrix", projMatrix);
+    frameBlock.setProjectionMatrix(projMatrix);
 }
 // update g_frustFovY from g_frustMinFov, g_windowWidth, and g_windowHeight
 static void updateFrustFovY() {
@@ -222,18 +248,27 @@ static void drawStuff(bool picking) {
     if (!(g_mouseMClickButton || (g_mouseLClickButton && g_mouseRClickButton) ||
           (g_mouseLClickButton && !g_mouseRClickButton && g_spaceDown)))
         updateArcballScale();
-    Uniforms uniforms;
+    // kept across frames so the per shape puts overwrite values in place and
+    // materials keep their uniform bindings
+    static Uniforms uniforms;
     // build & send proj. matrix to vshader
     const Matrix4 projmat = makeProjectionMatrix();
-    sendProjectionMatrix(uniforms, projmat);
+    sendProjectionMatrix(*g_frameBlock, projmat);
     const RigTForm eyeRbt = getPathAccumRbt(g_world, g_currentCameraNode);
     const RigTForm invEyeRbt = inv(eyeRbt);
     Cvec3 l1 = getPathAccumRbt(g_world, g_light1).getTranslation();
 //    Cvec3 l2 = getPathAccumRbt(g_world, g_light2).getTranslation();
-    uniforms.put("uLight", Cvec3(invEyeRbt * Cvec4(l1, 1)));
-//    uniforms.put("uLight2", Cvec3(invEyeRbt * Cvec4(l2, 1)));
+    g_frameBlock->setLight(Cvec3(invEyeRbt * Cvec4(l1, 1)));
+//    g_frameBlock->setLight2(Cvec3(invEyeRbt * Cvec4(l2, 1)));
+    g_frameBlock->setTime(g_headless
+                              ? double(g_headlessFrame) / g_framesPerSecond
+                              : glfwGetTime());
+    g_frameBlock->upload();
     if (!picking) {
-        Drawer drawer(invEyeRbt, uniforms);
+        // pixels per eye space unit at depth 1, for picking material LODs
+        const double pixelsPerUnit =
+            1 / getScreenToEyeScale(-1, g_frustFovY, g_windowHeight);
+        Drawer drawer(invEyeRbt, uniforms, pixelsPerUnit);
         g_world->accept(drawer);
         if (g_displayArcball && shouldUseArcball())
             drawArcBall(uniforms);
@@ -253,9 +288,14 @@ static void drawStuff(bool picking) {
     }
 }
 static void display() {
+    TextureStreamer::getSingleton().update();
+    if (g_earthVt)
+        g_earthVt->update();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     drawStuff(false);
-    glfwSwapBuffers(g_window);
+    FrameCapture::getSingleton().endFrame(g_windowWidth, g_windowHeight);
+    if (g_window)
+        glfwSwapBuffers(g_window);
     checkGlErrors();
 }
 static void pick() {
@@ -424,13 +464,16 @@ static void keyboard(GLFWwindow* window, int key, int scancode, int action, int
                 g_spaceDown = true;
                 break;
             case GLFW_KEY_ESCAPE:
-                exit(0);
+                // glfwLoop saves what is being captured before returning
+                glfwSetWindowShouldClose(window, GLFW_TRUE);
+                break;
             case GLFW_KEY_H:
                 cout << " ============== H E L P ==============\n\n"
                 << "h\t\thelp menu\n"
                 << "\tdrag left mouse to rotate\n"
                 << "\tdrag right mouse button to move\n"
                 << "s\t\tsave screenshot\n"
+                << "c\t\tToggle recording frames (C: to one raw file)\n"
                 << "f\t\tToggle all motion\n"
                 << "v\t\tChange view scale\n"
                 << "m\t\tChange view MODE (sky-sky or sky-world)\n"
@@ -438,13 +481,26 @@ static void keyboard(GLFWwindow* window, int key, int scancode, int action, int
                 << "a\t\tToggle to presets speeds\n"
                 << ">\t\tSpeed up time\n"
                 << "<\t\tSlow down time\n"
-                << "p\t\tPrint info for view (DEBUG)\n"
+                << "p\t\tPrint info for view and GL state counters (DEBUG)\n"
                 << endl;
                 break;
             case GLFW_KEY_S:
-                glFlush();
-                writePpmScreenshot(g_windowWidth, g_windowHeight, "out.ppm");
+                // Saved at the end of the next frame, off the render thread
+                FrameCapture::getSingleton().requestScreenshot("out.ppm");
                 break;
+            case GLFW_KEY_C: {
+                // CS175_RECORD_INTERVAL=n keeps every nth frame
+                FrameCapture &capture = FrameCapture::getSingleton();
+                if (capture.isRecording()) {
+                    capture.stopRecording();
+                } else {
+                    const char *interval = getenv("CS175_RECORD_INTERVAL");
+                    capture.startRecording("frame",
+                                           interval ? atoi(interval) : 1,
+                                           (mods & GLFW_MOD_SHIFT) != 0);
+                    cerr << "Recording frames" << endl;
+                }
+            } break;
             case GLFW_KEY_V: {
                 toScale = !toScale;
                 initScene();
@@ -461,6 +517,8 @@ static void keyboard(GLFWwindow* window, int key, int scancode, int action, int
                 for (int i=0; i < 4; i++){
                     cerr<<q[i]<<"  ";
                 } cerr << "\n";
+                GlState::get().printCounters(cerr);
+                GlState::get().resetCounters();
                 break;}
                 //            g_pickingMode = !g_pickingMode;
                 //            cerr << "Picking mode is " << (g_pickingMode ? "on" : "off") << endl;
@@ -529,21 +587,31 @@ void error_callback(int error, const char* description) {
     fprintf(stderr, "Error: %s\n", description);
 }
 static void initGlfwState() {
+#ifdef __linux__
+    // GLFW 3.3 needs an X display even for an invisible window, which batch
+    // machines do not have, so headless runs make their context with EGL
+    if (g_headless) {
+        g_egl = new EglContext(3, 3);
+        return;
+    }
+#endif
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_SRGB_CAPABLE, GL_TRUE);
-    g_window = glfwCreateWindow(g_windowWidth, g_windowHeight,
-                                "Assignment 8", NULL, NULL);
+    // Elsewhere headless runs use an invisible window
+    glfwWindowHint(GLFW_VISIBLE, g_headless ? GLFW_FALSE : GLFW_TRUE);
+    g_window = glfwCreateWindow(g_windowWidth, g_windowHeight, "Assignment 8",
+                                NULL, NULL);
     if (!g_window) {
         fprintf(stderr, "Failed to create GLFW window or OpenGL context\n");
         exit(1);
     }
     glfwMakeContextCurrent(g_window);
     glewInit();
-    glfwSwapInterval(1);
+    glfwSwapInterval(g_headless ? 0 : 1);
     glfwSetErrorCallback(error_callback);
     glfwSetMouseButtonCallback(g_window, mouse);
     glfwSetCursorPosCallback(g_window, motion);
@@ -567,8 +635,11 @@ static void initGLState() {
     glEnable(GL_CULL_FACE);
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_GREATER);
-    glReadBuffer(GL_BACK);
-        glEnable(GL_FRAMEBUFFER_SRGB);
+    // An EGL context has no back buffer; headless frames are read from FBOs
+    if (g_window)
+        glReadBuffer(GL_BACK);
+    glEnable(GL_FRAMEBUFFER_SRGB);
+    g_frameBlock.reset(new FrameBlock());
 }
 static void initMaterials() {
     // Create some prototype materials
@@ -585,71 +656,73 @@ static void initMaterials() {
     g_astMat.reset(new Material(solid));
     g_astMat->getUniforms().put("uColor", Cvec3f(0, 0, 1));
     
-    // sun material
-    g_sunMat.reset(new Material("./shaders/normal-gl3.vshader",
-                 "./shaders/normal-gl3.fshader"));
-    g_sunMat->getUniforms().put("uTexColor",shared_ptr<ImageTexture>(new ImageTexture("sun.ppm", true)));
-    g_sunMat->getUniforms().put("uTexNormal", shared_ptr<ImageTexture>(new ImageTexture("sun.ppm", false)));
-    
-    // mercury material
-    g_mercMat.reset(new Material("./shaders/normal-gl3.vshader",
-                 "./shaders/normal-gl3.fshader"));
-    g_mercMat->getUniforms().put("uTexColor",shared_ptr<ImageTexture>(new ImageTexture("mercury.ppm", true)));
-    g_mercMat->getUniforms().put("uTexNormal", shared_ptr<ImageTexture>(new ImageTexture("mercury.ppm", false)));
-    
-    // venus material
-    g_venusMat.reset(new Material("./shaders/normal-gl3.vshader",
-                 "./shaders/normal-gl3.fshader"));
-    g_venusMat->getUniforms().put("uTexColor",shared_ptr<ImageTexture>(new ImageTexture("venus.ppm", true)));
-    g_venusMat->getUniforms().put("uTexNormal", shared_ptr<ImageTexture>(new ImageTexture("venus.ppm", false)));
-    
-    // earth material
-    g_earthMat.reset(new Material("./shaders/normal-gl3.vshader",
-                 "./shaders/normal-gl3.fshader"));
-    g_earthMat->getUniforms().put("uTexColor",shared_ptr<ImageTexture>(new ImageTexture("earth.ppm", true)));
-    g_earthMat->getUniforms().put("uTexNormal", shared_ptr<ImageTexture>(new ImageTexture("earth.ppm", false)));
-    
-    // mars material
-    g_marsMat.reset(new Material("./shaders/normal-gl3.vshader",
-                 "./shaders/normal-gl3.fshader"));
-    g_marsMat->getUniforms().put("uTexColor",shared_ptr<ImageTexture>(new ImageTexture("mars.ppm", true)));
-    g_marsMat->getUniforms().put("uTexNormal", shared_ptr<ImageTexture>(new ImageTexture("mars.ppm", false)));
-    
-    // jupiter material
-    g_jupiterMat.reset(new Material("./shaders/normal-gl3.vshader",
-                 "./shaders/normal-gl3.fshader"));
-    g_jupiterMat->getUniforms().put("uTexColor",shared_ptr<ImageTexture>(new ImageTexture("jupiter.ppm", true)));
-    g_jupiterMat->getUniforms().put("uTexNormal", shared_ptr<ImageTexture>(new ImageTexture("jupiter.ppm", false)));
-    
-    // saturn material
-    g_saturnMat.reset(new Material("./shaders/normal-gl3.vshader",
-                 "./shaders/normal-gl3.fshader"));
-    g_saturnMat->getUniforms().put("uTexColor",shared_ptr<ImageTexture>(new ImageTexture("saturn.ppm", true)));
-    g_saturnMat->getUniforms().put("uTexNormal", shared_ptr<ImageTexture>(new ImageTexture("saturn.ppm", false)));
-    
-    // neptune material
-    g_neptuneMat.reset(new Material("./shaders/normal-gl3.vshader",
-                 "./shaders/normal-gl3.fshader"));
-    g_neptuneMat->getUniforms().put("uTexColor",shared_ptr<ImageTexture>(new ImageTexture("neptune.ppm", true)));
-    g_neptuneMat->getUniforms().put("uTexNormal", shared_ptr<ImageTexture>(new ImageTexture("neptune.ppm", false)));
-    
-    // uranus material
-    g_uranusMat.reset(new Material("./shaders/normal-gl3.vshader",
-                 "./shaders/normal-gl3.fshader"));
-    g_uranusMat->getUniforms().put("uTexColor",shared_ptr<ImageTexture>(new ImageTexture("fieldstone.ppm", true)));
-    g_uranusMat->getUniforms().put("uTexNormal", shared_ptr<ImageTexture>(new ImageTexture("uranus.ppm", false)));
-    
-    // pluto material
-    g_plutoMat.reset(new Material("./shaders/normal-gl3.vshader",
-                 "./shaders/normal-gl3.fshader"));
-    g_plutoMat->getUniforms().put("uTexColor",shared_ptr<ImageTexture>(new ImageTexture("pluto.ppm", true)));
-    g_plutoMat->getUniforms().put("uTexNormal", shared_ptr<ImageTexture>(new ImageTexture("pluto.ppm", false)));
-    
-    // asteroid material
-    g_asteroidMat.reset(new Material("./shaders/normal-gl3.vshader",
-                 "./shaders/normal-gl3.fshader"));
-    g_asteroidMat->getUniforms().put("uTexColor",shared_ptr<ImageTexture>(new ImageTexture("asteroid.ppm", true)));
-    g_asteroidMat->getUniforms().put("uTexNormal", shared_ptr<ImageTexture>(new ImageTexture("asteroid.ppm", false)));
+    // The sun, planets and asteroids all use the normal mapping shader with
+    // their own images. Pack the images into one texture array, so these
+    // materials only differ in the layers they select and draw with the same
+    // program and texture bindings. The color map reads the images as sRGB and
+    // the normal map as linear, each from an array with mipmaps filtered for
+    // that.
+    const char *const celestialImages[] = {
+        "sun.ppm",     "mercury.ppm", "venus.ppm",    "earth.ppm",
+        "mars.ppm",    "jupiter.ppm", "saturn.ppm",   "neptune.ppm",
+        "uranus.ppm",  "pluto.ppm",   "asteroid.ppm", "fieldstone.ppm"};
+    const int numCelestials = 11, fieldstoneLayer = 11;
+    const vector<string> images(celestialImages,
+                                celestialImages +
+                                    sizeof(celestialImages) /
+                                        sizeof(celestialImages[0]));
+
+    // CS175_COMPRESS_TEXTURES=1 stores the textures block compressed. The
+    // normal maps then only keep x and y, so the shader has to know.
+    TextureLibrary &textures = TextureLibrary::getSingleton();
+    textures.setCompression(getenv("CS175_COMPRESS_TEXTURES") != NULL);
+    // Load the images in the background, so the window comes up right away.
+    // CS175_NO_TEXTURE_STREAMING loads them all before the first frame.
+    // Headless runs draw every frame complete, so they stay reproducible.
+    textures.setStreaming(!g_headless &&
+                          getenv("CS175_NO_TEXTURE_STREAMING") == NULL);
+    vector<string> celestialDefines;
+    if (textures.getCompression() && StoredTexture::canCompress(false))
+        celestialDefines.push_back("NORMAL_MAP_RG");
+    Material celestial("./shaders/normal-gl3.vshader",
+                       "./shaders/normal-array-gl3.fshader", celestialDefines);
+    // The maps are equirectangular, so the layers are 2:1 too. Larger images
+    // are downsampled to them, and smaller ones upsampled. `make textures'
+    // converts the images at this size (LAYER_SIZE in the Makefile).
+    const int layerWidth = 1024, layerHeight = 512;
+    celestial.getUniforms().put(
+        "uTexColor", shared_ptr<Texture>(textures.getImageTextureArray(
+                         images, true, layerWidth, layerHeight)));
+    celestial.getUniforms().put(
+        "uTexNormal", shared_ptr<Texture>(textures.getImageTextureArray(
+                          images, false, layerWidth, layerHeight)));
+    // Small bodies do not show their normal map or highlight anyway
+    const char *const flat[] = {"NO_NORMAL_MAP"};
+    const char *const flatMatte[] = {"NO_NORMAL_MAP", "NO_SPECULAR"};
+    celestial.addLod(24, vector<string>(flat, flat + 1))
+        .addLod(6, vector<string>(flatMatte, flatMatte + 2));
+
+    shared_ptr<Material> *celestialMats[] = {
+        &g_sunMat,     &g_mercMat,    &g_venusMat,   &g_earthMat,
+        &g_marsMat,    &g_jupiterMat, &g_saturnMat,  &g_neptuneMat,
+        &g_uranusMat,  &g_plutoMat,   &g_asteroidMat};
+    for (int i = 0; i < numCelestials; ++i) {
+        celestialMats[i]->reset(new Material(celestial));
+        (*celestialMats[i])->getUniforms().put("uTexLayer", i).put(
+            "uTexNormalLayer", i);
+    }
+    // uranus is colored with fieldstone
+    g_uranusMat->getUniforms().put("uTexLayer", fieldstoneLayer);
+
+    // A tiled map (mipconvert -tiles 128 earth.ppm) replaces Earth's layer,
+    // for maps too large to load whole. Only the tiles in view are resident.
+    if (ifstream("earth.vtex")) {
+        g_earthVt.reset(new VirtualTexture("earth.vtex"));
+        g_earthMat.reset(new Material("./shaders/normal-gl3.vshader",
+                                      "./shaders/normal-vt-gl3.fshader"));
+        g_earthVt->putUniforms(g_earthMat->getUniforms());
+        g_earthMat->addLod(6, vector<string>(1, "NO_SPECULAR"));
+    }
     
     // copy solid prototype, and set to wireframed rendering
     g_arcballMat.reset(new Material(solid));
@@ -663,6 +736,8 @@ static void initMaterials() {
     // pick shader
     g_pickingMat.reset(new Material("./shaders/basic-gl3.vshader",
                                     "./shaders/pick-gl3.fshader"));
+
+    textures.printStats(cerr);
 };
 static void initGeometry() {
 //    initGround();
@@ -769,9 +844,10 @@ static void constructCelestial(shared_ptr<SgTransformNode> base,
     for (int i = 0; i < NUM_SHAPES; ++i) {
         shared_ptr<MyShapeNode> shape(new MyShapeNode(
             shapeDesc[i].geometry, shapeDesc[i].material,
-            Cvec3(shapeDesc[i].x, shapeDesc[i].y, shapeDesc[i].z),
-            Cvec3(90, 0, 0), // make this 90 to fix materials
-            Cvec3(shapeDesc[i].sx, shapeDesc[i].sy, shapeDesc[i].sz)));
+            AffineTForm(
+                Cvec3(shapeDesc[i].x, shapeDesc[i].y, shapeDesc[i].z),
+                g_planetRotation, // make this 90 to fix materials
+                Cvec3(shapeDesc[i].sx, shapeDesc[i].sy, shapeDesc[i].sz))));
         jointNodes[shapeDesc[i].parentJointId]->addChild(shape);
     }
 }
@@ -951,9 +1027,127 @@ static void glfwLoop() {
         }
         glfwPollEvents();
     }
+
+    // Draw the frame a screenshot was asked for since the last one, and
+    // write out everything still being captured
+    FrameCapture &capture = FrameCapture::getSingleton();
+    if (capture.isScreenshotRequested())
+        display();
+    capture.flush();
 }
+// Options of --headless
+struct HeadlessOptions {
+    int frames;
+    int every;          // keep every nth frame as an image
+    std::string images; // prefix of the images, none if empty
+    std::string timings;
+};
+
+static void headlessLoop(const HeadlessOptions &options) {
+    // There may be no window, or an invisible one whose framebuffer is
+    // missing or not full size
+    GlRenderbuffer color, depth;
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_SRGB8_ALPHA8, g_windowWidth,
+                          g_windowHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, g_windowWidth,
+                          g_windowHeight);
+    GlFramebuffer fbo;
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, depth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw runtime_error("Cannot create the offscreen framebuffer");
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glViewport(0, 0, g_windowWidth, g_windowHeight);
+    updateFrustFovY();
+
+    FrameCapture &capture = FrameCapture::getSingleton();
+    if (!options.images.empty())
+        capture.startRecording(options.images, options.every);
+
+    // Each frame waits for the GPU, so that its time includes the drawing
+    vector<double> times;
+    for (g_headlessFrame = 0; g_headlessFrame < options.frames;
+         ++g_headlessFrame) {
+        // Not glfwGetTime, as GLFW is not initialized with an EGL context
+        const chrono::steady_clock::time_point start =
+            chrono::steady_clock::now();
+        animationUpdate();
+        display();
+        glFinish();
+        const chrono::duration<double, milli> elapsed =
+            chrono::steady_clock::now() - start;
+        times.push_back(elapsed.count());
+    }
+    capture.flush();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    ofstream f(options.timings.c_str());
+    f << "frame,ms\n";
+    for (size_t i = 0; i < times.size(); ++i)
+        f << i << "," << times[i] << "\n";
+    if (!f)
+        throw runtime_error("Cannot write file " + options.timings);
+
+    if (times.empty())
+        return;
+    double total = 0;
+    for (size_t i = 0; i < times.size(); ++i)
+        total += times[i];
+    sort(times.begin(), times.end());
+    cout << times.size() << " frames at " << g_windowWidth << "x"
+         << g_windowHeight << ": mean " << total / times.size()
+         << " ms, median " << times[times.size() / 2] << " ms, 95th "
+         << times[times.size() * 95 / 100] << " ms (" << options.timings
+         << ")" << endl;
+}
+
+// Throws runtime_error on an unknown or incomplete option
+static void parseArgs(int argc, char *argv[], HeadlessOptions &options) {
+    options.frames = 600;
+    options.every = 1;
+    options.timings = "timings.csv";
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "--headless") {
+            g_headless = true;
+            continue;
+        }
+        if (i + 1 == argc)
+            throw runtime_error("Missing value for " + arg);
+        const char *value = argv[++i];
+        if (arg == "--frames") {
+            options.frames = atoi(value);
+        } else if (arg == "--seconds") {
+            options.frames = int(atof(value) * g_framesPerSecond + 0.5);
+        } else if (arg == "--size") {
+            if (sscanf(value, "%dx%d", &g_windowWidth, &g_windowHeight) != 2 ||
+                g_windowWidth <= 0 || g_windowHeight <= 0)
+                throw runtime_error("Invalid size " + string(value));
+        } else if (arg == "--images") {
+            options.images = value;
+        } else if (arg == "--every") {
+            options.every = max(1, atoi(value));
+        } else if (arg == "--timings") {
+            options.timings = value;
+        } else {
+            throw runtime_error(
+                "Unknown option " + arg +
+                "\nUsage: asst6 [--headless] [--frames n | --seconds s]"
+                " [--size WxH] [--images prefix] [--every n]"
+                " [--timings file.csv]");
+        }
+    }
+}
+
 int main(int argc, char *argv[]) {
     try {
+        HeadlessOptions headless;
+        parseArgs(argc, argv, headless);
         initGlfwState();
         // on Mac, we shouldn't use GLEW.
 #ifndef __MAC__
@@ -963,7 +1157,10 @@ int main(int argc, char *argv[]) {
         initMaterials();
         initGeometry();
         initScene();
-        glfwLoop();
+        if (g_headless)
+            headlessLoop(headless);
+        else
+            glfwLoop();
         return 0;
     } catch (const runtime_error &e) {
         cout << "Exception caught: " << e.what() << endl;
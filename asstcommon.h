@@ -17,7 +17,16 @@ extern std::shared_ptr<Material> g_overridingMaterial;
 // takes MVM and its normal matrix to the shaders
 inline void sendModelViewNormalMatrix(Uniforms &uniforms, const Matrix4 &MVM,
                                       const Matrix4 &NMVM) {
-    uniforms.put("uModelViewMatrix", MVM).put("uNormalMatrix", NMVM);
+    static const UniformName uModelViewMatrix("uModelViewMatrix"),
+        uNormalMatrix("uNormalMatrix");
+    uniforms.put(uModelViewMatrix, MVM).put(uNormalMatrix, NMVM);
+}
+
+inline void sendModelViewNormalMatrix(Uniforms &uniforms, const Matrix4f &MVM,
+                                      const Matrix4f &NMVM) {
+    static const UniformName uModelViewMatrix("uModelViewMatrix"),
+        uNormalMatrix("uNormalMatrix");
+    uniforms.put(uModelViewMatrix, MVM).put(uNormalMatrix, NMVM);
 }
 
 #endif
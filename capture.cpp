@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "capture.h"
+
+using namespace std;
+
+FrameCapture &FrameCapture::getSingleton() {
+    static FrameCapture fc;
+    return fc;
+}
+
+FrameCapture::FrameCapture()
+    : nextReadback_(0), recording_(false), raw_(false), interval_(1),
+      frameCount_(0), recorded_(0), maxQueued_(8), writing_(0),
+      stopping_(false) {
+    for (int i = 0; i < NUM_READBACKS; ++i) {
+        readbacks_[i].capacity = 0;
+        readbacks_[i].fence = NULL;
+    }
+}
+
+FrameCapture::~FrameCapture() {
+    if (!writer_.joinable())
+        return;
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    writer_.join();
+}
+
+void FrameCapture::requestScreenshot(const string &filename) {
+    screenshot_ = filename;
+}
+
+void FrameCapture::startRecording(const string &prefix, int interval,
+                                  bool raw) {
+    if (recording_)
+        stopRecording();
+    recording_ = true;
+    raw_ = raw;
+    prefix_ = prefix;
+    interval_ = max(1, interval);
+    frameCount_ = recorded_ = 0;
+}
+
+void FrameCapture::stopRecording() {
+    if (!recording_)
+        return;
+    recording_ = false;
+
+    // The frames still in flight belong to the recording
+    for (int i = 0; i < NUM_READBACKS; ++i) {
+        Readback &r = readbacks_[nextReadback_];
+        if (r.fence)
+            finish(r);
+        nextReadback_ = (nextReadback_ + 1) % NUM_READBACKS;
+    }
+    if (raw_) {
+        Frame close;
+        close.kind = CLOSE_RAW;
+        close.width = close.height = close.number = 0;
+        push(close);
+    }
+    cerr << "Recorded " << recorded_ << " frames" << endl;
+}
+
+void FrameCapture::flush() {
+    stopRecording();
+    for (int i = 0; i < NUM_READBACKS; ++i) {
+        Readback &r = readbacks_[nextReadback_];
+        if (r.fence)
+            finish(r);
+        nextReadback_ = (nextReadback_ + 1) % NUM_READBACKS;
+    }
+
+    if (!writer_.joinable())
+        return;
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    writer_.join();
+    stopping_ = false; // the next push starts a new writer
+}
+
+void FrameCapture::endFrame(int width, int height) {
+    // Queue the readbacks that completed, oldest first so that frames are
+    // written in order
+    for (int i = 0; i < NUM_READBACKS; ++i) {
+        Readback &r = readbacks_[nextReadback_];
+        if (!r.fence ||
+            glClientWaitSync(r.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            break;
+        finish(r);
+        nextReadback_ = (nextReadback_ + 1) % NUM_READBACKS;
+    }
+
+    Frame frame;
+    frame.width = width;
+    frame.height = height;
+    frame.number = 0;
+    // A screenshot taken while recording is written from the same readback,
+    // so that the recording keeps the frame and its cadence
+    frame.screenshot.swap(screenshot_);
+    if (recording_ && frameCount_++ % interval_ == 0) {
+        frame.kind = raw_ ? RAW : PPM;
+        frame.number = recorded_++;
+        if (raw_) {
+            frame.name = prefix_;
+        } else {
+            char number[16];
+            sprintf(number, "%04d", frame.number);
+            frame.name = prefix_ + number + ".ppm";
+        }
+    } else if (!frame.screenshot.empty()) {
+        frame.kind = PPM;
+        frame.name.swap(frame.screenshot);
+    } else {
+        return;
+    }
+
+    // All readbacks busy: the GPU is two captures behind, so wait for it
+    Readback *r = NULL;
+    for (int i = 0; i < NUM_READBACKS && !r; ++i) {
+        Readback &candidate =
+            readbacks_[(nextReadback_ + i) % NUM_READBACKS];
+        if (!candidate.fence)
+            r = &candidate;
+    }
+    if (!r) {
+        r = &readbacks_[nextReadback_];
+        finish(*r);
+        nextReadback_ = (nextReadback_ + 1) % NUM_READBACKS;
+    }
+
+    const size_t bytes = size_t(width) * height * 3;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, r->pbo);
+    if (r->capacity < bytes) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+        r->capacity = bytes;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    r->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    r->frame = frame;
+}
+
+void FrameCapture::finish(Readback &r) {
+    glClientWaitSync(r.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                     GL_TIMEOUT_IGNORED);
+    glDeleteSync(r.fence);
+    r.fence = NULL;
+
+    Frame &frame = r.frame;
+    const size_t rowBytes = size_t(frame.width) * 3;
+    const size_t bytes = rowBytes * frame.height;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (!spare_.empty()) {
+            frame.pixels.swap(spare_.back());
+            spare_.pop_back();
+        }
+    }
+    frame.pixels.resize(bytes);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+    const unsigned char *src = static_cast<const unsigned char *>(
+        glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT));
+    if (src) {
+        // GL reads bottom up; files store the top row first
+        for (int y = 0; y < frame.height; ++y)
+            memcpy(&frame.pixels[rowBytes * (frame.height - 1 - y)],
+                   src + rowBytes * y, rowBytes);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if (src)
+        push(frame);
+    else
+        cerr << "Cannot read back frame for " << frame.name << endl;
+}
+
+void FrameCapture::push(Frame &frame) {
+    {
+        unique_lock<mutex> lock(mutex_);
+        // Started on first use
+        if (!writer_.joinable())
+            writer_ = thread(&FrameCapture::write, this);
+        while (int(queued_.size()) >= maxQueued_)
+            space_.wait(lock);
+        queued_.push_back(Frame());
+        swap(queued_.back(), frame);
+    }
+    wake_.notify_one();
+}
+
+int FrameCapture::getPending() const {
+    lock_guard<mutex> lock(mutex_);
+    return queued_.size() + writing_;
+}
+
+void FrameCapture::write() {
+    for (;;) {
+        Frame frame;
+        {
+            unique_lock<mutex> lock(mutex_);
+            while (queued_.empty() && !stopping_)
+                wake_.wait(lock);
+            if (queued_.empty())
+                return; // stopping, with everything written
+            swap(frame, queued_.front());
+            queued_.pop_front();
+            ++writing_;
+        }
+        space_.notify_one();
+
+        try {
+            writeFrame(frame);
+        } catch (const exception &e) {
+            cerr << "Cannot save frame: " << e.what() << endl;
+        }
+
+        lock_guard<mutex> lock(mutex_);
+        --writing_;
+        if (!frame.pixels.empty() && spare_.size() < size_t(maxQueued_)) {
+            spare_.push_back(vector<unsigned char>());
+            spare_.back().swap(frame.pixels);
+        }
+    }
+}
+
+static void writePpm(const string &filename, int width, int height,
+                     const vector<unsigned char> &pixels) {
+    ofstream f(filename.c_str(), ios::binary);
+    f << "P6 " << width << " " << height << " 255\n";
+    f.write(reinterpret_cast<const char *>(&pixels[0]), pixels.size());
+    if (!f)
+        throw runtime_error("Cannot write file " + filename);
+}
+
+void FrameCapture::writeFrame(Frame &frame) {
+    const size_t bytes = frame.pixels.size();
+    switch (frame.kind) {
+    case PPM:
+        writePpm(frame.name, frame.width, frame.height, frame.pixels);
+        break;
+    case RAW:
+        if (!rawFile_.is_open()) {
+            rawFile_.open((frame.name + ".raw").c_str(), ios::binary);
+            indexFile_.open((frame.name + ".idx").c_str());
+            indexFile_ << "# frame width height offset (RGB8, top row first)"
+                       << endl;
+        }
+        indexFile_ << frame.number << " " << frame.width << " "
+                   << frame.height << " " << rawFile_.tellp() << "\n";
+        rawFile_.write(reinterpret_cast<const char *>(&frame.pixels[0]),
+                       bytes);
+        if (!rawFile_ || !indexFile_)
+            throw runtime_error("Cannot write file " + frame.name + ".raw");
+        break;
+    case CLOSE_RAW:
+        rawFile_.close();
+        indexFile_.close();
+        rawFile_.clear();
+        indexFile_.clear();
+        break;
+    }
+    // After the recording, which a failure here must not lose
+    if (!frame.screenshot.empty())
+        writePpm(frame.screenshot, frame.width, frame.height, frame.pixels);
+}
+
+void writePpmScreenshot(const int width, const int height,
+                        const char *filename) {
+    vector<char> image(width * height * 3);
+
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &image[0]);
+
+    ofstream f(filename, ios::binary);
+    f << "P6 " << width << " " << height << " 255\n";
+    for (int i = 0; i < height; ++i) {
+        f.write(&image[3 * width * (height - 1 - i)], 3 * width);
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "glsupport.h"
+
+// Saves frames without stalling the render loop. The back buffer is read
+// into one of two pixel pack buffers, so glReadPixels returns right away; a
+// frame or two later, once its fence has signaled, the pixels are copied out
+// and handed to a writer thread through a bounded queue.
+//
+// Besides single screenshots it can record every Nth frame, either as
+// numbered PPM files or appended to one raw file with an index. When the
+// writer falls behind by more than the queue holds, endFrame waits for it
+// rather than dropping frames.
+class FrameCapture : Noncopyable {
+  public:
+    static FrameCapture &getSingleton();
+
+    // Writes out whatever is queued
+    ~FrameCapture();
+
+    // Saves the next frame as a binary PPM
+    void requestScreenshot(const std::string &filename);
+
+    // Saves every `interval'th frame from the next one on. As prefix0000.ppm,
+    // prefix0001.ppm and so on, or if `raw', appended to prefix.raw as RGB8
+    // rows top row first, with a line per frame in prefix.idx giving its
+    // number, size and offset in the raw file.
+    void startRecording(const std::string &prefix, int interval = 1,
+                        bool raw = false);
+
+    // Waits for the frames still being read back and closes the recording.
+    // Call on the GL thread.
+    void stopRecording();
+
+    bool isRecording() const { return recording_; }
+
+    // Whether a screenshot is still to be taken at the next endFrame
+    bool isScreenshotRequested() const { return !screenshot_.empty(); }
+
+    // Stops recording, reads back the frames still in flight, screenshots
+    // too, and waits until everything queued is written. Call on the GL
+    // thread before exiting.
+    void flush();
+
+    // Starts reading back the frame just drawn if a capture is due, and
+    // queues the ones read back earlier. Call once per frame on the GL thread,
+    // after drawing and before swapping buffers.
+    void endFrame(int width, int height);
+
+    // 8 frames by default. A 1080p frame is 6 MB.
+    void setMaxQueued(int frames) { maxQueued_ = frames; }
+
+    // Frames read back but not yet written
+    int getPending() const;
+
+  private:
+    enum Kind { PPM, RAW, CLOSE_RAW };
+
+    struct Frame {
+        Kind kind;
+        int width, height;
+        std::string name; // the PPM file, or the raw recording's prefix
+        int number;       // in the recording
+        std::string screenshot; // also saved there as a PPM, if not empty
+        std::vector<unsigned char> pixels; // top row first
+    };
+
+    struct Readback {
+        GlBufferObject pbo;
+        size_t capacity;
+        GLsync fence; // NULL when idle
+        Frame frame;  // without pixels
+    };
+
+    static const int NUM_READBACKS = 2;
+    Readback readbacks_[NUM_READBACKS];
+    int nextReadback_; // the oldest busy one, or the next to use
+
+    // Used by the GL thread only
+    std::string screenshot_;
+    bool recording_, raw_;
+    std::string prefix_;
+    int interval_, frameCount_, recorded_;
+
+    std::thread writer_;
+    mutable std::mutex mutex_;
+    std::condition_variable wake_, space_;
+    std::deque<Frame> queued_;
+    std::vector<std::vector<unsigned char>> spare_; // buffers to reuse
+    int maxQueued_, writing_;
+    bool stopping_;
+
+    // The open raw recording, used by the writer thread only
+    std::ofstream rawFile_, indexFile_;
+
+    FrameCapture();
+
+    // Copies the pixels of a completed readback into a frame and queues it
+    void finish(Readback &r);
+
+    // Hands a frame to the writer, waiting while the queue is full
+    void push(Frame &frame);
+
+    void write();
+    void writeFrame(Frame &frame);
+};
+
+// Reads the bottom-left width x height pixels of the read buffer and writes
+// them as a binary PPM right away, waiting for the GPU to finish the frame.
+// Kept apart from ppm.h, so that the offline tools reading PPM files do not
+// need GL.
+void writePpmScreenshot(const int width, const int height,
+                        const char *filename);
+
+#endif
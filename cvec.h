@@ -5,85 +5,84 @@
 #include <cassert>
 #include <cmath>
 
-static const double CS175_PI = 3.14159265358979323846264338327950288;
-static const double CS175_EPS = 1e-8;
-static const double CS175_EPS2 = CS175_EPS * CS175_EPS;
-static const double CS175_EPS3 = CS175_EPS * CS175_EPS * CS175_EPS;
+// The math headers are constexpr throughout, so that constant vectors,
+// rotations and transforms are computed by the compiler. Only what needs
+// std::sqrt or trigonometry is left to run time.
+constexpr double CS175_PI = 3.14159265358979323846264338327950288;
+constexpr double CS175_SQRT1_2 = 0.70710678118654752440084436210484903;
+constexpr double CS175_EPS = 1e-8;
+constexpr double CS175_EPS2 = CS175_EPS * CS175_EPS;
+constexpr double CS175_EPS3 = CS175_EPS * CS175_EPS * CS175_EPS;
 
 template <typename T, int n> class Cvec {
     T d_[n];
 
   public:
-    Cvec() {
-        for (int i = 0; i < n; ++i) {
-            d_[i] = 0;
-        }
-    }
+    constexpr Cvec() : d_() {}
 
-    explicit Cvec(const T &t) {
+    constexpr explicit Cvec(const T &t) : d_() {
         for (int i = 0; i < n; ++i) {
             d_[i] = t;
         }
     }
 
-    Cvec(const T &t0, const T &t1) {
-        assert(n == 2); // better to use static_assert from c++11
-        d_[0] = t0, d_[1] = t1;
+    constexpr Cvec(const T &t0, const T &t1) : d_{t0, t1} {
+        static_assert(n == 2, "Cvec with 2 elements");
     }
 
-    Cvec(const T &t0, const T &t1, const T &t2) {
-        assert(n == 3); // better to use static_assert from c++11
-        d_[0] = t0, d_[1] = t1, d_[2] = t2;
+    constexpr Cvec(const T &t0, const T &t1, const T &t2) : d_{t0, t1, t2} {
+        static_assert(n == 3, "Cvec with 3 elements");
     }
 
-    Cvec(const T &t0, const T &t1, const T &t2, const T &t3) {
-        assert(n == 4); // better to use static_assert from c++11
-        d_[0] = t0, d_[1] = t1, d_[2] = t2, d_[3] = t3;
+    constexpr Cvec(const T &t0, const T &t1, const T &t2, const T &t3)
+        : d_{t0, t1, t2, t3} {
+        static_assert(n == 4, "Cvec with 4 elements");
     }
 
     // either truncate if m < n, or extend with extendValue
     template <int m>
-    explicit Cvec(const Cvec<T, m> &v, const T &extendValue = T(0)) {
-        for (int i = 0; i < std::min(m, n); ++i) {
+    constexpr explicit Cvec(const Cvec<T, m> &v, const T &extendValue = T(0))
+        : d_() {
+        for (int i = 0; i < (m < n ? m : n); ++i) {
             d_[i] = v[i];
         }
-        for (int i = std::min(m, n); i < n; ++i) {
+        for (int i = (m < n ? m : n); i < n; ++i) {
             d_[i] = extendValue;
         }
     }
 
-    T &operator[](const int i) { return d_[i]; }
+    constexpr T &operator[](const int i) { return d_[i]; }
 
-    const T &operator[](const int i) const { return d_[i]; }
+    constexpr const T &operator[](const int i) const { return d_[i]; }
 
-    T &operator()(const int i) { return d_[i]; }
+    constexpr T &operator()(const int i) { return d_[i]; }
 
-    const T &operator()(const int i) const { return d_[i]; }
+    constexpr const T &operator()(const int i) const { return d_[i]; }
 
-    Cvec operator-() const { return Cvec(*this) *= -1; }
+    constexpr Cvec operator-() const { return Cvec(*this) *= -1; }
 
-    Cvec &operator+=(const Cvec &v) {
+    constexpr Cvec &operator+=(const Cvec &v) {
         for (int i = 0; i < n; ++i) {
             d_[i] += v[i];
         }
         return *this;
     }
 
-    Cvec &operator-=(const Cvec &v) {
+    constexpr Cvec &operator-=(const Cvec &v) {
         for (int i = 0; i < n; ++i) {
             d_[i] -= v[i];
         }
         return *this;
     }
 
-    Cvec &operator*=(const T a) {
+    constexpr Cvec &operator*=(const T a) {
         for (int i = 0; i < n; ++i) {
             d_[i] *= a;
         }
         return *this;
     }
 
-    Cvec &operator/=(const T a) {
+    constexpr Cvec &operator/=(const T a) {
         const T inva(1 / a);
         for (int i = 0; i < n; ++i) {
             d_[i] *= inva;
@@ -91,13 +90,13 @@ template <typename T, int n> class Cvec {
         return *this;
     }
 
-    Cvec operator+(const Cvec &v) const { return Cvec(*this) += v; }
+    constexpr Cvec operator+(const Cvec &v) const { return Cvec(*this) += v; }
 
-    Cvec operator-(const Cvec &v) const { return Cvec(*this) -= v; }
+    constexpr Cvec operator-(const Cvec &v) const { return Cvec(*this) -= v; }
 
-    Cvec operator*(const T a) const { return Cvec(*this) *= a; }
+    constexpr Cvec operator*(const T a) const { return Cvec(*this) *= a; }
 
-    Cvec operator/(const T a) const { return Cvec(*this) /= a; }
+    constexpr Cvec operator/(const T a) const { return Cvec(*this) /= a; }
 
     // Normalize self and returns self
     Cvec &normalize() {
@@ -107,13 +106,13 @@ template <typename T, int n> class Cvec {
 };
 
 template <typename T>
-inline Cvec<T, 3> cross(const Cvec<T, 3> &a, const Cvec<T, 3> &b) {
+constexpr Cvec<T, 3> cross(const Cvec<T, 3> &a, const Cvec<T, 3> &b) {
     return Cvec<T, 3>(a(1) * b(2) - a(2) * b(1), a(2) * b(0) - a(0) * b(2),
                       a(0) * b(1) - a(1) * b(0));
 }
 
 template <typename T, int n>
-inline T dot(const Cvec<T, n> &a, const Cvec<T, n> &b) {
+constexpr T dot(const Cvec<T, n> &a, const Cvec<T, n> &b) {
     T r(0);
     for (int i = 0; i < n; ++i) {
         r += a(i) * b(i);
@@ -121,7 +120,7 @@ inline T dot(const Cvec<T, n> &a, const Cvec<T, n> &b) {
     return r;
 }
 
-template <typename T, int n> inline T norm2(const Cvec<T, n> &v) {
+template <typename T, int n> constexpr T norm2(const Cvec<T, n> &v) {
     return dot(v, v);
 }
 
@@ -137,15 +136,16 @@ template <typename T, int n> inline Cvec<T, n> normalize(const Cvec<T, n> &v) {
 }
 
 template <typename T, int n>
-inline Cvec<T, n> lerp(const Cvec<T, n> &v0, const Cvec<T, n> &v1, T t) {
+constexpr Cvec<T, n> lerp(const Cvec<T, n> &v0, const Cvec<T, n> &v1, T t) {
     return v0 + (v1 - v0) * t;
 }
 
 template <typename T, int n>
-inline Cvec<T, n> interpolateCatmullRom(const Cvec<T, n> &v0,
-                                        const Cvec<T, n> &v1,
-                                        const Cvec<T, n> &v2,
-                                        const Cvec<T, n> &v3, const double t) {
+constexpr Cvec<T, n> interpolateCatmullRom(const Cvec<T, n> &v0,
+                                           const Cvec<T, n> &v1,
+                                           const Cvec<T, n> &v2,
+                                           const Cvec<T, n> &v3,
+                                           const double t) {
     const double t2 = t * t, t3 = t2 * t;
     const double s = 1 - t, s2 = s * s, s3 = s * s2;
     const Cvec<T, n> i1 = v1 + (v2 - v0) * (1 / 6.0);
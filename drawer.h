@@ -1,9 +1,13 @@
 #ifndef DRAWER_H
 #define DRAWER_H
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
+#include "affinetform.h"
 #include "asstcommon.h"
+#include "matrix4f.h"
 #include "scenegraph.h"
 #include "uniforms.h"
 
@@ -11,10 +15,16 @@ class Drawer : public SgNodeVisitor {
   protected:
     std::vector<RigTForm> rbtStack_;
     Uniforms &uniforms_;
+    double pixelsPerUnit_;
 
   public:
-    Drawer(const RigTForm &initialRbt, Uniforms &uniforms)
-        : rbtStack_(1, initialRbt), uniforms_(uniforms) {}
+    // If `pixelsPerUnit' (the screen size in pixels of one eye space unit at
+    // depth -1) is positive, the approximate screen radius of each shape is
+    // put as Material::SCREEN_RADIUS, for materials with LODs
+    Drawer(const RigTForm &initialRbt, Uniforms &uniforms,
+           double pixelsPerUnit = 0)
+        : rbtStack_(1, initialRbt), uniforms_(uniforms),
+          pixelsPerUnit_(pixelsPerUnit) {}
 
     virtual bool visit(SgTransformNode &node) {
         rbtStack_.push_back(rbtStack_.back() * node.getRbt());
@@ -27,9 +37,16 @@ class Drawer : public SgNodeVisitor {
     }
 
     virtual bool visit(SgShapeNode &shapeNode) {
-        const Matrix4 MVM =
-            rigTFormToMatrix(rbtStack_.back()) * shapeNode.getAffineMatrix();
-        sendModelViewNormalMatrix(uniforms_, MVM, normalMatrix(MVM));
+        // The frames are composed in double, for the range of distances of
+        // the scene, and in closed form; the matrices come out in float, as
+        // GL takes them
+        const AffineTForm modelView =
+            rbtStack_.back() * shapeNode.getAffineTForm();
+        sendModelViewNormalMatrix(uniforms_,
+                                  affineTFormToMatrix<Matrix4f>(modelView),
+                                  normalMatrix<Matrix4f>(modelView));
+        if (pixelsPerUnit_ > 0)
+            sendScreenRadius(modelView);
         shapeNode.draw(uniforms_);
         return true;
     }
@@ -37,6 +54,23 @@ class Drawer : public SgNodeVisitor {
     virtual bool postVisit(SgShapeNode &shapeNode) { return true; }
 
     Uniforms &getUniforms() { return uniforms_; }
+
+  protected:
+    // Screen radius of the unit ball in object space, which bounds the
+    // geometry made by geometrymaker.h
+    void sendScreenRadius(const AffineTForm &modelView) {
+        static const UniformName screenRadius(Material::SCREEN_RADIUS);
+
+        const Cvec3 s = modelView.getScale();
+        const double maxScale = std::max(
+            std::abs(s[0]), std::max(std::abs(s[1]), std::abs(s[2])));
+        const double depth = -modelView.getTranslation()[2];
+        const float r =
+            depth > CS175_EPS
+                ? float(maxScale * pixelsPerUnit_ / depth)
+                : 1e30f; // at or behind the eye, treat as huge
+        uniforms_.put(screenRadius, r);
+    }
 };
 
 #endif
@@ -0,0 +1,130 @@
+#ifdef __linux__
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "eglcontext.h"
+
+using namespace std;
+
+// Whether a space separated extension string lists `name'
+static bool hasExtension(const char *extensions, const char *name) {
+    if (extensions == NULL)
+        return false;
+    const size_t n = strlen(name);
+    for (const char *p = extensions; (p = strstr(p, name)) != NULL; p += n) {
+        if ((p == extensions || p[-1] == ' ') && (p[n] == ' ' || p[n] == 0))
+            return true;
+    }
+    return false;
+}
+
+// The displays to try, in the order given in eglcontext.h
+static vector<EGLDisplay> getDisplays() {
+    // NULL without EGL_EXT_client_extensions
+    const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = NULL;
+    if (hasExtension(extensions, "EGL_EXT_platform_base"))
+        getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+            eglGetProcAddress("eglGetPlatformDisplayEXT"));
+
+    vector<EGLDisplay> displays;
+    if (getPlatformDisplay &&
+        hasExtension(extensions, "EGL_EXT_platform_device")) {
+        PFNEGLQUERYDEVICESEXTPROC queryDevices =
+            reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(
+                eglGetProcAddress("eglQueryDevicesEXT"));
+        EGLDeviceEXT devices[8];
+        EGLint numDevices = 0;
+        if (queryDevices && queryDevices(8, devices, &numDevices)) {
+            for (int i = 0; i < numDevices; ++i)
+                displays.push_back(getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT,
+                                                      devices[i], NULL));
+        }
+    }
+    if (getPlatformDisplay &&
+        hasExtension(extensions, "EGL_MESA_platform_surfaceless"))
+        displays.push_back(getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                              EGL_DEFAULT_DISPLAY, NULL));
+    displays.push_back(eglGetDisplay(EGL_DEFAULT_DISPLAY));
+    return displays;
+}
+
+// Makes a context of the version current on the initialized `display',
+// without a surface if the display allows, otherwise with a 1 x 1 pbuffer.
+// Returns false, with nothing left to destroy, if it cannot.
+static bool makeCurrent(EGLDisplay display, int major, int minor,
+                        EGLContext &context, EGLSurface &surface) {
+    if (!eglBindAPI(EGL_OPENGL_API))
+        return false;
+    const bool surfaceless =
+        hasExtension(eglQueryString(display, EGL_EXTENSIONS),
+                     "EGL_KHR_surfaceless_context");
+
+    // A surface type of 0 matches any config
+    const EGLint configAttribs[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_SURFACE_TYPE,
+        surfaceless ? 0 : EGL_PBUFFER_BIT, EGL_NONE};
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) ||
+        numConfigs == 0)
+        return false;
+
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, major, EGL_CONTEXT_MINOR_VERSION, minor,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE};
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+    if (context == EGL_NO_CONTEXT)
+        return false;
+
+    surface = EGL_NO_SURFACE;
+    if (!surfaceless) {
+        const EGLint pbufferAttribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+        surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+    }
+    if ((surfaceless || surface != EGL_NO_SURFACE) &&
+        eglMakeCurrent(display, surface, surface, context))
+        return true;
+
+    if (surface != EGL_NO_SURFACE)
+        eglDestroySurface(display, surface);
+    eglDestroyContext(display, context);
+    return false;
+}
+
+EglContext::EglContext(int major, int minor)
+    : display_(EGL_NO_DISPLAY), context_(EGL_NO_CONTEXT),
+      surface_(EGL_NO_SURFACE) {
+    const vector<EGLDisplay> displays = getDisplays();
+    for (size_t i = 0; i < displays.size(); ++i) {
+        EGLDisplay display = displays[i];
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+            continue;
+        EGLContext context;
+        EGLSurface surface;
+        if (makeCurrent(display, major, minor, context, surface)) {
+            display_ = display;
+            context_ = context;
+            surface_ = surface;
+            return;
+        }
+        eglTerminate(display);
+    }
+    throw runtime_error("Cannot create an EGL context without a window");
+}
+
+EglContext::~EglContext() {
+    eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (surface_ != EGL_NO_SURFACE)
+        eglDestroySurface(display_, surface_);
+    eglDestroyContext(display_, context_);
+    eglTerminate(display_);
+}
+
+#endif
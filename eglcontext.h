@@ -0,0 +1,30 @@
+#ifndef EGLCONTEXT_H
+#define EGLCONTEXT_H
+
+#include "glsupport.h"
+
+// An OpenGL core context made current without any window or display server,
+// for --headless runs on machines with no X display. Created through EGL, on
+// the first of:
+//
+// - a GPU found with EGL_EXT_platform_device
+// - Mesa's surfaceless platform (EGL_MESA_platform_surfaceless), which falls
+//   back to its software rasterizer
+// - the default display
+//
+// The context has no default framebuffer worth drawing to, so everything is
+// drawn into framebuffer objects. Linux only, as EGL is rarely found
+// elsewhere.
+class EglContext : Noncopyable {
+  public:
+    // Throws runtime_error if no display offers a context of that version
+    EglContext(int major, int minor);
+    ~EglContext();
+
+  private:
+    // EGLDisplay, EGLContext and EGLSurface, which are all pointers, kept
+    // opaque so the EGL headers stay out of the files including this
+    void *display_, *context_, *surface_;
+};
+
+#endif
@@ -0,0 +1,43 @@
+#include "frameblock.h"
+
+const char *const FrameBlock::NAME = "FrameBlock";
+
+FrameBlock::FrameBlock() {
+    Matrix4().writeToColumnMajorMatrix(data_.projMatrix);
+    setLight(Cvec3(0)).setLight2(Cvec3(0)).setTime(0);
+    data_.pad0 = 0;
+
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo_);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(Std140), NULL, GL_DYNAMIC_DRAW);
+    checkGlErrors();
+}
+
+FrameBlock &FrameBlock::setProjectionMatrix(const Matrix4 &projMatrix) {
+    projMatrix.writeToColumnMajorMatrix(data_.projMatrix);
+    return *this;
+}
+
+FrameBlock &FrameBlock::setLight(const Cvec3 &eyePos) {
+    for (int i = 0; i < 3; ++i)
+        data_.light[i] = float(eyePos[i]);
+    return *this;
+}
+
+FrameBlock &FrameBlock::setLight2(const Cvec3 &eyePos) {
+    for (int i = 0; i < 3; ++i)
+        data_.light2[i] = float(eyePos[i]);
+    return *this;
+}
+
+FrameBlock &FrameBlock::setTime(float time) {
+    data_.time = time;
+    return *this;
+}
+
+void FrameBlock::upload() {
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo_);
+    // orphan the old storage so we don't stall on last frame's draws
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(Std140), NULL, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Std140), &data_);
+    glBindBufferBase(GL_UNIFORM_BUFFER, BINDING, ubo_);
+}
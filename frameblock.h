@@ -0,0 +1,47 @@
+#ifndef FRAMEBLOCK_H
+#define FRAMEBLOCK_H
+
+#include "cvec.h"
+#include "glsupport.h"
+#include "matrix4.h"
+
+// Per frame uniforms shared by all GL3 programs. The shaders declare
+//
+//   layout(std140) uniform FrameBlock {
+//     mat4 uProjMatrix;
+//     vec3 uLight, uLight2; // lights in eye space
+//     float uTime;
+//   };
+//
+// Material binds that block of every program to FrameBlock::BINDING, so one
+// upload per frame feeds every draw, regardless of program.
+class FrameBlock : Noncopyable {
+  public:
+    static const GLuint BINDING = 0;
+    static const char *const NAME;
+
+    FrameBlock();
+
+    FrameBlock &setProjectionMatrix(const Matrix4 &projMatrix);
+    FrameBlock &setLight(const Cvec3 &eyePos);
+    FrameBlock &setLight2(const Cvec3 &eyePos);
+    FrameBlock &setTime(float time);
+
+    // Uploads the current values and binds the buffer to BINDING
+    void upload();
+
+  private:
+    // Mirrors the std140 layout of the GLSL block above
+    struct Std140 {
+        float projMatrix[16]; // offset 0
+        float light[3];       // offset 64
+        float pad0;
+        float light2[3]; // offset 80
+        float time;      // offset 92
+    };
+
+    Std140 data_;
+    GlBufferObject ubo_;
+};
+
+#endif
@@ -456,6 +456,11 @@ public:
     ibo->upload(indices, numIndices, true);
   }
 
+  // For deforming meshes: new vertices, same indices
+  void uploadVertices(const Vertex* vertices, int numVertices) {
+    vbo->upload(vertices, numVertices, true);
+  }
+
 private:
   GLenum size2IboFmt(int size) {
     if (size == 1)
@@ -479,4 +484,7 @@ typedef SimpleIndexedGeometry<VertexPN, unsigned short> SimpleIndexedGeometryPN;
 typedef SimpleIndexedGeometry<VertexPNX, unsigned short> SimpleIndexedGeometryPNX;
 typedef SimpleIndexedGeometry<VertexPNTBX, unsigned short> SimpleIndexedGeometryPNTBX;
 
+// For meshes with more than 65536 vertices
+typedef SimpleIndexedGeometry<VertexPN, unsigned int> SimpleIndexedGeometryPN32;
+
 #endif
@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+#include "glstate.h"
+
+using namespace std;
+
+// Never a valid object name or enum, so any real value differs from it
+static const GLuint kUnknown = ~0u;
+
+GlState &GlState::get() {
+    // Never destroyed, since textures and programs held by globals call
+    // forget*() during static destruction
+    static GlState *state = new GlState();
+    return *state;
+}
+
+GlState::GlState() {
+    invalidate();
+    resetCounters();
+}
+
+int GlState::targetIndex(GLenum target) {
+    switch (target) {
+    case GL_TEXTURE_1D:
+        return TARGET_1D;
+    case GL_TEXTURE_2D:
+        return TARGET_2D;
+    case GL_TEXTURE_3D:
+        return TARGET_3D;
+    case GL_TEXTURE_CUBE_MAP:
+        return TARGET_CUBE;
+    case GL_TEXTURE_2D_ARRAY:
+        return TARGET_2D_ARRAY;
+    default:;
+    }
+    throw invalid_argument("GlState::bindTexture: unsupported target");
+}
+
+void GlState::useProgram(GLuint program) {
+    if (count(USE_PROGRAM, program != program_)) {
+        ::glUseProgram(program);
+        program_ = program;
+    }
+}
+
+void GlState::activeTexture(GLuint unit) {
+    // Nothing reaches GL until a bind actually needs this unit
+    if (unit >= units_.size()) {
+        Unit u;
+        fill(u.textures, u.textures + NUM_TARGETS, kUnknown);
+        u.sampler = kUnknown;
+        units_.resize(unit + 1, u);
+    }
+    pendingUnit_ = unit;
+}
+
+void GlState::bindTexture(GLenum target, GLuint texture) {
+    if (pendingUnit_ >= units_.size())
+        activeTexture(pendingUnit_);
+
+    GLuint &bound = units_[pendingUnit_].textures[targetIndex(target)];
+    if (!count(BIND_TEXTURE, bound != texture)) {
+        count(ACTIVE_TEXTURE, false);
+        return;
+    }
+
+    if (count(ACTIVE_TEXTURE, activeUnit_ != pendingUnit_)) {
+        ::glActiveTexture(GL_TEXTURE0 + pendingUnit_);
+        activeUnit_ = pendingUnit_;
+    }
+    ::glBindTexture(target, texture);
+    bound = texture;
+}
+
+void GlState::bindForEdit(GLenum target, GLuint texture) {
+    if (activeUnit_ == kUnknown) {
+        count(ACTIVE_TEXTURE, true);
+        ::glActiveTexture(GL_TEXTURE0);
+        activeUnit_ = 0;
+    }
+    // Whatever unit GL has active serves, which spares a glActiveTexture
+    const GLuint pending = pendingUnit_;
+    pendingUnit_ = activeUnit_;
+    bindTexture(target, texture);
+    pendingUnit_ = pending;
+}
+
+void GlState::bindSampler(GLuint sampler) {
+    // glBindSampler takes the unit directly, no glActiveTexture needed
+    if (pendingUnit_ >= units_.size())
+        activeTexture(pendingUnit_);
+
+    GLuint &bound = units_[pendingUnit_].sampler;
+    if (count(BIND_SAMPLER, bound != sampler)) {
+        ::glBindSampler(pendingUnit_, sampler);
+        bound = sampler;
+    }
+}
+
+void GlState::bindVertexArray(GLuint vao) {
+    if (count(BIND_VERTEX_ARRAY, vao != vao_)) {
+        ::glBindVertexArray(vao);
+        vao_ = vao;
+    }
+}
+
+void GlState::polygonMode(GLenum mode) {
+    if (count(POLYGON_MODE, mode != polygonMode_)) {
+        ::glPolygonMode(GL_FRONT_AND_BACK, mode);
+        polygonMode_ = mode;
+    }
+}
+
+void GlState::blendFunc(GLenum sfactor, GLenum dfactor) {
+    if (count(BLEND_FUNC, sfactor != blendSrc_ || dfactor != blendDst_)) {
+        ::glBlendFunc(sfactor, dfactor);
+        blendSrc_ = sfactor;
+        blendDst_ = dfactor;
+    }
+}
+
+void GlState::cullFace(GLenum mode) {
+    if (count(CULL_FACE, mode != cullFace_)) {
+        ::glCullFace(mode);
+        cullFace_ = mode;
+    }
+}
+
+void GlState::setEnabled(GLenum cap, bool enabled) {
+    int *current;
+    switch (cap) {
+    case GL_BLEND:
+        current = &blend_;
+        break;
+    case GL_CULL_FACE:
+        current = &cullFaceEnabled_;
+        break;
+    default:
+        throw invalid_argument("GlState::setEnabled: unsupported capability");
+    }
+
+    if (count(ENABLE_DISABLE, *current != int(enabled))) {
+        if (enabled)
+            ::glEnable(cap);
+        else
+            ::glDisable(cap);
+        *current = enabled;
+    }
+}
+
+void GlState::forgetProgram(GLuint program) {
+    if (program_ == program)
+        program_ = kUnknown;
+}
+
+void GlState::forgetTexture(GLuint texture) {
+    for (size_t i = 0; i < units_.size(); ++i) {
+        for (int j = 0; j < NUM_TARGETS; ++j) {
+            if (units_[i].textures[j] == texture)
+                units_[i].textures[j] = kUnknown;
+        }
+    }
+}
+
+void GlState::forgetSampler(GLuint sampler) {
+    for (size_t i = 0; i < units_.size(); ++i) {
+        if (units_[i].sampler == sampler)
+            units_[i].sampler = kUnknown;
+    }
+}
+
+void GlState::forgetVertexArray(GLuint vao) {
+    if (vao_ == vao)
+        vao_ = kUnknown;
+}
+
+void GlState::invalidate() {
+    program_ = kUnknown;
+    vao_ = kUnknown;
+    activeUnit_ = kUnknown;
+    pendingUnit_ = 0;
+    units_.clear();
+
+    polygonMode_ = kUnknown;
+    blendSrc_ = blendDst_ = kUnknown;
+    cullFace_ = kUnknown;
+    blend_ = cullFaceEnabled_ = -1;
+}
+
+void GlState::resetCounters() {
+    fill(counters_.issued, counters_.issued + NUM_CALLS, 0);
+    fill(counters_.elided, counters_.elided + NUM_CALLS, 0);
+}
+
+void GlState::printCounters(ostream &os) const {
+    static const char *const names[NUM_CALLS] = {
+        "glUseProgram",  "glActiveTexture",   "glBindTexture",
+        "glBindSampler", "glBindVertexArray", "glPolygonMode",
+        "glBlendFunc",   "glCullFace",        "glEnable/Disable"};
+
+    unsigned long long totalIssued = 0, totalElided = 0;
+    os << "GL state calls (issued / elided):\n";
+    for (int i = 0; i < NUM_CALLS; ++i) {
+        os << "  " << left << setw(18) << names[i] << right << setw(10)
+           << counters_.issued[i] << " / " << counters_.elided[i] << "\n";
+        totalIssued += counters_.issued[i];
+        totalElided += counters_.elided[i];
+    }
+    os << "  " << left << setw(18) << "total" << right << setw(10)
+       << totalIssued << " / " << totalElided << endl;
+}
@@ -0,0 +1,125 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <iosfwd>
+#include <vector>
+
+#include "glsupport.h"
+
+// Shadow copy of the GL context state that the renderer changes per draw:
+//
+// - the current program            (glUseProgram)
+// - the active texture unit        (glActiveTexture)
+// - the textures bound to each unit, per target (glBindTexture)
+// - the sampler object bound to each unit (glBindSampler)
+// - the vertex array object        (glBindVertexArray)
+// - glPolygonMode, glBlendFunc, glCullFace
+// - GL_BLEND and GL_CULL_FACE      (glEnable/glDisable)
+//
+// Each setter compares against the shadow and only calls into GL on an actual
+// transition. Selecting the active texture unit is deferred until a texture
+// is actually bound, so rebinding the same textures costs no GL calls at all.
+// Code that edits a texture binds it with bindForEdit instead.
+//
+// Everything that touches the above states has to go through
+// GlState::get(), otherwise the shadow goes stale. If some code has to bypass
+// it, call invalidate() afterwards.
+class GlState : Noncopyable {
+  public:
+    enum Call {
+        USE_PROGRAM,
+        ACTIVE_TEXTURE,
+        BIND_TEXTURE,
+        BIND_SAMPLER,
+        BIND_VERTEX_ARRAY,
+        POLYGON_MODE,
+        BLEND_FUNC,
+        CULL_FACE,
+        ENABLE_DISABLE,
+        NUM_CALLS
+    };
+
+    struct Counters {
+        unsigned long long issued[NUM_CALLS];
+        unsigned long long elided[NUM_CALLS];
+    };
+
+    // The state of the (single) GL context. Starts out unknown, so the first
+    // call of each setter always reaches GL.
+    static GlState &get();
+
+    void useProgram(GLuint program);
+
+    // Selects the texture unit the next bindTexture applies to (as a unit
+    // index, not GL_TEXTUREi).
+    void activeTexture(GLuint unit);
+    void bindTexture(GLenum target, GLuint texture);
+
+    // Binds `texture' on the unit GL has active, for the glTex* calls that
+    // follow to edit it. bindTexture may leave GL on another unit than the
+    // one selected, when it skips the bind.
+    void bindForEdit(GLenum target, GLuint texture);
+    void bindSampler(GLuint sampler); // 0 for the texture's own parameters
+
+    void bindVertexArray(GLuint vao);
+
+    void polygonMode(GLenum mode); // always GL_FRONT_AND_BACK
+    void blendFunc(GLenum sfactor, GLenum dfactor);
+    void cullFace(GLenum mode);
+    void setEnabled(GLenum cap, bool enabled); // GL_BLEND or GL_CULL_FACE
+
+    // Forgets about a deleted object, so that a reused name is not mistaken
+    // for the bound one.
+    void forgetProgram(GLuint program);
+    void forgetTexture(GLuint texture);
+    void forgetSampler(GLuint sampler);
+    void forgetVertexArray(GLuint vao);
+
+    // Marks everything unknown, e.g., after code that bypasses GlState
+    void invalidate();
+
+    const Counters &getCounters() const { return counters_; }
+    void resetCounters();
+    void printCounters(std::ostream &os) const;
+
+  private:
+    // Texture targets tracked per unit
+    enum {
+        TARGET_1D,
+        TARGET_2D,
+        TARGET_3D,
+        TARGET_CUBE,
+        TARGET_2D_ARRAY,
+        NUM_TARGETS
+    };
+
+    struct Unit {
+        GLuint textures[NUM_TARGETS];
+        GLuint sampler;
+    };
+
+    GLuint program_;
+    GLuint vao_;
+    GLuint activeUnit_;  // unit selected in GL
+    GLuint pendingUnit_; // unit selected by activeTexture()
+    std::vector<Unit> units_;
+
+    GLenum polygonMode_;
+    GLenum blendSrc_, blendDst_;
+    GLenum cullFace_;
+    int blend_, cullFaceEnabled_; // 0 or 1, -1 if unknown
+
+    Counters counters_;
+
+    GlState();
+
+    static int targetIndex(GLenum target);
+
+    // Records one call of kind `c', returns `changed'
+    bool count(Call c, bool changed) {
+        ++(changed ? counters_.issued : counters_.elided)[c];
+        return changed;
+    }
+};
+
+#endif
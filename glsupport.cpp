@@ -19,8 +19,7 @@ void checkGlErrors() {
     }
 }
 
-// Dump text file into a character vector, throws exception on error
-static void readTextFile(const char *fn, vector<char> &data) {
+void readTextFile(const char *fn, vector<char> &data) {
     // Sets ios::binary bit to prevent end of line translation, so that the
     // number of bytes we read equals file size
     ifstream ifs(fn, ios::binary);
@@ -64,12 +63,20 @@ static void printShaderInfoLog(GLuint obj, const string &filename) {
 
 static void compileShader(GLuint shaderHandle, int sourceLength,
                           const char *source, const char *filenameHint) {
+    submitShaderCompile(shaderHandle, sourceLength, source);
+    resolveShaderCompile(shaderHandle, filenameHint);
+}
+
+void submitShaderCompile(GLuint shaderHandle, int sourceLength,
+                         const char *source) {
     const char *ptrs[] = {source};
     const GLint lens[] = {sourceLength};
     glShaderSource(shaderHandle, 1, ptrs, lens); // load the shader sources
 
     glCompileShader(shaderHandle);
+}
 
+void resolveShaderCompile(GLuint shaderHandle, const char *filenameHint) {
     printShaderInfoLog(shaderHandle, filenameHint);
 
     GLint compiled = 0;
@@ -89,15 +96,18 @@ void readAndCompileSingleShader(GLuint shaderHandle, const char *fn) {
     compileShader(shaderHandle, source.size(), &source[0], fn);
 }
 
-void linkShader(GLuint programHandle, GLuint vs, GLuint fs) {
+void submitLink(GLuint programHandle, GLuint vs, GLuint fs) {
     glAttachShader(programHandle, vs);
     glAttachShader(programHandle, fs);
 
     glLinkProgram(programHandle);
 
+    // Detaching does not affect the (possibly still in progress) link
     glDetachShader(programHandle, vs);
     glDetachShader(programHandle, fs);
+}
 
+void resolveLink(GLuint programHandle) {
     GLint linked = 0;
     glGetProgramiv(programHandle, GL_LINK_STATUS, &linked);
     printProgramInfoLog(programHandle, "linking");
@@ -106,6 +116,52 @@ void linkShader(GLuint programHandle, GLuint vs, GLuint fs) {
         throw runtime_error("fails to link shaders");
 }
 
+void linkShader(GLuint programHandle, GLuint vs, GLuint fs) {
+    submitLink(programHandle, vs, fs);
+    resolveLink(programHandle);
+}
+
+// From GL_KHR_parallel_shader_compile, which GLEW here predates. The ARB
+// version of the extension has the same entry point and enums.
+typedef void(APIENTRY *PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+bool hasGlExtension(const char *name) {
+    GLint numExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (int i = 0; i < numExtensions; ++i) {
+        const char *ext =
+            reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+        if (ext != NULL && string(ext) == name)
+            return true;
+    }
+    return false;
+}
+
+bool hasGlVersion(int major, int minor) {
+    GLint actualMajor = 0, actualMinor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &actualMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &actualMinor);
+    return actualMajor > major || (actualMajor == major && actualMinor >= minor);
+}
+
+bool enableParallelShaderCompile() {
+    const char *proc;
+    if (hasGlExtension("GL_KHR_parallel_shader_compile"))
+        proc = "glMaxShaderCompilerThreadsKHR";
+    else if (hasGlExtension("GL_ARB_parallel_shader_compile"))
+        proc = "glMaxShaderCompilerThreadsARB";
+    else
+        return false;
+
+    PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads =
+        reinterpret_cast<PFNGLMAXSHADERCOMPILERTHREADSKHRPROC>(
+            glfwGetProcAddress(proc));
+    if (maxShaderCompilerThreads == NULL)
+        return false;
+    maxShaderCompilerThreads(0xFFFFFFFFu); // as many as the driver likes
+    return true;
+}
+
 void readAndCompileShader(GLuint programHandle,
                           const char *vertexShaderFileName,
                           const char *fragmentShaderFileName) {
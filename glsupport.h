@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <stdexcept>
+#include <vector>
 
 #define GLEW_STATIC
 #include "GL/glew.h"
@@ -12,6 +13,9 @@
 // and through a runtime_error exception.
 void checkGlErrors();
 
+// Dump text file into a character vector, throws runtime_error on error
+void readTextFile(const char *fn, std::vector<char> &data);
+
 // Reads and compiles a pair of vertex shader and fragment shader files into a
 // GL shader program. Throws runtime_error on error
 void readAndCompileShader(GLuint programHandle,
@@ -38,6 +42,30 @@ void readAndCompileSingleShader(GLuint shaderHandle,
 void readAndCompileSingleShaderFromMemory(GLuint shaderHandle, int sourceLength,
                                           const char *source);
 
+// The above block until GL is done. To overlap the work of several shaders
+// and programs, submit all of them first, and only then resolve each, which
+// waits for the result and throws runtime_error on error (after printing the
+// info log).
+void submitShaderCompile(GLuint shaderHandle, int sourceLength,
+                         const char *source);
+void resolveShaderCompile(GLuint shaderHandle, const char *filenameHint);
+void submitLink(GLuint programHandle, GLuint vertexShaderHandle,
+                GLuint fragmentShaderHandle);
+void resolveLink(GLuint programHandle);
+
+// Whether the current context lists the given extension, e.g.,
+// "GL_ARB_texture_view"
+bool hasGlExtension(const char *name);
+
+// Whether the current context is at least the given GL version
+bool hasGlVersion(int major, int minor);
+
+// Lets the driver compile and link on background threads, if it supports
+// GL_KHR_parallel_shader_compile (or the ARB version). Without it, submitted
+// work may still overlap, but that is up to the driver. Returns whether the
+// extension was found.
+bool enableParallelShaderCompile();
+
 // Classes inheriting Noncopyable will not have default compiler generated copy
 // constructor and assignment operator
 class Noncopyable {
@@ -108,6 +136,24 @@ class GlTexture : Noncopyable {
     operator GLuint() const { return handle_; }
 };
 
+// Light wrapper around a GL sampler object handle that automatically allocates
+// and deallocates. Can be casted to a GLuint.
+class GlSampler : Noncopyable {
+  protected:
+    GLuint handle_;
+
+  public:
+    GlSampler() {
+        glGenSamplers(1, &handle_);
+        checkGlErrors();
+    }
+
+    ~GlSampler() { glDeleteSamplers(1, &handle_); }
+
+    // Casts to GLuint so can be used directly by glBindSampler and so on
+    operator GLuint() const { return handle_; }
+};
+
 // Light wrapper around a GL buffer object handle that automatically allocates
 // and deallocates. Can be casted to a GLuint.
 class GlBufferObject : Noncopyable {
@@ -144,6 +190,42 @@ class GlArrayObject : Noncopyable {
     operator GLuint() const { return handle_; }
 };
 
+// Light wrapper around a GL framebuffer object handle that automatically
+// allocates and deallocates. Can be casted to a GLuint.
+class GlFramebuffer : Noncopyable {
+  protected:
+    GLuint handle_;
+
+  public:
+    GlFramebuffer() {
+        glGenFramebuffers(1, &handle_);
+        checkGlErrors();
+    }
+
+    ~GlFramebuffer() { glDeleteFramebuffers(1, &handle_); }
+
+    // Casts to GLuint so can be used directly by glBindFramebuffer
+    operator GLuint() const { return handle_; }
+};
+
+// Light wrapper around a GL renderbuffer object handle that automatically
+// allocates and deallocates. Can be casted to a GLuint.
+class GlRenderbuffer : Noncopyable {
+  protected:
+    GLuint handle_;
+
+  public:
+    GlRenderbuffer() {
+        glGenRenderbuffers(1, &handle_);
+        checkGlErrors();
+    }
+
+    ~GlRenderbuffer() { glDeleteRenderbuffers(1, &handle_); }
+
+    // Casts to GLuint so can be used directly by glBindRenderbuffer and so on
+    operator GLuint() const { return handle_; }
+};
+
 // Safe versions of various functions that handle GLSL shader attributes
 // and variables: These mainly issue a warning when specified attributes
 // and variables do not exist in the compiled GLSL program (e.g., due to
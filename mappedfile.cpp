@@ -0,0 +1,63 @@
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mappedfile.h"
+
+using namespace std;
+
+MappedFile::MappedFile(const char *filename)
+    : data_(NULL), size_(0), mapped_(false) {
+#ifndef _WIN32
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        throw runtime_error(string("Cannot open file ") + filename);
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            data_ = static_cast<const unsigned char *>(p);
+            size_ = st.st_size;
+            mapped_ = true;
+        }
+    }
+    close(fd); // the mapping stays valid
+
+    if (mapped_)
+        return;
+#endif
+
+    // Not mappable (or no mmap): read it in
+    ifstream ifs(filename, ios::binary);
+    if (!ifs)
+        throw runtime_error(string("Cannot open file ") + filename);
+    ifs.seekg(0, ios::end);
+    const streamoff len = ifs.tellg();
+    if (len > 0) {
+        buffer_.resize(len);
+        ifs.seekg(0, ios::beg);
+        ifs.read(reinterpret_cast<char *>(&buffer_[0]), len);
+        if (!ifs)
+            throw runtime_error(string("Cannot read file ") + filename);
+        data_ = &buffer_[0];
+        size_ = len;
+    }
+
+    if (size_ == 0)
+        throw runtime_error(string("Empty file ") + filename);
+}
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+    if (mapped_)
+        munmap(const_cast<unsigned char *>(data_), size_);
+#endif
+}
@@ -0,0 +1,28 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <vector>
+
+#include "glsupport.h"
+
+// Read only view of a whole file. Uses mmap where available, so the pages are
+// only brought in as they are touched and nothing is copied; elsewhere the file
+// is simply read into memory. Throws runtime_error if the file cannot be
+// opened or is empty.
+class MappedFile : Noncopyable {
+  public:
+    explicit MappedFile(const char *filename);
+    ~MappedFile();
+
+    const unsigned char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+  private:
+    const unsigned char *data_;
+    size_t size_;
+    bool mapped_;                      // whether data_ needs munmap
+    std::vector<unsigned char> buffer_; // used when not mapped
+};
+
+#endif
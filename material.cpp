@@ -1,10 +1,23 @@
 #include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
 #include <sstream>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
 #include "asstcommon.h"
+#include "frameblock.h"
+#include "glstate.h"
 #include "glsupport.h"
 #include "material.h"
 
@@ -13,6 +26,8 @@ using namespace std;
 struct GlProgramDesc {
     struct UniformDesc {
         string name;
+        string arrayName; // name with trailing "[0]" stripped, if any
+        int nameId, arrayNameId; // UniformName ids of the above
         GLenum type;
         GLint size;
         GLint location;
@@ -31,9 +46,63 @@ struct GlProgramDesc {
     vector<UniformDesc> uniforms;
     vector<AttribDesc> attribs;
 
-    GlProgramDesc(GLuint vsHandle, GLuint fsHandle) {
-        linkShader(program, vsHandle, fsHandle);
+    // For each uniform, the stamp of the value last uploaded to it (texture
+    // unit + 1 for samplers), or 0 if nothing has been uploaded yet. Uniform
+    // values are per program GL state, so this stays valid across glUseProgram
+    vector<unsigned long long> uploadedStamps;
+
+    // Submits the link of the shaders, which may well still be compiling.
+    // Nothing is waited for until resolve(). If `cachePath' is not empty, the
+    // program is saved there once resolved.
+    GlProgramDesc(const shared_ptr<GlShader> &vs, const string &vsFilename,
+                  const shared_ptr<GlShader> &fs, const string &fsFilename,
+                  const string &cachePath)
+        : pending_(new Pending) {
+        pending_->vs = vs;
+        pending_->fs = fs;
+        pending_->vsFilename = vsFilename;
+        pending_->fsFilename = fsFilename;
+        pending_->cachePath = cachePath;
+
+        if (!cachePath.empty())
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                                GL_TRUE);
+        submitLink(program, *vs, *fs);
+    }
+
+    // Recreates a program saved by save(). Throws runtime_error if the stream
+    // is not a saved program, or if GL rejects the binary (e.g., the driver
+    // has been updated since). Such a program is resolved right away.
+    explicit GlProgramDesc(istream &is);
+
+    ~GlProgramDesc() {
+        GlState::get().forgetProgram(program);
+        GlState::get().forgetVertexArray(vao);
+    }
+
+    bool isResolved() const { return !pending_; }
+
+    // Waits for the compiles and the link, throwing runtime_error if any
+    // failed, then reflects the active uniforms and attributes. Material
+    // calls this on first draw.
+    void resolve();
+
+    // Writes the program binary along with the reflected uniform and attribute
+    // tables, so that the istream constructor can skip compiling and
+    // querying. Returns false if GL cannot give us the binary.
+    bool save(ostream &os) const;
 
+  private:
+    struct Pending {
+        shared_ptr<GlShader> vs, fs;
+        string vsFilename, fsFilename, cachePath;
+    };
+
+    // Non-NULL until resolved
+    unique_ptr<Pending> pending_;
+
+    // Queries the active uniforms and attributes of the linked program
+    void reflect() {
         int numActiveUniforms, numActiveAttribs, uniformMaxLen, attribMaxLen;
 
         glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numActiveUniforms);
@@ -45,16 +114,24 @@ struct GlProgramDesc {
         const int bufSize = max(uniformMaxLen, attribMaxLen) + 1;
         vector<GLchar> buffer(bufSize);
 
-        uniforms.resize(numActiveUniforms);
         for (int i = 0; i < numActiveUniforms; ++i) {
+            // members of uniform blocks (e.g., FrameBlock) are fed from
+            // buffers, not glUniform*
+            const GLuint index = i;
+            GLint blockIndex;
+            glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_BLOCK_INDEX,
+                                  &blockIndex);
+            if (blockIndex != -1)
+                continue;
+
+            UniformDesc ud;
             GLsizei charsWritten;
-            glGetActiveUniform(program, i, bufSize, &charsWritten,
-                               &(uniforms[i].size), &(uniforms[i].type),
-                               &buffer[0]);
+            glGetActiveUniform(program, i, bufSize, &charsWritten, &ud.size,
+                               &ud.type, &buffer[0]);
             assert(charsWritten + 1 <= bufSize);
-            uniforms[i].name =
-                string(buffer.begin(), buffer.begin() + charsWritten);
-            uniforms[i].location = glGetUniformLocation(program, &buffer[0]);
+            ud.name = string(buffer.begin(), buffer.begin() + charsWritten);
+            ud.location = glGetUniformLocation(program, &buffer[0]);
+            uniforms.push_back(ud);
         }
 
         attribs.resize(numActiveAttribs);
@@ -68,24 +145,254 @@ struct GlProgramDesc {
                 string(buffer.begin(), buffer.begin() + charsWritten);
             attribs[i].location = glGetAttribLocation(program, &buffer[0]);
         }
+    }
+
+    // Work common to linked and loaded programs
+    void finish() {
+        for (size_t i = 0; i < uniforms.size(); ++i) {
+            UniformDesc &ud = uniforms[i];
+            const bool isArray =
+                ud.name.length() >= 3 &&
+                ud.name.compare(ud.name.length() - 3, 3, "[0]") == 0;
+            ud.arrayName =
+                isArray ? ud.name.substr(0, ud.name.length() - 3) : ud.name;
+            ud.nameId = UniformName(ud.name).getId();
+            ud.arrayNameId = UniformName(ud.arrayName).getId();
+        }
+        uploadedStamps.assign(uniforms.size(), 0);
+
+        const GLuint frameBlockIndex =
+            glGetUniformBlockIndex(program, FrameBlock::NAME);
+        if (frameBlockIndex != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, frameBlockIndex, FrameBlock::BINDING);
 
-            glBindFragDataLocation(program, 0, "fragColor");
+        glBindFragDataLocation(program, 0, "fragColor");
 
         checkGlErrors();
     }
+
+    template <typename T> static T read(istream &is) {
+        T t;
+        is.read(reinterpret_cast<char *>(&t), sizeof(T));
+        return t;
+    }
+
+    template <typename T> static void write(ostream &os, const T &t) {
+        os.write(reinterpret_cast<const char *>(&t), sizeof(T));
+    }
+
+    static string readString(istream &is) {
+        string s(read<uint32_t>(is), ' ');
+        if (!s.empty())
+            is.read(&s[0], s.size());
+        return s;
+    }
+
+    static void writeString(ostream &os, const string &s) {
+        write<uint32_t>(os, s.size());
+        os.write(s.data(), s.size());
+    }
 };
 
+// Linked programs are kept in shadercache/, one file per program, named after
+// a hash of both shader sources and the GL vendor, renderer and version
+// strings. So editing a shader or updating the driver just misses the cache.
+class GlProgramCache {
+    static const char *dir() { return "shadercache"; }
+
+    // Bump when the file layout of GlProgramDesc::save changes
+    static const uint32_t VERSION = 1;
+
+    bool enabled_;
+    string driver_;
+
+    // 64 bit FNV-1a
+    static uint64_t hash(uint64_t h, const char *data, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            h ^= (unsigned char)data[i];
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+    static string getString(GLenum name) {
+        const GLubyte *s = glGetString(name);
+        return s ? reinterpret_cast<const char *>(s) : "";
+    }
+
+  public:
+    GlProgramCache() {
+        GLint numFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        enabled_ = numFormats > 0 && getenv("CS175_NO_SHADER_CACHE") == NULL;
+        driver_ = getString(GL_VENDOR) + "\n" + getString(GL_RENDERER) + "\n" +
+                  getString(GL_VERSION);
+        checkGlErrors();
+    }
+
+    // Where the program linked from the given sources is cached, or empty if
+    // caching is disabled
+    string getPath(const vector<char> &vsSource,
+                   const vector<char> &fsSource) const {
+        if (!enabled_)
+            return string();
+
+        uint64_t h = 14695981039346656037ull;
+        h = hash(h, reinterpret_cast<const char *>(&VERSION), sizeof(VERSION));
+        h = hash(h, driver_.data(), driver_.size());
+        // lengths go in too, so moving text between the shaders changes it
+        const uint64_t lens[] = {vsSource.size(), fsSource.size()};
+        h = hash(h, reinterpret_cast<const char *>(lens), sizeof(lens));
+        h = hash(h, vsSource.data(), vsSource.size());
+        h = hash(h, fsSource.data(), fsSource.size());
+
+        ostringstream s;
+        s << dir() << "/" << hex << setw(16) << setfill('0') << h << ".bin";
+        return s.str();
+    }
+
+    // Returns NULL on a miss, or if the cached binary no longer loads
+    static shared_ptr<GlProgramDesc> load(const string &path) {
+        if (path.empty())
+            return shared_ptr<GlProgramDesc>();
+
+        ifstream ifs(path.c_str(), ios::binary);
+        if (!ifs)
+            return shared_ptr<GlProgramDesc>();
+        try {
+            return shared_ptr<GlProgramDesc>(new GlProgramDesc(ifs));
+        } catch (const exception &e) {
+            cerr << "Ignoring cached shader program: " << e.what() << endl;
+            return shared_ptr<GlProgramDesc>();
+        }
+    }
+
+    static void save(const string &path, const GlProgramDesc &program) {
+        if (path.empty())
+            return;
+
+#ifdef _WIN32
+        _mkdir(dir());
+#else
+        mkdir(dir(), 0755);
+#endif
+        {
+            ofstream ofs(path.c_str(), ios::binary);
+            if (ofs && program.save(ofs))
+                return;
+        }
+        remove(path.c_str()); // do not leave a truncated file behind
+    }
+};
+
+GlProgramDesc::GlProgramDesc(istream &is) {
+    is.exceptions(ios::eofbit | ios::failbit | ios::badbit);
+
+    GLenum binaryFormat = read<GLenum>(is);
+    vector<char> binary(read<uint32_t>(is));
+    if (binary.empty())
+        throw runtime_error("empty program binary");
+    is.read(&binary[0], binary.size());
+
+    uniforms.resize(read<uint32_t>(is));
+    for (size_t i = 0; i < uniforms.size(); ++i) {
+        uniforms[i].name = readString(is);
+        uniforms[i].type = read<GLenum>(is);
+        uniforms[i].size = read<GLint>(is);
+        uniforms[i].location = read<GLint>(is);
+    }
+    attribs.resize(read<uint32_t>(is));
+    for (size_t i = 0; i < attribs.size(); ++i) {
+        attribs[i].name = readString(is);
+        attribs[i].type = read<GLenum>(is);
+        attribs[i].size = read<GLint>(is);
+        attribs[i].location = read<GLint>(is);
+    }
+
+    glProgramBinary(program, binaryFormat, &binary[0], binary.size());
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        glGetError(); // an unsupported format is reported as an error too
+        throw runtime_error("program binary rejected by GL");
+    }
+
+    finish();
+}
+
+void GlProgramDesc::resolve() {
+    if (!pending_)
+        return;
+
+    resolveShaderCompile(*pending_->vs, pending_->vsFilename.c_str());
+    resolveShaderCompile(*pending_->fs, pending_->fsFilename.c_str());
+    resolveLink(program);
+
+    reflect();
+    finish();
+    GlProgramCache::save(pending_->cachePath, *this);
+
+    pending_.reset(); // lets go of the shaders, too
+}
+
+bool GlProgramDesc::save(ostream &os) const {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return false;
+
+    vector<char> binary(length);
+    GLenum binaryFormat;
+    glGetProgramBinary(program, length, &length, &binaryFormat,
+                       &binary[0]);
+    if (glGetError() != GL_NO_ERROR)
+        return false;
+
+    write<GLenum>(os, binaryFormat);
+    write<uint32_t>(os, length);
+    os.write(&binary[0], length);
+
+    write<uint32_t>(os, uniforms.size());
+    for (size_t i = 0; i < uniforms.size(); ++i) {
+        writeString(os, uniforms[i].name);
+        write<GLenum>(os, uniforms[i].type);
+        write<GLint>(os, uniforms[i].size);
+        write<GLint>(os, uniforms[i].location);
+    }
+    write<uint32_t>(os, attribs.size());
+    for (size_t i = 0; i < attribs.size(); ++i) {
+        writeString(os, attribs[i].name);
+        write<GLenum>(os, attribs[i].type);
+        write<GLint>(os, attribs[i].size);
+        write<GLint>(os, attribs[i].location);
+    }
+    return bool(os);
+}
+
+// Shaders and programs are keyed by their file names, plus the block of
+// #define lines of the permutation (empty for none)
 class GlProgramLibrary {
     typedef map<string, vector<char>> FileMap;
-    typedef map<pair<string, GLenum>, shared_ptr<GlShader>> GlShaderMap;
-    typedef map<pair<string, string>, shared_ptr<GlProgramDesc>>
+    typedef map<pair<string, string>, vector<char>> PermutedFileMap;
+    typedef map<pair<pair<string, string>, GLenum>, shared_ptr<GlShader>>
+        GlShaderMap;
+    typedef map<pair<pair<string, string>, string>, shared_ptr<GlProgramDesc>>
         GlProgramDescMap;
 
-    FileMap fileMap;
+    FileMap fileMap;   // inline sources
+    FileMap sourceMap; // sources read from files
+    PermutedFileMap permutedMap;
     GlShaderMap shaderMap;
     GlProgramDescMap programMap;
 
-    GlProgramLibrary() {}
+    shared_ptr<GlProgramCache> cache;
+
+    GlProgramLibrary() {
+        // Compiles and links are only submitted here, and resolved when a
+        // material is first drawn, so they all overlap when the driver can
+        // run them in the background.
+        enableParallelShaderCompile();
+    }
 
   public:
     static GlProgramLibrary &getSingleton() {
@@ -93,15 +400,42 @@ class GlProgramLibrary {
         return pl;
     }
 
+    // Turns a list of defines into the block of #define lines inserted into
+    // the sources. Order and duplicates do not matter.
+    static string makeDefineBlock(vector<string> defines) {
+        sort(defines.begin(), defines.end());
+        defines.erase(unique(defines.begin(), defines.end()), defines.end());
+
+        string block;
+        for (size_t i = 0; i < defines.size(); ++i) {
+            block += "#define " + defines[i] + "\n";
+        }
+        return block;
+    }
+
     shared_ptr<GlProgramDesc> getProgramDesc(const string &vsFilename,
-                                             const string &fsFilename) {
-        GlProgramDescMap::key_type key(vsFilename, fsFilename);
+                                             const string &fsFilename,
+                                             const string &defineBlock) {
+        GlProgramDescMap::key_type key(make_pair(vsFilename, fsFilename),
+                                       defineBlock);
 
         GlProgramDescMap::iterator i = programMap.find(key);
         if (i == programMap.end()) {
-            shared_ptr<GlProgramDesc> program(
-                new GlProgramDesc(*getShader(vsFilename, GL_VERTEX_SHADER),
-                                  *getShader(fsFilename, GL_FRAGMENT_SHADER)));
+            if (!cache)
+                cache.reset(new GlProgramCache());
+
+            const vector<char> &vsSource = getSource(vsFilename, defineBlock);
+            const vector<char> &fsSource = getSource(fsFilename, defineBlock);
+
+            const string cachePath = cache->getPath(vsSource, fsSource);
+            shared_ptr<GlProgramDesc> program = GlProgramCache::load(cachePath);
+            if (!program) {
+                program.reset(new GlProgramDesc(
+                    getShader(vsFilename, defineBlock, GL_VERTEX_SHADER),
+                    vsFilename,
+                    getShader(fsFilename, defineBlock, GL_FRAGMENT_SHADER),
+                    fsFilename, cachePath));
+            }
             programMap[key] = program;
             return program;
         } else {
@@ -117,21 +451,74 @@ class GlProgramLibrary {
     void removeInlineSource(const string &filename) { fileMap.erase(filename); }
 
   protected:
-    shared_ptr<GlShader> getShader(const string &filename, GLenum shaderType) {
-        string f = filename;
+    // The inline source if there is one, otherwise the file's content
+    const vector<char> &getSource(const string &filename) {
+        FileMap::iterator i = fileMap.find(filename);
+        if (i != fileMap.end())
+            return i->second;
+
+        i = sourceMap.find(filename);
+        if (i == sourceMap.end()) {
+            i = sourceMap.insert(make_pair(filename, vector<char>())).first;
+            readTextFile(filename.c_str(), i->second);
+        }
+        return i->second;
+    }
+
+    // The source with `defineBlock' inserted after the #version line. A
+    // #line directive after the block keeps the line numbers in compile
+    // errors matching the file.
+    const vector<char> &getSource(const string &filename,
+                                  const string &defineBlock) {
+        if (defineBlock.empty())
+            return getSource(filename);
+
+        PermutedFileMap::key_type key(filename, defineBlock);
+        PermutedFileMap::iterator i = permutedMap.find(key);
+        if (i != permutedMap.end())
+            return i->second;
+
+        const vector<char> &source = getSource(filename);
+        static const char versionDirective[] = "#version";
+        vector<char>::const_iterator versionLine =
+            search(source.begin(), source.end(), versionDirective,
+                   versionDirective + sizeof(versionDirective) - 1);
+
+        vector<char>::const_iterator insertAt = source.begin();
+        int nextLine = 1;
+        if (versionLine != source.end()) {
+            insertAt = find(versionLine, source.end(), '\n');
+            if (insertAt != source.end())
+                ++insertAt;
+            nextLine = count(source.begin(), insertAt, '\n') + 1;
+        }
 
-        GlShaderMap::key_type key(f, shaderType);
+        ostringstream s;
+        if (insertAt == source.end() && insertAt != source.begin() &&
+            insertAt[-1] != '\n')
+            s << "\n"; // #version was on the last line, without a newline
+        s << defineBlock << "#line " << nextLine << "\n";
+        const string inserted = s.str();
+
+        vector<char> &permuted = permutedMap[key];
+        permuted.reserve(source.size() + inserted.size());
+        permuted.assign(source.begin(), insertAt);
+        permuted.insert(permuted.end(), inserted.begin(), inserted.end());
+        permuted.insert(permuted.end(), insertAt, source.end());
+        return permuted;
+    }
+
+    shared_ptr<GlShader> getShader(const string &filename,
+                                   const string &defineBlock,
+                                   GLenum shaderType) {
+        GlShaderMap::key_type key(make_pair(filename, defineBlock), shaderType);
         GlShaderMap::iterator i = shaderMap.find(key);
         if (i == shaderMap.end()) {
             shared_ptr<GlShader> shader(new GlShader(shaderType));
 
-            FileMap::iterator contentIter = fileMap.find(f);
-            if (contentIter == fileMap.end())
-                readAndCompileSingleShader(*shader, f.c_str());
-            else
-                readAndCompileSingleShaderFromMemory(*shader,
-                                                     contentIter->second.size(),
-                                                     &contentIter->second[0]);
+            // the status is checked by GlProgramDesc::resolve
+            const vector<char> &source = getSource(filename, defineBlock);
+            submitShaderCompile(*shader, source.size(), &source[0]);
 
             shaderMap[key] = shader;
             return shader;
@@ -150,9 +537,35 @@ void Material::removeInlineSource(const std::string &filename) {
     GlProgramLibrary::getSingleton().removeInlineSource(filename);
 }
 
-Material::Material(const string &vsFilename, const string &fsFilename)
-    : programDesc_(GlProgramLibrary::getSingleton().getProgramDesc(
-          vsFilename, fsFilename)) {}
+const char *const Material::SCREEN_RADIUS = "uScreenRadius";
+
+Material::Material(const string &vsFilename, const string &fsFilename,
+                   const vector<string> &defines)
+    : vsFilename_(vsFilename), fsFilename_(fsFilename) {
+    addVariant(0, defines);
+}
+
+Material &Material::addLod(double maxScreenRadius,
+                           const vector<string> &defines) {
+    addVariant(maxScreenRadius, defines);
+
+    // keep the LODs sorted, after the full variant
+    for (size_t i = variants_.size() - 1;
+         i > 1 && variants_[i - 1].maxScreenRadius > maxScreenRadius; --i) {
+        swap(variants_[i - 1], variants_[i]);
+    }
+    return *this;
+}
+
+void Material::addVariant(double maxScreenRadius,
+                          const vector<string> &defines) {
+    Variant v;
+    v.maxScreenRadius = maxScreenRadius;
+    v.programDesc = GlProgramLibrary::getSingleton().getProgramDesc(
+        vsFilename_, fsFilename_, GlProgramLibrary::makeDefineBlock(defines));
+    v.boundLayoutStamp = v.boundExtraLayoutStamp = 0;
+    variants_.push_back(v);
+}
 
 static const char *getGlConstantName(GLenum c) {
     struct ValueNamePair {
@@ -186,6 +599,7 @@ static const char *getGlConstantName(GLenum c) {
         {GL_SAMPLER_CUBE, "GL_SAMPLER_CUBE"},
         {GL_SAMPLER_1D_SHADOW, "GL_SAMPLER_1D_SHADOW"},
         {GL_SAMPLER_2D_SHADOW, "GL_SAMPLER_2D_SHADOW"},
+        {GL_SAMPLER_2D_ARRAY, "GL_SAMPLER_2D_ARRAY"},
     };
 
     for (int i = 0, n = sizeof(valueNamePairs) / sizeof(valueNamePairs[0]);
@@ -196,7 +610,7 @@ static const char *getGlConstantName(GLenum c) {
     return "Unkonwn";
 }
 
-void Material::draw(Geometry &geometry, const Uniforms &extraUniforms) {
+void Material::bindUniforms(Variant &variant, const Uniforms &extraUniforms) {
     static GLint maxTextureImageUnits = 0;
 
     // Initialize maxTextureImageUnits if this is called for the first time
@@ -207,84 +621,142 @@ void Material::draw(Geometry &geometry, const Uniforms &extraUniforms) {
                0); // GL spec says this has to be at least 2
     }
 
-    glUseProgram(programDesc_->program);
+    const GlProgramDesc &programDesc = *variant.programDesc;
+    vector<UniformBinding> &uniformBindings = variant.uniformBindings;
+    uniformBindings.clear();
 
-    renderStates_.apply(); // transit to current states
-
-    // Step 1:
-    // set the uniforms and bind the textures
     int textureUnit = 0;
-    for (int i = 0, n = programDesc_->uniforms.size(); i < n; ++i) {
-        const GlProgramDesc::UniformDesc &ud = programDesc_->uniforms[i];
+    for (int i = 0, n = programDesc.uniforms.size(); i < n; ++i) {
+        const GlProgramDesc::UniformDesc &ud = programDesc.uniforms[i];
 
         const Uniforms *uniformsList[] = {&uniforms_, &extraUniforms};
-        int j = 0;
-        for (; j < 2; ++j) {
-            const Uniforms::Value *u = uniformsList[j]->get(ud.name);
+        const Uniforms::Value *u = NULL;
+        for (int j = 0; j < 2 && u == NULL; ++j) {
+            u = uniformsList[j]->get(ud.nameId);
 
             // if the name looks like blah[0], and the uniform is not found, we
             // also try stripping the '[0]'
-            if (u == NULL && ud.name.length() >= 3 &&
-                ud.name.compare(ud.name.length() - 3, 3, "[0]") == 0)
-                u = uniformsList[j]->get(
-                    ud.name.substr(0, ud.name.length() - 3));
-
-            if (u) {
-                if (u->type == ud.type && u->size >= ud.size) {
-                    switch (u->type) {
-                    case GL_SAMPLER_1D:
-                    case GL_SAMPLER_2D:
-                    case GL_SAMPLER_CUBE:
-                    case GL_SAMPLER_1D_SHADOW:
-                    case GL_SAMPLER_2D_SHADOW: {
-                        const shared_ptr<Texture> *tex = u->getTextures();
-
-                        // If this assert hits, the Uniform::Value is
-                        // incorrectly implemented
-                        assert(tex != NULL);
-                        static const int MAX_TEX_UNITS = 1024;
-                        GLint texUnits[MAX_TEX_UNITS];
-                        int count = 0;
-                        for (; count < ud.size; ++count) {
-                            if (textureUnit == maxTextureImageUnits) {
-                                stringstream s;
-                                s << "System allows a maximum of "
-                                  << maxTextureImageUnits
-                                  << ". The current shader is trying to use "
-                                     "more than that.";
-                                throw runtime_error(s.str());
-                            }
-
-                            glActiveTexture(GL_TEXTURE0 + textureUnit);
-                            tex[count]->bind();
-                            texUnits[count] = textureUnit++;
-                        }
-                        u->apply(ud.location, ud.size, texUnits);
-                    } break;
-                    default:
-                        u->apply(ud.location, ud.size, NULL);
-                    }
-                } else {
-                    stringstream s;
-                    s << "Uniform variable " << ud.name
-                      << ": supplied value and declared variable do not match "
-                         "in type and/or size."
-                      << "\nSupplied value: type = "
-                      << getGlConstantName(u->type) << ", size = " << u->size
-                      << "\nDeclared in shader: type = "
-                      << getGlConstantName(ud.type) << ", size = " << ud.size;
-                    throw runtime_error(s.str());
-                }
-                break;
-            }
+            if (u == NULL && ud.arrayNameId != ud.nameId)
+                u = uniformsList[j]->get(ud.arrayNameId);
         }
-        if (j == 2) {
+        if (u == NULL) {
             stringstream s;
             s << "Uniform variable " << ud.name
               << ": used in the shader codes, but not supplied. Type = "
               << getGlConstantName(ud.type) << ", Size = " << ud.size;
             throw runtime_error(s.str());
         }
+
+        if (u->type != ud.type || u->size < ud.size) {
+            stringstream s;
+            s << "Uniform variable " << ud.name
+              << ": supplied value and declared variable do not match "
+                 "in type and/or size."
+              << "\nSupplied value: type = " << getGlConstantName(u->type)
+              << ", size = " << u->size
+              << "\nDeclared in shader: type = " << getGlConstantName(ud.type)
+              << ", size = " << ud.size;
+            throw runtime_error(s.str());
+        }
+
+        UniformBinding b;
+        b.location = ud.location;
+        b.size = ud.size;
+        b.uniformIndex = i;
+        b.textureUnit = -1;
+        b.source = u;
+
+        switch (u->type) {
+        case GL_SAMPLER_1D:
+        case GL_SAMPLER_2D:
+        case GL_SAMPLER_CUBE:
+        case GL_SAMPLER_1D_SHADOW:
+        case GL_SAMPLER_2D_SHADOW:
+        case GL_SAMPLER_2D_ARRAY:
+            // If this assert hits, the Uniform::Value is incorrectly
+            // implemented
+            assert(u->getTextures() != NULL);
+            if (textureUnit + ud.size > maxTextureImageUnits) {
+                stringstream s;
+                s << "System allows a maximum of " << maxTextureImageUnits
+                  << ". The current shader is trying to use more than that.";
+                throw runtime_error(s.str());
+            }
+            b.textureUnit = textureUnit;
+            textureUnit += ud.size;
+            break;
+        default:;
+        }
+        uniformBindings.push_back(b);
+    }
+
+    variant.boundLayoutStamp = uniforms_.layoutStamp_;
+    variant.boundExtraLayoutStamp = extraUniforms.layoutStamp_;
+}
+
+void Material::draw(Geometry &geometry, const Uniforms &extraUniforms) {
+    // Waits for the program on first draw, and throws if it failed to build
+    // Pick the cheapest variant good enough for the shape's size on screen
+    Variant *variant = &variants_[0];
+    if (variants_.size() > 1) {
+        static const UniformName screenRadiusName(SCREEN_RADIUS);
+        const Uniforms::Value *screenRadius = extraUniforms.get(screenRadiusName);
+        if (screenRadius != NULL && screenRadius->type == GL_FLOAT) {
+            const float r = screenRadius->floats()[0];
+            for (size_t i = 1; i < variants_.size(); ++i) {
+                if (r <= variants_[i].maxScreenRadius) {
+                    variant = &variants_[i];
+                    break;
+                }
+            }
+        }
+    }
+    GlProgramDesc &programDesc = *variant->programDesc;
+
+    if (!programDesc.isResolved())
+        programDesc.resolve();
+
+    GlState &gl = GlState::get();
+    gl.useProgram(programDesc.program);
+
+    renderStates_.apply(); // transit to current states
+
+    // Step 1:
+    // set the uniforms and bind the textures. Name lookup and type checking
+    // only happens when the layout of either Uniforms changes.
+    if (variant->boundLayoutStamp != uniforms_.layoutStamp_ ||
+        variant->boundExtraLayoutStamp != extraUniforms.layoutStamp_)
+        bindUniforms(*variant, extraUniforms);
+
+    unsigned long long *uploaded = programDesc.uploadedStamps.data();
+    const vector<UniformBinding> &uniformBindings = variant->uniformBindings;
+    for (int i = 0, n = uniformBindings.size(); i < n; ++i) {
+        const UniformBinding &b = uniformBindings[i];
+        const Uniforms::Value *u = b.source;
+
+        if (b.textureUnit < 0) {
+            if (uploaded[b.uniformIndex] != u->stamp) {
+                u->apply(b.location, b.size, NULL);
+                uploaded[b.uniformIndex] = u->stamp;
+            }
+            continue;
+        }
+
+        const shared_ptr<Texture> *tex = u->getTextures();
+        static const int MAX_TEX_UNITS = 1024;
+        GLint texUnits[MAX_TEX_UNITS];
+        for (int count = 0; count < b.size; ++count) {
+            tex[count]->prepareDraw(extraUniforms);
+            gl.activeTexture(b.textureUnit + count);
+            tex[count]->bind();
+            texUnits[count] = b.textureUnit + count;
+        }
+        // for samplers what gets uploaded is the texture units, so that is
+        // what we remember instead of the value stamp
+        if (uploaded[b.uniformIndex] != (unsigned long long)b.textureUnit + 1) {
+            u->apply(b.location, b.size, texUnits);
+            uploaded[b.uniformIndex] = b.textureUnit + 1;
+        }
     }
 
     // Step 2:
@@ -307,8 +779,8 @@ void Material::draw(Geometry &geometry, const Uniforms &extraUniforms) {
     }
 
     // simple and stupid O(n^2) wiring, should use a hashtable to reduce to O(n)
-    for (int i = 0, n = programDesc_->attribs.size(); i < n; ++i) {
-        const GlProgramDesc::AttribDesc &ad = programDesc_->attribs[i];
+    for (int i = 0, n = programDesc.attribs.size(); i < n; ++i) {
+        const GlProgramDesc::AttribDesc &ad = programDesc.attribs[i];
 
         size_t j = 0;
         for (; j < numAttribs; ++j) {
@@ -325,7 +797,7 @@ void Material::draw(Geometry &geometry, const Uniforms &extraUniforms) {
     }
 
     // enable the VAO associated with GL program desc
-    glBindVertexArray(programDesc_->vao);
+    gl.bindVertexArray(programDesc.vao);
 
     for (size_t i = 0; i < numAttribs; ++i) {
         if (attribIndices[i] >= 0)
@@ -340,6 +812,5 @@ void Material::draw(Geometry &geometry, const Uniforms &extraUniforms) {
             glDisableVertexAttribArray(attribIndices[i]);
     }
 
-    // set back to default vao
-    glBindVertexArray(0);
+    // The VAO stays bound; the next draw switches it only if it differs.
 }
@@ -5,6 +5,7 @@
 #include <map>
 #include <memory>
 #include <stdexcept>
+#include <string>
 #include <vector>
 
 #include "cvec.h"
@@ -18,7 +19,22 @@ struct GlProgramDesc;
 
 class Material {
   public:
-    Material(const std::string &vsFilename, const std::string &fsFilename);
+    // `defines' are inserted as #define lines right after the #version line
+    // of both shaders, e.g., {"NO_SPECULAR", "NUM_LIGHTS 2"}, to pick a
+    // permutation of the shader sources. Each permutation is compiled once.
+    Material(const std::string &vsFilename, const std::string &fsFilename,
+             const std::vector<std::string> &defines =
+                 std::vector<std::string>());
+
+    // Adds a cheaper permutation of the same shaders, drawn instead when the
+    // shape covers at most `maxScreenRadius' pixels, as told by the float
+    // SCREEN_RADIUS in extraUniforms. The uniforms and render states are
+    // shared with the full version.
+    Material &addLod(double maxScreenRadius,
+                     const std::vector<std::string> &defines);
+
+    // Set per shape by Drawer
+    static const char *const SCREEN_RADIUS;
 
     void draw(Geometry &geometry, const Uniforms &extraUniforms);
 
@@ -34,11 +50,42 @@ class Material {
     static void removeInlineSource(const std::string &filename);
 
   protected:
-    std::shared_ptr<GlProgramDesc> programDesc_;
+    std::string vsFilename_, fsFilename_;
 
     Uniforms uniforms_;
 
     RenderStates renderStates_;
+
+    // One entry per active uniform of the program, resolved against
+    // uniforms_ and the extraUniforms of the last draw.
+    struct UniformBinding {
+        GLint location;
+        GLint size;          // number of elements declared by the shader
+        int uniformIndex;    // index into programDesc->uniforms
+        int textureUnit;     // first bound texture unit, or -1 if not sampler
+        // Points into uniforms_ or extraUniforms, and stays valid until the
+        // layout stamp of that Uniforms changes.
+        const Uniforms::Value *source;
+    };
+
+    struct Variant {
+        double maxScreenRadius; // only used by LODs
+        std::shared_ptr<GlProgramDesc> programDesc;
+
+        std::vector<UniformBinding> uniformBindings;
+
+        // layout stamps of uniforms_ and extraUniforms the bindings were
+        // built against. 0 is never a valid stamp, so a new variant starts
+        // unbound.
+        unsigned long long boundLayoutStamp, boundExtraLayoutStamp;
+    };
+
+    // The full program first, then the LODs by increasing maxScreenRadius
+    std::vector<Variant> variants_;
+
+    void addVariant(double maxScreenRadius,
+                    const std::vector<std::string> &defines);
+    void bindUniforms(Variant &variant, const Uniforms &extraUniforms);
 };
 
 #endif
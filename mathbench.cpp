@@ -0,0 +1,226 @@
+// Times the float SIMD math classes (matrix4f.h, quatf.h, rigtformf.h)
+// against the double ones they mirror, and checks that both compute the same
+// results up to float precision. Also times fastSlerp and the batched
+// RigTFormArray lerp against slerp:
+//
+//   mathbench [-runs n]
+//
+// `make bench' runs it. For each kernel, prints the best of n runs over a
+// batch of random operands, in nanoseconds per operation. Exits with -1 if a
+// float result is further than TOLERANCE from the double one.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "matrix4.h"
+#include "matrix4f.h"
+#include "quat.h"
+#include "quatf.h"
+#include "rigtform.h"
+#include "rigtformarray.h"
+#include "rigtformf.h"
+
+using namespace std;
+
+static const int BATCH = 4096;
+
+// Of results whose magnitudes are at most about 20 (see randomVector)
+static const double TOLERANCE = 1e-4;
+
+static mt19937 g_random(175);
+
+static double uniform(double lo, double hi) {
+    return uniform_real_distribution<double>(lo, hi)(g_random);
+}
+
+static Cvec3 randomVector() {
+    return Cvec3(uniform(-10, 10), uniform(-10, 10), uniform(-10, 10));
+}
+
+static Quat randomRotation() {
+    return normalize(Quat(uniform(-1, 1), uniform(-1, 1), uniform(-1, 1),
+                          uniform(-1, 1)));
+}
+
+static Cvec4f toFloat(const Cvec4 &v) {
+    return Cvec4f(float(v[0]), float(v[1]), float(v[2]), float(v[3]));
+}
+
+static double maxDifference(const Cvec4 &a, const Cvec4f &b) {
+    double d = 0;
+    for (int i = 0; i < 4; ++i)
+        d = max(d, abs(a[i] - b[i]));
+    return d;
+}
+
+static double maxDifference(const Quat &a, const Quatf &b) {
+    double d = 0;
+    for (int i = 0; i < 4; ++i)
+        d = max(d, abs(a[i] - b[i]));
+    return d;
+}
+
+static double maxDifference(const Matrix4 &a, const Matrix4f &b) {
+    double d = 0;
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j)
+            d = max(d, abs(a(i, j) - b(i, j)));
+    }
+    return d;
+}
+
+static double maxDifference(const RigTForm &a, const RigTFormf &b) {
+    const Cvec3 t = a.getTranslation();
+    const Cvec3f tf = b.getTranslation();
+    return max(maxDifference(Cvec4(t, 0), Cvec4f(tf[0], tf[1], tf[2], 0)),
+               maxDifference(a.getRotation(), b.getRotation()));
+}
+
+// Best time of `runs' calls of `kernel', each over the batch, in nanoseconds
+// per operation
+template <typename Kernel> static double timeBest(int runs, Kernel kernel) {
+    double best = 1e30;
+    for (int i = 0; i < runs; ++i) {
+        const chrono::steady_clock::time_point start =
+            chrono::steady_clock::now();
+        kernel();
+        const chrono::duration<double, nano> elapsed =
+            chrono::steady_clock::now() - start;
+        best = min(best, elapsed.count() / BATCH);
+    }
+    return best;
+}
+
+// Times out[i] = op(a[i], b[i]) for both precisions, where the float operands
+// are converted from the double ones, and compares the results
+template <typename A, typename B, typename R, typename Af, typename Bf,
+          typename Rf, typename Op>
+static bool run(const char *name, int runs, const vector<A> &a,
+                const vector<B> &b, const vector<Af> &af,
+                const vector<Bf> &bf, Op op) {
+    vector<R> out(BATCH);
+    vector<Rf> outf(BATCH);
+    const double doubleNs = timeBest(runs, [&] {
+        for (int i = 0; i < BATCH; ++i)
+            out[i] = op(a[i], b[i]);
+    });
+    const double floatNs = timeBest(runs, [&] {
+        for (int i = 0; i < BATCH; ++i)
+            outf[i] = op(af[i], bf[i]);
+    });
+
+    double error = 0;
+    for (int i = 0; i < BATCH; ++i)
+        error = max(error, maxDifference(out[i], outf[i]));
+    const bool ok = error <= TOLERANCE;
+    cout << left << setw(24) << name << right << fixed << setprecision(2)
+         << setw(8) << floatNs << " ns" << setw(8) << doubleNs
+         << " ns  (double)  max error " << scientific << setprecision(1)
+         << error << (ok ? "" : "  TOO LARGE") << endl;
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    int runs = 20;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            if (string(argv[i]) == "-runs" && i + 1 < argc) {
+                runs = atoi(argv[++i]);
+                if (runs <= 0)
+                    throw runtime_error("Invalid number of runs");
+            } else
+                throw runtime_error(string("Unknown argument ") + argv[i]);
+        }
+    } catch (const runtime_error &e) {
+        cerr << "Exception caught: " << e.what() << endl;
+        cerr << "Usage: " << argv[0] << " [-runs n]" << endl;
+        return -1;
+    }
+
+    // Unit rotations and translations within 10 of the origin, as the
+    // matrices of rigid transforms, and points with w = 1
+    vector<Quat> q(BATCH);
+    vector<RigTForm> tforms(BATCH);
+    vector<Matrix4> matrices(BATCH);
+    vector<Cvec4> points(BATCH);
+    vector<Quatf> qf(BATCH);
+    vector<RigTFormf> tformsf(BATCH);
+    vector<Matrix4f> matricesf(BATCH);
+    vector<Cvec4f> pointsf(BATCH);
+    for (int i = 0; i < BATCH; ++i) {
+        q[i] = randomRotation();
+        tforms[i] = RigTForm(randomVector(), randomRotation());
+        matrices[i] = rigTFormToMatrix(RigTForm(randomVector(), q[i]));
+        points[i] = Cvec4(randomVector(), 1);
+        qf[i] = Quatf(q[i]);
+        tformsf[i] = RigTFormf(tforms[i]);
+        matricesf[i] = Matrix4f(matrices[i]);
+        pointsf[i] = toFloat(points[i]);
+    }
+    // Each operand is paired with the next one
+    vector<Quat> q2(q.begin() + 1, q.end());
+    vector<RigTForm> tforms2(tforms.begin() + 1, tforms.end());
+    vector<Matrix4> matrices2(matrices.begin() + 1, matrices.end());
+    vector<Quatf> qf2(qf.begin() + 1, qf.end());
+    vector<RigTFormf> tformsf2(tformsf.begin() + 1, tformsf.end());
+    vector<Matrix4f> matricesf2(matricesf.begin() + 1, matricesf.end());
+    q2.push_back(q[0]);
+    tforms2.push_back(tforms[0]);
+    matrices2.push_back(matrices[0]);
+    qf2.push_back(qf[0]);
+    tformsf2.push_back(tformsf[0]);
+    matricesf2.push_back(matricesf[0]);
+
+    cout << BATCH << " operations per run, best of " << runs << " runs"
+         << endl;
+    bool ok = true;
+    const auto multiply = [](const auto &x, const auto &y) { return x * y; };
+    ok &= run<Matrix4, Matrix4, Matrix4, Matrix4f, Matrix4f, Matrix4f>(
+        "Matrix4f * Matrix4f", runs, matrices, matrices2, matricesf,
+        matricesf2, multiply);
+    ok &= run<Matrix4, Cvec4, Cvec4, Matrix4f, Cvec4f, Cvec4f>(
+        "Matrix4f * Cvec4f", runs, matrices, points, matricesf, pointsf,
+        multiply);
+    ok &= run<Quat, Quat, Quat, Quatf, Quatf, Quatf>(
+        "Quatf * Quatf", runs, q, q2, qf, qf2, multiply);
+    ok &= run<Quat, Cvec4, Cvec4, Quatf, Cvec4f, Cvec4f>(
+        "Quatf * Cvec4f", runs, q, points, qf, pointsf, multiply);
+    ok &= run<RigTForm, RigTForm, RigTForm, RigTFormf, RigTFormf, RigTFormf>(
+        "RigTFormf * RigTFormf", runs, tforms, tforms2, tformsf, tformsf2,
+        multiply);
+    ok &= run<RigTForm, Cvec4, Cvec4, RigTFormf, Cvec4f, Cvec4f>(
+        "RigTFormf * Cvec4f", runs, tforms, points, tformsf, pointsf,
+        multiply);
+
+    // The interpolations are checked against slerp by mathcheck, so they
+    // are only timed here, per rotation
+    vector<Quat> slerped(BATCH);
+    const double slerpNs = timeBest(runs, [&] {
+        for (int i = 0; i < BATCH; ++i)
+            slerped[i] = slerp(q[i], q2[i], (i + 0.5) / BATCH);
+    });
+    const double fastSlerpNs = timeBest(runs, [&] {
+        for (int i = 0; i < BATCH; ++i)
+            slerped[i] = fastSlerp(q[i], q2[i], (i + 0.5) / BATCH);
+    });
+    RigTFormArray from(BATCH), to(BATCH), lerped;
+    for (int i = 0; i < BATCH; ++i) {
+        from.set(i, RigTForm(Cvec3(), q[i]));
+        to.set(i, RigTForm(Cvec3(), q2[i]));
+    }
+    const double batchNs =
+        timeBest(runs, [&] { lerp(from, to, 0.5f, lerped); });
+    cout << left << setw(24) << "fastSlerp" << right << fixed
+         << setprecision(2) << setw(8) << fastSlerpNs << " ns" << setw(8)
+         << slerpNs << " ns  (slerp)" << endl;
+    cout << left << setw(24) << "RigTFormArray lerp" << right << setw(8)
+         << batchNs << " ns" << setw(8) << slerpNs << " ns  (slerp)" << endl;
+    return ok ? 0 : -1;
+}
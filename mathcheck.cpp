@@ -0,0 +1,143 @@
+// Checks of the batch math kernels against the double classes they mirror:
+//
+//   mathcheck
+//
+// `make check' runs it. Prints each failed check, and exits with -1 if there
+// were any.
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "quat.h"
+#include "rigtform.h"
+#include "rigtformarray.h"
+
+using namespace std;
+
+static mt19937 g_random(175);
+static int g_failures = 0;
+
+static double uniform(double lo, double hi) {
+    return uniform_real_distribution<double>(lo, hi)(g_random);
+}
+
+static RigTForm randomRigTForm() {
+    return RigTForm(Cvec3(uniform(-10, 10), uniform(-10, 10), uniform(-10, 10)),
+                    normalize(Quat(uniform(-1, 1), uniform(-1, 1),
+                                   uniform(-1, 1), uniform(-1, 1))));
+}
+
+// Angle in radians of the rotation from q to p, both unit
+static double angleBetween(const Quat &q, const Quat &p) {
+    const Quat d = p * inv(q);
+    const double s = sqrt(d[1] * d[1] + d[2] * d[2] + d[3] * d[3]);
+    return 2 * atan2(s, abs(d[0]));
+}
+
+static double maxDifference(const RigTForm &a, const RigTForm &b) {
+    double d = 0;
+    for (int i = 0; i < 3; ++i)
+        d = max(d, abs(a.getTranslation()[i] - b.getTranslation()[i]));
+    for (int i = 0; i < 4; ++i)
+        d = max(d, abs(a.getRotation()[i] - b.getRotation()[i]));
+    return d;
+}
+
+static void check(bool ok, const char *what, int i = -1) {
+    if (ok)
+        return;
+    cerr << "FAILED: " << what;
+    if (i >= 0)
+        cerr << " (" << i << ")";
+    cerr << endl;
+    ++g_failures;
+}
+
+// Slots that come into view when the array grows are identities, even where
+// the kernels stored results into the padding
+static void checkResize() {
+    RigTFormArray a(5);
+    for (int i = 0; i < a.size(); ++i)
+        a.set(i, randomRigTForm());
+    // Writes the broadcast transform into slots 5 to 7 as well
+    compose(randomRigTForm(), a, a);
+    a.resize(RIGTFORM_BATCH);
+    for (int i = 5; i < a.size(); ++i)
+        check(maxDifference(a.get(i), RigTForm()) == 0,
+              "growing into the padding gives identities", i);
+
+    a.resize(2);
+    a.resize(RIGTFORM_BATCH + 3);
+    for (int i = 2; i < a.size(); ++i)
+        check(maxDifference(a.get(i), RigTForm()) == 0,
+              "growing after shrinking gives identities", i);
+}
+
+static void checkCompose() {
+    const int n = 3 * RIGTFORM_BATCH + 5;
+    RigTFormArray a(n), b(n), r;
+    vector<RigTForm> da(n), db(n);
+    for (int i = 0; i < n; ++i) {
+        a.set(i, da[i] = randomRigTForm());
+        b.set(i, db[i] = randomRigTForm());
+    }
+    compose(a, b, r);
+    check(r.size() == n, "compose sizes the result");
+    for (int i = 0; i < n; ++i)
+        check(maxDifference(r.get(i), da[i] * db[i]) < 1e-4,
+              "compose matches RigTForm", i);
+}
+
+// fastSlerp, and the batch kernels with their float weights, against slerp
+// over a grid of t and of angles short of a half turn (where either arc is
+// the shorter, so rounding may pick the other), each about a few axes. The
+// documented bound is 2e-5 radians; the grid reaches about 1.5e-5.
+static void checkSlerp() {
+    static const double TOLERANCE = 2e-5, BATCH_TOLERANCE = 5e-5;
+    static const int STEPS = 64, ANGLES = 512, AXES = 4,
+                     PAIRS = ANGLES * AXES;
+    vector<Quat> q0(PAIRS), q1(PAIRS);
+    RigTFormArray a(PAIRS), b(PAIRS), r;
+    for (int k = 0; k < PAIRS; ++k) {
+        const double angle = CS175_PI * (k / AXES) / ANGLES;
+        const Cvec3 axis =
+            normalize(Cvec3(uniform(-1, 1), uniform(-1, 1), uniform(-1, 1)));
+        q0[k] = randomRigTForm().getRotation();
+        q1[k] = Quat(cos(angle / 2), axis * sin(angle / 2)) * q0[k];
+        a.set(k, RigTForm(Cvec3(), q0[k]));
+        b.set(k, RigTForm(Cvec3(), q1[k]));
+    }
+
+    double error = 0, batchError = 0;
+    for (int i = 0; i <= STEPS; ++i) {
+        const double t = double(i) / STEPS;
+        lerp(a, b, float(t), r);
+        for (int k = 0; k < PAIRS; ++k) {
+            const Quat q = slerp(q0[k], q1[k], t);
+            const double e = angleBetween(q, fastSlerp(q0[k], q1[k], t));
+            check(e <= TOLERANCE, "fastSlerp is within 2e-5 of slerp", k);
+            error = max(error, e);
+
+            const double be = angleBetween(q, r.get(k).getRotation());
+            check(be <= BATCH_TOLERANCE, "batch lerp is within 5e-5 of slerp",
+                  k);
+            batchError = max(batchError, be);
+        }
+    }
+    cout << "fastSlerp max error " << error << " rad, batch lerp "
+         << batchError << " rad" << endl;
+}
+
+int main() {
+    checkResize();
+    checkCompose();
+    checkSlerp();
+    if (g_failures > 0) {
+        cerr << g_failures << " checks failed" << endl;
+        return -1;
+    }
+    cout << "All checks passed" << endl;
+    return 0;
+}
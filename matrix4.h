@@ -8,7 +8,7 @@
 
 // Forward declaration of Matrix4 and transpose since those are used below
 class Matrix4;
-Matrix4 transpose(const Matrix4 &m);
+constexpr Matrix4 transpose(const Matrix4 &m);
 
 // A 4x4 Matrix.
 // To get the element at ith row and jth column, use a(i,j)
@@ -16,77 +16,83 @@ class Matrix4 {
     double d_[16]; // layout is row-major
 
   public:
-    double &operator()(const int row, const int col) {
+    constexpr double &operator()(const int row, const int col) {
         return d_[(row << 2) + col];
     }
 
-    const double &operator()(const int row, const int col) const {
+    constexpr const double &operator()(const int row, const int col) const {
         return d_[(row << 2) + col];
     }
 
-    double &operator[](const int i) { return d_[i]; }
+    constexpr double &operator[](const int i) { return d_[i]; }
 
-    const double &operator[](const int i) const { return d_[i]; }
+    constexpr const double &operator[](const int i) const { return d_[i]; }
 
-    Matrix4() {
-        for (int i = 0; i < 16; ++i) {
-            d_[i] = 0;
-        }
+    constexpr Matrix4() : d_() {
         for (int i = 0; i < 4; ++i) {
             (*this)(i, i) = 1;
         }
     }
 
-    explicit Matrix4(const double a) {
+    constexpr explicit Matrix4(const double a) : d_() {
         for (int i = 0; i < 16; ++i) {
             d_[i] = a;
         }
     }
 
-    template <class T> Matrix4 &readFromColumnMajorMatrix(const T m[]) {
+    template <class T>
+    constexpr Matrix4 &readFromColumnMajorMatrix(const T m[]) {
         for (int i = 0; i < 16; ++i) {
             d_[i] = m[i];
         }
         return *this = transpose(*this);
     }
 
-    template <class T> void writeToColumnMajorMatrix(T m[]) const {
+    template <class T> constexpr void writeToColumnMajorMatrix(T m[]) const {
         Matrix4 t = transpose(*this);
         for (int i = 0; i < 16; ++i) {
             m[i] = T(t.d_[i]);
         }
     }
 
-    Matrix4 &operator+=(const Matrix4 &m) {
+    constexpr Matrix4 &operator+=(const Matrix4 &m) {
         for (int i = 0; i < 16; ++i) {
             d_[i] += m.d_[i];
         }
         return *this;
     }
 
-    Matrix4 &operator-=(const Matrix4 &m) {
+    constexpr Matrix4 &operator-=(const Matrix4 &m) {
         for (int i = 0; i < 16; ++i) {
             d_[i] -= m.d_[i];
         }
         return *this;
     }
 
-    Matrix4 &operator*=(const double a) {
+    constexpr Matrix4 &operator*=(const double a) {
         for (int i = 0; i < 16; ++i) {
             d_[i] *= a;
         }
         return *this;
     }
 
-    Matrix4 &operator*=(const Matrix4 &a) { return *this = *this * a; }
+    constexpr Matrix4 &operator*=(const Matrix4 &a) {
+        return *this = *this * a;
+    }
 
-    Matrix4 operator+(const Matrix4 &a) const { return Matrix4(*this) += a; }
+    constexpr Matrix4 operator+(const Matrix4 &a) const {
+        return Matrix4(*this) += a;
+    }
 
-    Matrix4 operator-(const Matrix4 &a) const { return Matrix4(*this) -= a; }
+    constexpr Matrix4 operator-(const Matrix4 &a) const {
+        return Matrix4(*this) -= a;
+    }
 
-    Matrix4 operator*(const double a) const { return Matrix4(*this) *= a; }
+    constexpr Matrix4 operator*(const double a) const {
+        return Matrix4(*this) *= a;
+    }
 
-    Cvec4 operator*(const Cvec4 &v) const {
+    constexpr Cvec4 operator*(const Cvec4 &v) const {
         Cvec4 r(0);
         for (int i = 0; i < 4; ++i) {
             for (int j = 0; j < 4; ++j) {
@@ -96,7 +102,7 @@ class Matrix4 {
         return r;
     }
 
-    Matrix4 operator*(const Matrix4 &m) const {
+    constexpr Matrix4 operator*(const Matrix4 &m) const {
         Matrix4 r(0);
         for (int i = 0; i < 4; ++i) {
             for (int j = 0; j < 4; ++j) {
@@ -123,7 +129,7 @@ class Matrix4 {
                              std::sin(ang * CS175_PI / 180));
     }
 
-    static Matrix4 makeXRotation(const double c, const double s) {
+    static constexpr Matrix4 makeXRotation(const double c, const double s) {
         Matrix4 r;
         r(1, 1) = r(2, 2) = c;
         r(1, 2) = -s;
@@ -131,7 +137,7 @@ class Matrix4 {
         return r;
     }
 
-    static Matrix4 makeYRotation(const double c, const double s) {
+    static constexpr Matrix4 makeYRotation(const double c, const double s) {
         Matrix4 r;
         r(0, 0) = r(2, 2) = c;
         r(0, 2) = s;
@@ -139,7 +145,7 @@ class Matrix4 {
         return r;
     }
 
-    static Matrix4 makeZRotation(const double c, const double s) {
+    static constexpr Matrix4 makeZRotation(const double c, const double s) {
         Matrix4 r;
         r(0, 0) = r(1, 1) = c;
         r(0, 1) = -s;
@@ -147,7 +153,7 @@ class Matrix4 {
         return r;
     }
 
-    static Matrix4 makeTranslation(const Cvec3 &t) {
+    static constexpr Matrix4 makeTranslation(const Cvec3 &t) {
         Matrix4 r;
         for (int i = 0; i < 3; ++i) {
             r(i, 3) = t[i];
@@ -155,7 +161,7 @@ class Matrix4 {
         return r;
     }
 
-    static Matrix4 makeScale(const Cvec3 &s) {
+    static constexpr Matrix4 makeScale(const Cvec3 &s) {
         Matrix4 r;
         for (int i = 0; i < 3; ++i) {
             r(i, i) = s[i];
@@ -213,7 +219,7 @@ inline bool isAffine(const Matrix4 &m) {
            CS175_EPS;
 }
 
-inline double norm2(const Matrix4 &m) {
+constexpr double norm2(const Matrix4 &m) {
     double r = 0;
     for (int i = 0; i < 16; ++i) {
         r += m[i] * m[i];
@@ -252,7 +258,7 @@ inline Matrix4 inv(const Matrix4 &m) {
     return r;
 }
 
-inline Matrix4 transpose(const Matrix4 &m) {
+constexpr Matrix4 transpose(const Matrix4 &m) {
     Matrix4 r(0);
     for (int i = 0; i < 4; ++i) {
         for (int j = 0; j < 4; ++j) {
@@ -0,0 +1,112 @@
+#ifndef MATRIX4F_H
+#define MATRIX4F_H
+
+#include <cstring>
+
+#include "cvec.h"
+#include "matrix4.h"
+
+// SSE is part of every x86-64 target; elsewhere the kernels below fall back
+// to plain loops
+#if defined(__SSE__) || defined(_M_X64) ||                                     \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define CS175_SSE 1
+#include <xmmintrin.h>
+#endif
+
+// A 4x4 float matrix, the single precision counterpart of Matrix4 for the
+// render path. Stored column-major, as GL takes it, so Uniforms copies it as
+// is. To get the element at ith row and jth column, use a(i,j)
+class Matrix4f {
+    alignas(16) float d_[16]; // layout is column-major
+
+  public:
+    float &operator()(const int row, const int col) {
+        return d_[(col << 2) + row];
+    }
+
+    const float &operator()(const int row, const int col) const {
+        return d_[(col << 2) + row];
+    }
+
+    // The 16 elements, column after column
+    const float *data() const { return d_; }
+
+    Matrix4f() {
+        for (int i = 0; i < 16; ++i) {
+            d_[i] = 0;
+        }
+        for (int i = 0; i < 4; ++i) {
+            (*this)(i, i) = 1;
+        }
+    }
+
+    explicit Matrix4f(const float a) {
+        for (int i = 0; i < 16; ++i) {
+            d_[i] = a;
+        }
+    }
+
+    explicit Matrix4f(const Matrix4 &m) { m.writeToColumnMajorMatrix(d_); }
+
+    Matrix4 toMatrix4() const {
+        Matrix4 m;
+        return m.readFromColumnMajorMatrix(d_);
+    }
+
+    template <class T> void writeToColumnMajorMatrix(T m[]) const {
+        for (int i = 0; i < 16; ++i) {
+            m[i] = T(d_[i]);
+        }
+    }
+
+    Cvec4f operator*(const Cvec4f &v) const {
+        Cvec4f r;
+#ifdef CS175_SSE
+        __m128 c = _mm_mul_ps(_mm_load_ps(d_), _mm_set1_ps(v[0]));
+        c = _mm_add_ps(c, _mm_mul_ps(_mm_load_ps(d_ + 4), _mm_set1_ps(v[1])));
+        c = _mm_add_ps(c, _mm_mul_ps(_mm_load_ps(d_ + 8), _mm_set1_ps(v[2])));
+        c = _mm_add_ps(c,
+                       _mm_mul_ps(_mm_load_ps(d_ + 12), _mm_set1_ps(v[3])));
+        _mm_storeu_ps(&r[0], c);
+#else
+        for (int i = 0; i < 4; ++i) {
+            r[i] = 0;
+            for (int j = 0; j < 4; ++j) {
+                r[i] += (*this)(i, j) * v[j];
+            }
+        }
+#endif
+        return r;
+    }
+
+    Matrix4f operator*(const Matrix4f &m) const {
+        Matrix4f r(0);
+#ifdef CS175_SSE
+        // Each column of the product combines the columns of *this
+        const __m128 c0 = _mm_load_ps(d_), c1 = _mm_load_ps(d_ + 4),
+                     c2 = _mm_load_ps(d_ + 8), c3 = _mm_load_ps(d_ + 12);
+        for (int j = 0; j < 4; ++j) {
+            const float *b = m.d_ + 4 * j;
+            __m128 c = _mm_mul_ps(c0, _mm_set1_ps(b[0]));
+            c = _mm_add_ps(c, _mm_mul_ps(c1, _mm_set1_ps(b[1])));
+            c = _mm_add_ps(c, _mm_mul_ps(c2, _mm_set1_ps(b[2])));
+            c = _mm_add_ps(c, _mm_mul_ps(c3, _mm_set1_ps(b[3])));
+            _mm_store_ps(r.d_ + 4 * j, c);
+        }
+#else
+        for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                for (int k = 0; k < 4; ++k) {
+                    r(i, k) += (*this)(i, j) * m(j, k);
+                }
+            }
+        }
+#endif
+        return r;
+    }
+
+    Matrix4f &operator*=(const Matrix4f &a) { return *this = *this * a; }
+};
+
+#endif
@@ -1,12 +1,18 @@
 #ifndef MESH_H
 #define MESH_H
 
-#include <fstream>
-#include <map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
 #include <utility>
 #include <vector>
 
 #include "cvec.h"
+#include "mappedfile.h"
+#include "meshfile.h"
 
 class Mesh {
     typedef int vertex_index;
@@ -39,43 +45,86 @@ class Mesh {
     bool with_boundary_;
 
     int fn__(const int i) const { return face_[i].vertex_[3] == -1 ? 3 : 4; }
+    // A half-edge with the key of its edge: the larger vertex index in the
+    // high 32 bits, the smaller in the low ones
+    struct halfedge_key_t {
+        unsigned long long key_;
+        int halfedge_;
+    };
+
+    // Stable LSD radix sort by key_, 16 bits per pass. Passes over digits
+    // that are the same in all keys are skipped, so that meshes with less
+    // than 65536 vertices need only two.
+    static void sort_keys__(std::vector<halfedge_key_t> &keys) {
+        if (keys.empty())
+            return;
+        std::vector<halfedge_key_t> sorted(keys.size());
+        std::vector<std::size_t> offset(1 << 16);
+        for (int shift = 0; shift < 64; shift += 16) {
+            std::fill(offset.begin(), offset.end(), 0);
+            for (std::size_t i = 0; i < keys.size(); ++i) {
+                ++offset[(keys[i].key_ >> shift) & 0xffff];
+            }
+            if (offset[(keys[0].key_ >> shift) & 0xffff] == keys.size())
+                continue;
+            std::size_t sum = 0;
+            for (std::size_t d = 0; d < offset.size(); ++d) {
+                const std::size_t count = offset[d];
+                offset[d] = sum;
+                sum += count;
+            }
+            for (std::size_t i = 0; i < keys.size(); ++i) {
+                sorted[offset[(keys[i].key_ >> shift) & 0xffff]++] = keys[i];
+            }
+            keys.swap(sorted);
+        }
+    }
+
+    // Edges come out of the sorted half-edge keys, in the same order and
+    // with the same half-edges as a map from vertex pairs would give them
     void init_topology__() {
-        std::map<std::pair<int, int>, Cvec<int, 2>> E;
+        std::vector<halfedge_key_t> keys;
+        keys.reserve(4 * face_.size());
         for (std::size_t i = 0; i < face_.size(); ++i) {
             const int n = fn__(i);
             for (int j = 0; j < n; ++j) {
-                const int vj = i | (j << 28);
                 const int k = (j + 1) % n;
-                std::pair<int, int> e(face_[i].vertex_[j], face_[i].vertex_[k]);
-                if (e.first < e.second) {
-                    const int t = e.first;
-                    e.first = e.second;
-                    e.second = t;
-                }
-                if (E.find(e) == E.end()) {
-                    E[e] = Cvec<int, 2>(vj, -1);
-                } else {
-                    Cvec<int, 2> &v = E[e];
-                    if (v[1] != -1)
-                        not_manifold_ = true;
-
-                    v[1] = vj;
-                }
+                unsigned int a = face_[i].vertex_[j], b = face_[i].vertex_[k];
+                if (a < b)
+                    std::swap(a, b);
+                halfedge_key_t h;
+                h.key_ = (static_cast<unsigned long long>(a) << 32) | b;
+                h.halfedge_ = i | (j << 28);
+                keys.push_back(h);
             }
         }
-        edge_.resize(E.size());
-        int e = 0;
-        for (std::map<std::pair<int, int>, Cvec<int, 2>>::iterator i =
-                 E.begin();
-             i != E.end(); ++i, ++e) {
-            edge_[e].halfedge_ = i->second;
+        sort_keys__(keys);
+
+        // A run of equal keys is one edge, with its half-edges in face order
+        // as the sort is stable. It keeps the first and the last; a third
+        // makes the mesh non manifold, a missing second gives a boundary.
+        edge_.clear();
+        edge_.reserve(keys.size() / 2 + 1);
+        for (std::size_t r = 0; r < keys.size();) {
+            std::size_t end = r + 1;
+            while (end < keys.size() && keys[end].key_ == keys[r].key_)
+                ++end;
+            if (end - r > 2)
+                not_manifold_ = true;
+
+            const int e = edge_.size();
+            edge_.push_back(edge_t());
+            Cvec<int, 2> &h = edge_.back().halfedge_;
+            h = Cvec<int, 2>(keys[r].halfedge_,
+                             end - r > 1 ? keys[end - 1].halfedge_ : -1);
             for (int j = 0; j < 2; ++j) {
-                if (i->second[j] != -1)
-                    face_[i->second[j] & ((1 << 28) - 1)]
-                        .edge_[i->second[j] >> 28] = e | (j << 28);
+                if (h[j] != -1)
+                    face_[h[j] & ((1 << 28) - 1)].edge_[h[j] >> 28] =
+                        e | (j << 28);
                 else
                     with_boundary_ = true;
             }
+            r = end;
         }
     }
     void resize__() {
@@ -83,33 +132,70 @@ class Mesh {
         f_.resize(face_.size());
         e_.resize(edge_.size());
     }
-    void load__(const char filename[]) {
-        using namespace std;
-
-        ifstream f(filename);
-        if (!f) {
-            throw std::runtime_error(std::string("Cannot open file ") +
-                                     filename);
+    // Whether the triangle then quad indices all name vertices of the mesh,
+    // and there are few enough faces for the 28 bits of a half-edge
+    bool valid_faces__(const std::size_t nt, const std::size_t nq,
+                       const int *indices) const {
+        if (nt + nq > (1 << 28))
+            return false;
+        const int nv = vertex_.size();
+        for (std::size_t i = 0; i < 3 * nt + 4 * nq; ++i) {
+            if (indices[i] < 0 || indices[i] >= nv)
+                return false;
         }
-        // Sets bits to report IO error using exception
-        f.exceptions(ios::eofbit | ios::failbit | ios::badbit);
-
-        int nv, nt, nq; // number of: vertices, tris, quads
-        f >> nv >> nt >> nq;
-        vertex_.resize(nv);
-        face_.resize(nt + nq);
-        for (int i = 0; i < nv; ++i) {
-            f >> vertex_[i].position_[0] >> vertex_[i].position_[1] >>
-                vertex_[i].position_[2];
+        return true;
+    }
+    // Whether h is a half-edge, face | corner << 28, of one of the faces
+    bool valid_halfedge__(const int h) const {
+        return h >= 0 && (h & ((1 << 28) - 1)) < int(face_.size()) &&
+               (h >> 28) < fn__(h & ((1 << 28) - 1));
+    }
+    // Whether face_[].edge_ and edge_ hold together as init_topology__
+    // leaves them: each face corner names an edge half-edge naming it back,
+    // and the two half-edges of an edge join the same two vertices. Corners
+    // dropped from a non manifold edge fail this, and are rebuilt.
+    bool valid_topology__() const {
+        const int mask = (1 << 28) - 1, ne = edge_.size();
+        if (ne > (1 << 28))
+            return false;
+        for (std::size_t i = 0; i < face_.size(); ++i) {
+            for (int j = 0; j < fn__(i); ++j) {
+                const int e = face_[i].edge_[j];
+                if (e < 0 || (e & mask) >= ne || (e >> 28) > 1 ||
+                    edge_[e & mask].halfedge_[e >> 28] != int(i | (j << 28)))
+                    return false;
+            }
         }
-        for (int i = 0; i < nt; ++i) {
-            f >> face_[i].vertex_[0] >> face_[i].vertex_[1] >>
-                face_[i].vertex_[2];
-            face_[i].vertex_[3] = -1;
+        for (int i = 0; i < ne; ++i) {
+            const Cvec<int, 2> &h = edge_[i].halfedge_;
+            // The second is -1 on a boundary
+            const int n = h[1] == -1 ? 1 : 2;
+            int a[2], b[2];
+            for (int k = 0; k < n; ++k) {
+                if (!valid_halfedge__(h[k]) ||
+                    face_[h[k] & mask].edge_[h[k] >> 28] != (i | (k << 28)))
+                    return false;
+                const int f = h[k] & mask, j = h[k] >> 28;
+                a[k] = face_[f].vertex_[j];
+                b[k] = face_[f].vertex_[(j + 1) % fn__(f)];
+            }
+            if (n == 2 && !(a[0] == b[1] && b[0] == a[1]) &&
+                !(a[0] == a[1] && b[0] == b[1]))
+                return false;
         }
-        for (int i = 0; i < nq; ++i) {
-            f >> face_[nt + i].vertex_[0] >> face_[nt + i].vertex_[1] >>
-                face_[nt + i].vertex_[2] >> face_[nt + i].vertex_[3];
+        return true;
+    }
+    // Faces from the triangle then quad indices, and a half-edge out of
+    // each vertex
+    void init_faces__(const int nt, const int nq, const int *indices) {
+        face_.resize(nt + nq);
+        for (int i = 0; i < nt; ++i, indices += 3) {
+            face_[i].vertex_ =
+                Cvec<int, 4>(indices[0], indices[1], indices[2], -1);
+        }
+        for (int i = 0; i < nq; ++i, indices += 4) {
+            face_[nt + i].vertex_ =
+                Cvec<int, 4>(indices[0], indices[1], indices[2], indices[3]);
         }
         for (int i = 0; i < nt; ++i) {
             for (int j = 0; j < 3; ++j) {
@@ -121,8 +207,24 @@ class Mesh {
                 vertex_[face_[nt + i].vertex_[j]].halfedge_ = i | (j << 28);
             }
         }
+    }
+    void load_text__(const MappedFile &file, const char filename[]) {
+        int nt;
+        std::vector<double> positions;
+        std::vector<int> indices;
+        parseMeshText(file, filename, nt, positions, indices);
+        const int nv = positions.size() / 3;
+        const int nq = (indices.size() - 3 * nt) / 4;
+        vertex_.resize(nv);
+        for (int i = 0; i < nv; ++i) {
+            vertex_[i].position_ = Cvec3(positions[3 * i], positions[3 * i + 1],
+                                         positions[3 * i + 2]);
+        }
+        if (!valid_faces__(nt, nq, indices.empty() ? 0 : &indices[0]))
+            throw std::runtime_error(std::string("Malformed mesh file ") +
+                                     filename);
+        init_faces__(nt, nq, indices.empty() ? 0 : &indices[0]);
         init_topology__();
-        resize__();
         Cvec3 center(0);
         for (std::size_t i = 0; i < vertex_.size(); ++i) {
             center += vertex_[i].position_;
@@ -139,10 +241,123 @@ class Mesh {
         for (std::size_t i = 0; i < vertex_.size(); ++i) {
             vertex_[i].position_ *= 1 / rms;
         }
+    }
+    // The arrays are used in place from the mapping. Positions are already
+    // centered and scaled. The face indices are checked; the half-edge
+    // tables, when stored, are kept only if they hold together, and are
+    // rebuilt otherwise.
+    void load_binary__(const MappedFile &file, const char filename[]) {
+        MeshFileHeader h;
+        std::memcpy(&h, file.data(), sizeof(h));
+        const bool topology = (h.flags & MESH_FILE_TOPOLOGY) != 0;
+        const std::size_t nv = h.numVertices, nt = h.numTris,
+                          nq = h.numQuads, nf = nt + nq,
+                          ne = topology ? h.numEdges : 0;
+        const std::size_t size =
+            sizeof(h) + 4 * (3 * nv + 3 * nt + 4 * nq) +
+            (topology ? 4 * (nv + 4 * nf + 2 * ne) : 0);
+        const std::string error = std::string("Invalid mesh file ") + filename;
+        if (file.size() < size ||
+            nv > std::size_t(std::numeric_limits<int>::max()))
+            throw std::runtime_error(error);
+
+        const float *p = reinterpret_cast<const float *>(file.data() +
+                                                         sizeof(h));
+        vertex_.resize(nv);
+        for (std::size_t i = 0; i < nv; ++i, p += 3) {
+            vertex_[i].position_ = Cvec3(p[0], p[1], p[2]);
+        }
+        const int32_t *indices = reinterpret_cast<const int32_t *>(p);
+        if (!valid_faces__(nt, nq, indices))
+            throw std::runtime_error(error);
+        init_faces__(nt, nq, indices);
+
+        if (topology) {
+            const int32_t *t = indices + 3 * nt + 4 * nq;
+            // A stored half-edge out of a vertex must start at the vertex
+            for (std::size_t i = 0; i < nv; ++i, ++t) {
+                if (valid_halfedge__(*t) &&
+                    face_[*t & ((1 << 28) - 1)].vertex_[*t >> 28] == int(i))
+                    vertex_[i].halfedge_ = *t;
+            }
+            for (std::size_t i = 0; i < nf; ++i, t += 4) {
+                face_[i].edge_ = Cvec<int, 4>(t[0], t[1], t[2], t[3]);
+            }
+            edge_.resize(ne);
+            for (std::size_t i = 0; i < ne; ++i, t += 2) {
+                edge_[i].halfedge_ = Cvec<int, 2>(t[0], t[1]);
+                with_boundary_ |= t[1] == -1;
+            }
+            not_manifold_ = (h.flags & MESH_FILE_NOT_MANIFOLD) != 0;
+            if (valid_topology__())
+                return;
+            not_manifold_ = with_boundary_ = false;
+        }
+        init_topology__();
+    }
+    // .mesh text, or the binary meshfile.h container made from it
+    void load__(const char filename[]) {
+        const MappedFile file(filename);
+        not_manifold_ = with_boundary_ = false;
+        if (isMeshFile(file))
+            load_binary__(file, filename);
+        else
+            load_text__(file, filename);
+        resize__();
         for (std::size_t i = 0; i < vertex_.size(); ++i) {
             vertex_[i].normal_[0] = -5e37;
         }
     }
+    // Faces must be the triangles then the quads, as load__ and subdivide__
+    // leave them
+    void save__(const char filename[], const bool topology) const {
+        MeshFileHeader h;
+        std::memset(&h, 0, sizeof(h));
+        h.numVertices = vertex_.size();
+        while (h.numTris < face_.size() && fn__(h.numTris) == 3)
+            ++h.numTris;
+        h.numQuads = face_.size() - h.numTris;
+        std::vector<float> positions;
+        positions.reserve(3 * vertex_.size());
+        for (std::size_t i = 0; i < vertex_.size(); ++i) {
+            for (int j = 0; j < 3; ++j) {
+                positions.push_back(vertex_[i].position_[j]);
+            }
+        }
+        std::vector<int> indices;
+        indices.reserve(4 * face_.size());
+        for (std::size_t i = 0; i < face_.size(); ++i) {
+            const int n = fn__(i);
+            if (n == 3 && i >= h.numTris)
+                throw std::runtime_error(
+                    "Cannot save a mesh with triangles after quads");
+            for (int j = 0; j < n; ++j) {
+                indices.push_back(face_[i].vertex_[j]);
+            }
+        }
+        std::vector<int> tables;
+        if (topology) {
+            h.flags = MESH_FILE_TOPOLOGY |
+                      (not_manifold_ ? MESH_FILE_NOT_MANIFOLD : 0) |
+                      (with_boundary_ ? MESH_FILE_WITH_BOUNDARY : 0);
+            h.numEdges = edge_.size();
+            tables.reserve(vertex_.size() + 4 * face_.size() +
+                           2 * edge_.size());
+            for (std::size_t i = 0; i < vertex_.size(); ++i) {
+                tables.push_back(vertex_[i].halfedge_);
+            }
+            for (std::size_t i = 0; i < face_.size(); ++i) {
+                for (int j = 0; j < 4; ++j) {
+                    tables.push_back(face_[i].edge_[j]);
+                }
+            }
+            for (std::size_t i = 0; i < edge_.size(); ++i) {
+                tables.push_back(edge_[i].halfedge_[0]);
+                tables.push_back(edge_[i].halfedge_[1]);
+            }
+        }
+        writeMeshFile(filename, h, positions, indices, tables);
+    }
     void subdivide__() {
         if (not_manifold_)
             throw std::runtime_error(
@@ -225,6 +440,76 @@ class Mesh {
         resize__();
     }
 
+    // Area weighted normal of each face, unnormalized: for a quad, the cross
+    // product of its diagonals
+    Cvec3 face_normal__(const int i) const {
+        const Cvec<int, 4> &v = face_[i].vertex_;
+        if (fn__(i) == 3)
+            return cross(vertex_[v[1]].position_ - vertex_[v[0]].position_,
+                         vertex_[v[2]].position_ - vertex_[v[0]].position_);
+        return cross(vertex_[v[2]].position_ - vertex_[v[0]].position_,
+                     vertex_[v[3]].position_ - vertex_[v[1]].position_);
+    }
+    static Cvec3 unit__(const Cvec3 &n) {
+        const double l2 = dot(n, n);
+        return l2 > CS175_EPS2 ? n / std::sqrt(l2) : n;
+    }
+    // The vertices of export_indexed__, in the same order
+    template <typename Vertex>
+    void export_vertices__(std::vector<Vertex> &vertices,
+                           const bool faceted) const {
+        if (faceted) {
+            vertices.clear();
+            for (std::size_t i = 0; i < face_.size(); ++i) {
+                const Cvec3 n = unit__(face_normal__(i));
+                for (int j = 0; j < fn__(i); ++j) {
+                    vertices.push_back(
+                        Vertex(vertex_[face_[i].vertex_[j]].position_, n));
+                }
+            }
+            return;
+        }
+        std::vector<Cvec3> normals(vertex_.size(), Cvec3(0));
+        for (std::size_t i = 0; i < face_.size(); ++i) {
+            const Cvec3 n = face_normal__(i);
+            for (int j = 0; j < fn__(i); ++j) {
+                normals[face_[i].vertex_[j]] += n;
+            }
+        }
+        vertices.clear();
+        vertices.reserve(vertex_.size());
+        for (std::size_t i = 0; i < vertex_.size(); ++i) {
+            vertices.push_back(
+                Vertex(vertex_[i].position_, unit__(normals[i])));
+        }
+    }
+    // Quads are split along their 0-2 diagonal. Faceted, each face gets its
+    // own corners; smooth, the mesh vertices are shared.
+    template <typename Index>
+    void export_indices__(std::vector<Index> &indices,
+                          const bool faceted) const {
+        indices.clear();
+        std::size_t corner = 0;
+        for (std::size_t i = 0; i < face_.size(); ++i) {
+            const int n = fn__(i);
+            Index v[4];
+            for (int j = 0; j < n; ++j) {
+                const std::size_t k =
+                    faceted ? corner + j : std::size_t(face_[i].vertex_[j]);
+                if (k > std::numeric_limits<Index>::max())
+                    throw std::runtime_error(
+                        "Mesh has too many vertices for the index type");
+                v[j] = Index(k);
+            }
+            corner += n;
+            for (int j = 2; j < n; ++j) {
+                indices.push_back(v[0]);
+                indices.push_back(v[j - 1]);
+                indices.push_back(v[j]);
+            }
+        }
+    }
+
   public:
     struct VertexIterator; // forward declaration (needed by Vertex class)
 
@@ -343,6 +628,11 @@ class Mesh {
     int getNumEdges() const { return edge_.size(); }
     int getNumVertices() const { return vertex_.size(); }
 
+    // Whether no edge has more than two faces, and whether one has only one;
+    // subdivision needs a manifold mesh without boundary
+    bool isManifold() const { return !not_manifold_; }
+    bool hasBoundary() const { return with_boundary_; }
+
     Vertex getVertex(const int i) { return Vertex(*this, i); }
     Edge getEdge(const int i) { return Edge(*this, i); }
     Face getFace(const int i) { return Face(*this, i); }
@@ -355,8 +645,35 @@ class Mesh {
     void setNewEdgeVertex(const Edge &e, const Cvec3 &p) { e_[e.e_] = p; }
     void setNewVertexVertex(const Vertex &v, const Cvec3 &p) { v_[v.v_] = p; }
 
+    // Vertex and index streams for indexed drawing, as taken by
+    // SimpleIndexedGeometry::upload. Vertex is made from a position and a
+    // normal, e.g., VertexPN. Smooth, each mesh vertex appears once with the
+    // area weighted average of its faces' normals; faceted, each face has
+    // its own vertices with its normal.
+    template <typename Vertex, typename Index>
+    void exportIndexed(std::vector<Vertex> &vertices,
+                       std::vector<Index> &indices,
+                       const bool faceted = false) const {
+        export_vertices__(vertices, faceted);
+        export_indices__(indices, faceted);
+    }
+
+    // After vertices have moved, the new positions and normals for the
+    // vertex stream of exportIndexed; its indices are still valid
+    template <typename Vertex>
+    void exportVertices(std::vector<Vertex> &vertices,
+                        const bool faceted = false) const {
+        export_vertices__(vertices, faceted);
+    }
+
     void subdivide() { subdivide__(); }
     void load(const char filename[]) { load__(filename); }
+
+    // Writes the binary container of meshfile.h, with the half-edge tables
+    // unless topology is false, for load to read without parsing
+    void save(const char filename[], const bool topology = true) const {
+        save__(filename, topology);
+    }
 };
 
 #endif
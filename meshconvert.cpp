@@ -0,0 +1,49 @@
+// Converts .mesh text into binary mesh containers (see meshfile.h), so that
+// the meshes load by mapping the file instead of parsing it:
+//
+//   meshconvert [-notopology] model.mesh...
+//
+// writes model.bmesh next to each mesh, with the positions centered and
+// scaled as Mesh::load leaves them. Unless -notopology, the half-edge tables
+// are stored too and need not be rebuilt on load.
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "mesh.h"
+
+using namespace std;
+
+static void convert(const string &meshFileName, bool topology) {
+    Mesh mesh;
+    mesh.load(meshFileName.c_str());
+
+    const string binaryFileName = getMeshFileName(meshFileName);
+    mesh.save(binaryFileName.c_str(), topology);
+    cout << meshFileName << " -> " << binaryFileName << " ("
+         << mesh.getNumVertices() << " vertices, " << mesh.getNumFaces()
+         << " faces" << (topology ? ", topology" : "") << ")" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    bool topology = true;
+    int converted = 0;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            if (string(argv[i]) == "-notopology") {
+                topology = false;
+            } else {
+                convert(argv[i], topology);
+                ++converted;
+            }
+        }
+    } catch (const runtime_error &e) {
+        cerr << "Exception caught: " << e.what() << endl;
+        return -1;
+    }
+    if (converted == 0) {
+        cerr << "Usage: " << argv[0] << " [-notopology] model.mesh..." << endl;
+        return -1;
+    }
+    return 0;
+}
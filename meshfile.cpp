@@ -0,0 +1,179 @@
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "meshfile.h"
+#include "parallel.h"
+
+using namespace std;
+
+static const char kMagic[8] = {'C', 'S', '1', '7', '5', 'M', 'S', 'H'};
+
+// Text is split into chunks of this many bytes, parsed in parallel
+static const size_t kChunkSize = 1 << 18;
+
+string getMeshFileName(const string &textFileName) {
+    const size_t dot = textFileName.rfind('.');
+    const size_t slash = textFileName.find_last_of("/\\");
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+        return textFileName + ".bmesh";
+    return textFileName.substr(0, dot) + ".bmesh";
+}
+
+bool isMeshFile(const MappedFile &file) {
+    MeshFileHeader header;
+    if (file.size() < sizeof(header))
+        return false;
+    memcpy(&header, file.data(), sizeof(header));
+    return memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+           header.version == MESH_FILE_VERSION;
+}
+
+void writeMeshFile(const char *filename, MeshFileHeader header,
+                   const vector<float> &positions, const vector<int> &indices,
+                   const vector<int> &topology) {
+    const size_t nf = size_t(header.numTris) + header.numQuads;
+    if (positions.size() != 3 * size_t(header.numVertices) ||
+        indices.size() != 3 * size_t(header.numTris) + 4 * header.numQuads)
+        throw runtime_error("writeMeshFile: wrong array size");
+    if ((header.flags & MESH_FILE_TOPOLOGY) &&
+        topology.size() != header.numVertices + 4 * nf + 2 * header.numEdges)
+        throw runtime_error("writeMeshFile: wrong topology size");
+    if (!(header.flags & MESH_FILE_TOPOLOGY) &&
+        (!topology.empty() || header.numEdges != 0))
+        throw runtime_error("writeMeshFile: topology without the flag");
+
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = MESH_FILE_VERSION;
+
+    ofstream f(filename, ios::binary);
+    f.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    f.write(reinterpret_cast<const char *>(positions.data()),
+            positions.size() * sizeof(float));
+    f.write(reinterpret_cast<const char *>(indices.data()),
+            indices.size() * sizeof(int));
+    f.write(reinterpret_cast<const char *>(topology.data()),
+            topology.size() * sizeof(int));
+    if (!f)
+        throw runtime_error(string("Cannot write mesh file ") + filename);
+}
+
+static bool isBlank(const unsigned char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' ||
+           c == '\f';
+}
+
+// libc++ on the Mac has no floating point from_chars, so coordinates go
+// through strtod on a terminated copy
+static bool parseNumber(const unsigned char *s, size_t n, double &x) {
+    char buffer[64];
+    if (n >= sizeof(buffer))
+        return false;
+    memcpy(buffer, s, n);
+    buffer[n] = 0;
+    char *end;
+    x = strtod(buffer, &end);
+    return end == buffer + n;
+}
+
+static bool parseNumber(const unsigned char *s, size_t n, int &x) {
+    const char *first = reinterpret_cast<const char *>(s);
+    // from_chars takes no plus sign, which the stream reads did
+    if (n > 1 && *first == '+' && first[1] != '-') {
+        ++first;
+        --n;
+    }
+    const from_chars_result r = from_chars(first, first + n, x);
+    return r.ec == errc() && r.ptr == first + n;
+}
+
+// Length of the token at s, which ends at a blank or at end
+static size_t tokenLength(const unsigned char *s, const unsigned char *end) {
+    const unsigned char *p = s;
+    while (p < end && !isBlank(*p))
+        ++p;
+    return p - s;
+}
+
+void parseMeshText(const MappedFile &file, const char *filename,
+                   int &numTris, vector<double> &positions,
+                   vector<int> &indices) {
+    const unsigned char *const data = file.data();
+    const unsigned char *const end = data + file.size();
+    const string error = string("Malformed mesh file ") + filename;
+
+    // The counts, read ahead of the rest
+    int counts[3];
+    const unsigned char *p = data;
+    for (int i = 0; i < 3; ++i) {
+        while (p < end && isBlank(*p))
+            ++p;
+        const size_t n = tokenLength(p, end);
+        if (!parseNumber(p, n, counts[i]) || counts[i] < 0)
+            throw runtime_error(error);
+        p += n;
+    }
+    const int nv = counts[0], nt = counts[1], nq = counts[2];
+    const size_t numCoords = 3 * size_t(nv);
+    const size_t numNumbers = 3 + numCoords + 3 * size_t(nt) + 4 * size_t(nq);
+    numTris = nt;
+    positions.resize(numCoords);
+    indices.resize(numNumbers - 3 - numCoords);
+
+    // A token belongs to the chunk holding its first character. The first
+    // pass counts them, so that the second knows the index of each.
+    const int numChunks = int((file.size() + kChunkSize - 1) / kChunkSize);
+    vector<size_t> firstToken(numChunks + 1, 0);
+    const auto chunkRange = [=](const int c, const unsigned char *&begin,
+                                const unsigned char *&last) {
+        begin = data + size_t(c) * kChunkSize;
+        last = c + 1 == numChunks ? end : begin + kChunkSize;
+    };
+    parallelFor(numChunks, [&](const int cb, const int ce) {
+        for (int c = cb; c < ce; ++c) {
+            const unsigned char *s, *last;
+            chunkRange(c, s, last);
+            size_t count = 0;
+            for (; s < last; ++s) {
+                if (!isBlank(*s) && (s == data || isBlank(s[-1])))
+                    ++count;
+            }
+            firstToken[c + 1] = count;
+        }
+    });
+    for (int c = 0; c < numChunks; ++c)
+        firstToken[c + 1] += firstToken[c];
+    // Like the stream reads it replaces, anything after the faces is ignored
+    if (firstToken[numChunks] < numNumbers)
+        throw runtime_error(string("Unexpected end of mesh file ") + filename);
+
+    vector<char> failed(numChunks, 0);
+    double *const coords = positions.empty() ? 0 : &positions[0];
+    int *const faces = indices.empty() ? 0 : &indices[0];
+    parallelFor(numChunks, [&](const int cb, const int ce) {
+        for (int c = cb; c < ce; ++c) {
+            const unsigned char *s, *last;
+            chunkRange(c, s, last);
+            size_t token = firstToken[c];
+            bool ok = true;
+            for (; s < last && token < numNumbers; ++s) {
+                if (isBlank(*s) || (s != data && !isBlank(s[-1])))
+                    continue;
+                const size_t n = tokenLength(s, end);
+                if (token >= 3 && token < 3 + numCoords)
+                    ok &= parseNumber(s, n, coords[token - 3]);
+                else if (token >= 3)
+                    ok &= parseNumber(s, n, faces[token - 3 - numCoords]);
+                ++token;
+                s += n - 1;
+            }
+            failed[c] = !ok;
+        }
+    });
+    for (int c = 0; c < numChunks; ++c) {
+        if (failed[c])
+            throw runtime_error(error);
+    }
+}
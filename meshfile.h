@@ -0,0 +1,71 @@
+#ifndef MESHFILE_H
+#define MESHFILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mappedfile.h"
+
+// Binary mesh container, written by Mesh::save or the offline meshconvert
+// tool and loaded by Mesh::load in place of the .mesh text. A
+// MeshFileHeader is followed by, each array tightly packed:
+//
+//   float    positions[3 * numVertices]
+//   int32_t  triangles[3 * numTris]
+//   int32_t  quads[4 * numQuads]
+//
+// and with MESH_FILE_TOPOLOGY, the half-edge tables Mesh would otherwise
+// build on load, in its encoding (face | corner << 28):
+//
+//   int32_t  vertexHalfedges[numVertices]
+//   int32_t  faceEdges[4 * (numTris + numQuads)]
+//   int32_t  edgeHalfedges[2 * numEdges]
+//
+// Mesh::load rejects face indices out of range, and rebuilds the half-edge
+// tables if they do not hold together.
+//
+// Positions are stored as the mesh had them, already centered and scaled
+// if it came from a .mesh text. Header fields and arrays are in the byte
+// order of the machine that wrote the file.
+
+struct MeshFileHeader {
+    char magic[8];    // "CS175MSH"
+    uint32_t version; // MESH_FILE_VERSION
+    uint32_t flags;   // MESH_FILE_TOPOLOGY, ...
+    uint32_t numVertices, numTris, numQuads;
+    uint32_t numEdges; // 0 without MESH_FILE_TOPOLOGY
+};
+
+enum {
+    MESH_FILE_VERSION = 1,
+
+    MESH_FILE_TOPOLOGY = 1,
+    // Flags of the stored topology, as Mesh found them
+    MESH_FILE_NOT_MANIFOLD = 2,
+    MESH_FILE_WITH_BOUNDARY = 4
+};
+
+// foo.mesh -> foo.bmesh
+std::string getMeshFileName(const std::string &textFileName);
+
+// Whether the file starts with a MeshFileHeader of a version we read
+bool isMeshFile(const MappedFile &file);
+
+// Writes the arrays above after the header, whose magic and version are
+// filled in; topology is empty without MESH_FILE_TOPOLOGY. Throws
+// runtime_error on a size mismatch or a write failure.
+void writeMeshFile(const char *filename, MeshFileHeader header,
+                   const std::vector<float> &positions,
+                   const std::vector<int> &indices,
+                   const std::vector<int> &topology);
+
+// Parses .mesh text: the vertex, triangle and quad counts, then the
+// coordinates and the indices of the triangles followed by those of the
+// quads. The numbers are parsed in parallel chunks of the file. Throws
+// runtime_error on a malformed file.
+void parseMeshText(const MappedFile &file, const char *filename,
+                   int &numTris, std::vector<double> &positions,
+                   std::vector<int> &indices);
+
+#endif
@@ -0,0 +1,92 @@
+// Converts PPM images into mip containers (see mipfile.h), so that the
+// textures load without decoding or generating mipmaps at startup:
+//
+//   mipconvert [-linear] [-size WxH] [-tiles size] image.ppm...
+//
+// writes image.mip next to each image. The levels are filtered by
+// makeMipChain, in linear space for sRGB images, or on the stored values with
+// -linear (normal maps), which writes image.linear.mip. With -size, the image
+// is first resampled to W x H as ImageTextureArray does for its layers, and
+// written to image.WxH.mip (or image.WxH.linear.mip). With -tiles, writes the
+// levels split into tiles of size x size texels to image.vtex instead, for
+// VirtualTexture.
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mipfile.h"
+#include "ppm.h"
+
+using namespace std;
+
+// `layerWidth' and `layerHeight' are 0 to keep the size of the image
+static void convert(const string &ppmFileName, bool srgb, int layerWidth,
+                    int layerHeight, int tileSize) {
+    const PpmImage image(ppmFileName.c_str());
+    const bool resample = layerWidth > 0;
+    const int width = resample ? layerWidth : image.getWidth(),
+              height = resample ? layerHeight : image.getHeight();
+
+    vector<vector<PackedPixel>> levels(1);
+    levels[0].resize(size_t(width) * height);
+    if (resample)
+        image.resampleTo(width, height, &levels[0][0]);
+    else
+        image.copyTo(&levels[0][0]);
+    makeMipChain(width, height, srgb, levels);
+    const int numLevels = levels.size();
+
+    if (tileSize > 0) {
+        const string tileFileName = getTileFileName(ppmFileName);
+        writeTileFile(tileFileName.c_str(), width, height, tileSize, 1, srgb,
+                      levels);
+        cout << ppmFileName << " -> " << tileFileName << " (" << width << "x"
+             << height << ", " << tileSize << "x" << tileSize << " tiles, "
+             << getTileLevelCount(width, height, tileSize) << " levels"
+             << (srgb ? ", sRGB" : "") << ")" << endl;
+        return;
+    }
+
+    const string mipFileName =
+        getMipFileName(ppmFileName, srgb, layerWidth, layerHeight);
+    writeMipFile(mipFileName.c_str(), width, height, srgb, levels);
+    cout << ppmFileName << " -> " << mipFileName << " (" << width << "x"
+         << height << ", " << numLevels << " levels"
+         << (srgb ? ", sRGB" : "") << ")" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    bool srgb = true;
+    int layerWidth = 0, layerHeight = 0, tileSize = 0, converted = 0;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            if (string(argv[i]) == "-linear") {
+                srgb = false;
+            } else if (string(argv[i]) == "-size" && i + 1 < argc) {
+                const int n =
+                    sscanf(argv[++i], "%dx%d", &layerWidth, &layerHeight);
+                if (n != 2 || layerWidth <= 0 || layerHeight <= 0)
+                    throw runtime_error("Invalid size");
+            } else if (string(argv[i]) == "-tiles" && i + 1 < argc) {
+                tileSize = atoi(argv[++i]);
+                if (tileSize <= 0)
+                    throw runtime_error("Invalid tile size");
+            } else {
+                convert(argv[i], srgb, layerWidth, layerHeight, tileSize);
+                ++converted;
+            }
+        }
+    } catch (const runtime_error &e) {
+        cerr << "Exception caught: " << e.what() << endl;
+        return -1;
+    }
+    if (converted == 0) {
+        cerr << "Usage: " << argv[0]
+             << " [-linear] [-size WxH] [-tiles size] image.ppm..." << endl;
+        return -1;
+    }
+    return 0;
+}
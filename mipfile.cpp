@@ -0,0 +1,312 @@
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "mipfile.h"
+#include "parallel.h"
+
+using namespace std;
+
+static const char kMagic[8] = {'C', 'S', '1', '7', '5', 'M', 'I', 'P'};
+static const char kTileMagic[8] = {'C', 'S', '1', '7', '5', 'V', 'T', 'X'};
+
+int getMipLevelCount(int width, int height) {
+    int levels = 1;
+    while (width > 1 || height > 1) {
+        width = getMipLevelSize(width, 1);
+        height = getMipLevelSize(height, 1);
+        ++levels;
+    }
+    return levels;
+}
+
+static string replaceExtension(const string &fileName, const char *ext) {
+    const size_t dot = fileName.rfind('.');
+    const size_t slash = fileName.find_last_of("/\\");
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+        return fileName + ext;
+    return fileName.substr(0, dot) + ext;
+}
+
+string getMipFileName(const string &ppmFileName, bool srgb, int width,
+                      int height) {
+    ostringstream ext;
+    if (width > 0 && height > 0)
+        ext << "." << width << "x" << height;
+    if (!srgb)
+        ext << ".linear";
+    ext << ".mip";
+    return replaceExtension(ppmFileName, ext.str().c_str());
+}
+
+void writeMipFile(const char *filename, int width, int height,
+                  bool srgbFiltered, const vector<vector<PackedPixel>> &levels) {
+    if (int(levels.size()) != getMipLevelCount(width, height))
+        throw runtime_error("writeMipFile: incomplete mip chain");
+
+    MipFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = MIP_FILE_VERSION;
+    header.flags = srgbFiltered ? MIP_FILE_SRGB_FILTERED : 0;
+    header.width = width;
+    header.height = height;
+    header.levels = levels.size();
+
+    ofstream f(filename, ios::binary);
+    f.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (size_t i = 0; i < levels.size(); ++i) {
+        const size_t n = size_t(getMipLevelSize(width, i)) *
+                         getMipLevelSize(height, i);
+        if (levels[i].size() != n)
+            throw runtime_error("writeMipFile: wrong level size");
+        f.write(reinterpret_cast<const char *>(&levels[i][0]),
+                n * sizeof(PackedPixel));
+    }
+    if (!f)
+        throw runtime_error(string("Cannot write file ") + filename);
+}
+
+MipFile::MipFile(const char *filename) : file_(filename) {
+    if (file_.size() < sizeof(header_))
+        throw runtime_error(string("Truncated mip file ") + filename);
+    memcpy(&header_, file_.data(), sizeof(header_));
+
+    if (memcmp(header_.magic, kMagic, sizeof(kMagic)) != 0 ||
+        header_.version != MIP_FILE_VERSION || header_.width == 0 ||
+        header_.height == 0 ||
+        int(header_.levels) != getMipLevelCount(header_.width, header_.height))
+        throw runtime_error(string("Invalid mip file ") + filename);
+
+    size_t offset = sizeof(header_);
+    for (int i = 0; i < getNumLevels(); ++i) {
+        levels_.push_back(
+            reinterpret_cast<const PackedPixel *>(file_.data() + offset));
+        offset += size_t(getMipLevelSize(getWidth(), i)) *
+                  getMipLevelSize(getHeight(), i) * sizeof(PackedPixel);
+    }
+    if (offset > file_.size())
+        throw runtime_error(string("Truncated mip file ") + filename);
+}
+
+int getTileLevelCount(int width, int height, int tileSize) {
+    int levels = 1;
+    while (getTileCount(width, tileSize, levels - 1) > 1 ||
+           getTileCount(height, tileSize, levels - 1) > 1)
+        ++levels;
+    return levels;
+}
+
+string getTileFileName(const string &ppmFileName) {
+    return replaceExtension(ppmFileName, ".vtex");
+}
+
+void writeTileFile(const char *filename, int width, int height, int tileSize,
+                   int border, bool srgbFiltered,
+                   const vector<vector<PackedPixel>> &levels) {
+    const int numLevels = getTileLevelCount(width, height, tileSize);
+    if (tileSize <= 0 || border < 0 || int(levels.size()) < numLevels)
+        throw runtime_error("writeTileFile: invalid tiling");
+
+    TileFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kTileMagic, sizeof(kTileMagic));
+    header.version = TILE_FILE_VERSION;
+    header.flags = srgbFiltered ? MIP_FILE_SRGB_FILTERED : 0;
+    header.width = width;
+    header.height = height;
+    header.tileSize = tileSize;
+    header.border = border;
+    header.levels = numLevels;
+
+    ofstream f(filename, ios::binary);
+    f.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    const int tilePixels = tileSize + 2 * border;
+    vector<PackedPixel> tile(size_t(tilePixels) * tilePixels);
+    for (int level = 0; level < numLevels; ++level) {
+        const int w = getMipLevelSize(width, level),
+                  h = getMipLevelSize(height, level);
+        const PackedPixel *src = &levels[level][0];
+        for (int ty = 0; ty < getTileCount(height, tileSize, level); ++ty) {
+            for (int tx = 0; tx < getTileCount(width, tileSize, level); ++tx) {
+                // The grid is laid out in level 0 texels, so the last tiles
+                // can reach past the level; they repeat its edge
+                for (int y = 0; y < tilePixels; ++y) {
+                    const int sy =
+                        min(h - 1, max(0, ty * tileSize + y - border));
+                    for (int x = 0; x < tilePixels; ++x) {
+                        const int sx =
+                            min(w - 1, max(0, tx * tileSize + x - border));
+                        tile[size_t(y) * tilePixels + x] =
+                            src[size_t(sy) * w + sx];
+                    }
+                }
+                f.write(reinterpret_cast<const char *>(&tile[0]),
+                        tile.size() * sizeof(PackedPixel));
+            }
+        }
+    }
+    if (!f)
+        throw runtime_error(string("Cannot write file ") + filename);
+}
+
+TileFile::TileFile(const char *filename) : file_(filename) {
+    if (file_.size() < sizeof(header_))
+        throw runtime_error(string("Truncated tile file ") + filename);
+    memcpy(&header_, file_.data(), sizeof(header_));
+
+    if (memcmp(header_.magic, kTileMagic, sizeof(kTileMagic)) != 0 ||
+        header_.version != TILE_FILE_VERSION || header_.width == 0 ||
+        header_.height == 0 || header_.tileSize == 0 ||
+        header_.tileSize > 4096 || header_.border > header_.tileSize / 2 ||
+        int(header_.levels) != getTileLevelCount(header_.width,
+                                                 header_.height,
+                                                 header_.tileSize))
+        throw runtime_error(string("Invalid tile file ") + filename);
+
+    tiles_ = reinterpret_cast<const PackedPixel *>(file_.data() +
+                                                   sizeof(header_));
+    size_t tiles = 0;
+    for (int level = 0; level < getNumLevels(); ++level) {
+        levelOffsets_.push_back(tiles);
+        tiles += size_t(getTilesX(level)) * getTilesY(level);
+    }
+    if (sizeof(header_) + tiles * getTilePixels() * getTilePixels() *
+                              sizeof(PackedPixel) >
+        file_.size())
+        throw runtime_error(string("Truncated tile file ") + filename);
+}
+
+static float srgbToLinear(float c) {
+    return c <= 0.04045f ? c / 12.92f : pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linearToSrgb(float c) {
+    return c <= 0.0031308f ? c * 12.92f
+                           : 1.055f * pow(c, 1.f / 2.4f) - 0.055f;
+}
+
+// One level being filtered: 3 floats per pixel, bottom row first
+struct FloatImage {
+    int width, height;
+    vector<float> texels;
+};
+
+// Source texels and weights of one destination texel along a dimension, for a
+// box filter whose footprint is the area the texel covers in the source
+struct BoxTaps {
+    vector<int> first, count;
+    vector<float> weights; // count[i] weights per texel, concatenated
+    vector<int> offsets;   // of texel i's weights
+};
+
+static BoxTaps makeBoxTaps(int n, int dn) {
+    BoxTaps taps;
+    const double scale = double(n) / dn;
+    for (int i = 0; i < dn; ++i) {
+        const double lo = i * scale, hi = (i + 1) * scale;
+        const int first = int(lo), last = min(n - 1, int(ceil(hi)) - 1);
+        taps.first.push_back(first);
+        taps.count.push_back(last - first + 1);
+        taps.offsets.push_back(taps.weights.size());
+        for (int j = first; j <= last; ++j) {
+            const double overlap = min(hi, j + 1.) - max(lo, double(j));
+            taps.weights.push_back(float(overlap / scale));
+        }
+    }
+    return taps;
+}
+
+// Filters src down to dw x dh, separably: first along rows into a temporary
+// image, then along columns. The inner loops run over contiguous floats with
+// no dependencies, which the compiler vectorizes.
+static FloatImage downsample(const FloatImage &src, int dw, int dh) {
+    const int w = src.width, h = src.height;
+    const BoxTaps xTaps = makeBoxTaps(w, dw), yTaps = makeBoxTaps(h, dh);
+
+    vector<float> tmp(size_t(dw) * h * 3);
+    parallelFor(h, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            const float *row = &src.texels[size_t(y) * w * 3];
+            float *out = &tmp[size_t(y) * dw * 3];
+            for (int x = 0; x < dw; ++x) {
+                const float *wt = &xTaps.weights[xTaps.offsets[x]];
+                const float *in = row + xTaps.first[x] * 3;
+                float r = 0, g = 0, b = 0;
+                for (int k = 0; k < xTaps.count[x]; ++k) {
+                    r += in[3 * k] * wt[k];
+                    g += in[3 * k + 1] * wt[k];
+                    b += in[3 * k + 2] * wt[k];
+                }
+                out[3 * x] = r;
+                out[3 * x + 1] = g;
+                out[3 * x + 2] = b;
+            }
+        }
+    });
+
+    FloatImage dst;
+    dst.width = dw;
+    dst.height = dh;
+    dst.texels.assign(size_t(dw) * dh * 3, 0.f);
+    const int rowFloats = dw * 3;
+    parallelFor(dh, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            float *out = &dst.texels[size_t(y) * rowFloats];
+            const float *wt = &yTaps.weights[yTaps.offsets[y]];
+            for (int k = 0; k < yTaps.count[y]; ++k) {
+                const float *in = &tmp[size_t(yTaps.first[y] + k) * rowFloats];
+                for (int i = 0; i < rowFloats; ++i)
+                    out[i] += in[i] * wt[k];
+            }
+        }
+    });
+    return dst;
+}
+
+static vector<PackedPixel> quantize(const FloatImage &image, bool srgb) {
+    vector<PackedPixel> pixels(size_t(image.width) * image.height);
+    parallelFor(pixels.size(), [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            unsigned char *out = &pixels[i].r;
+            for (int c = 0; c < 3; ++c) {
+                float v = min(1.f, max(0.f, image.texels[3 * size_t(i) + c]));
+                if (srgb)
+                    v = linearToSrgb(v);
+                out[c] = (unsigned char)(v * 255.f + 0.5f);
+            }
+        }
+    });
+    return pixels;
+}
+
+void makeMipChain(int width, int height, bool srgb,
+                  vector<vector<PackedPixel>> &levels) {
+    levels.resize(1);
+
+    float decode[256];
+    for (int i = 0; i < 256; ++i)
+        decode[i] = srgb ? srgbToLinear(i / 255.f) : i / 255.f;
+
+    FloatImage current;
+    current.width = width;
+    current.height = height;
+    current.texels.resize(levels[0].size() * 3);
+    for (size_t i = 0; i < levels[0].size(); ++i) {
+        current.texels[3 * i] = decode[levels[0][i].r];
+        current.texels[3 * i + 1] = decode[levels[0][i].g];
+        current.texels[3 * i + 2] = decode[levels[0][i].b];
+    }
+
+    // Each level is filtered from the one above it, kept in float so that
+    // the rounding errors do not add up along the chain
+    const int numLevels = getMipLevelCount(width, height);
+    for (int level = 1; level < numLevels; ++level) {
+        current = downsample(current, getMipLevelSize(width, level),
+                             getMipLevelSize(height, level));
+        levels.push_back(quantize(current, srgb));
+    }
+}
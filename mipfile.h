@@ -0,0 +1,171 @@
+#ifndef MIPFILE_H
+#define MIPFILE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mappedfile.h"
+#include "ppm.h"
+
+// Container for an RGB8 image together with its precomputed mip chain, made
+// from a PPM file offline by mipconvert and uploaded to GL as is:
+//
+//   MipFileHeader
+//   level 0, level 1, ..., the 1 x 1 level
+//
+// Each level is stored bottom row first with rows tightly packed, 3 bytes per
+// pixel, so it can be passed to glTexSubImage directly. Level i is
+// getMipLevelSize(width, i) x getMipLevelSize(height, i). Header fields are in
+// the byte order of the machine that wrote the file.
+
+struct MipFileHeader {
+    char magic[8];    // "CS175MIP"
+    uint32_t version; // MIP_FILE_VERSION
+    uint32_t flags;   // MIP_FILE_SRGB_FILTERED
+    uint32_t width, height;
+    uint32_t levels;
+    uint32_t reserved;
+};
+
+enum {
+    MIP_FILE_VERSION = 1,
+
+    // The levels were filtered in linear space, decoding the texels as sRGB
+    // (for color maps). Otherwise the texels were averaged as they are (for
+    // normal maps and other data).
+    MIP_FILE_SRGB_FILTERED = 1
+};
+
+// Size of a dimension at the given mip level, as GL computes it
+inline int getMipLevelSize(int size, int level) {
+    return std::max(1, size >> level);
+}
+
+// Number of levels of the full mip chain, down to 1 x 1
+int getMipLevelCount(int width, int height);
+
+// The container next to a PPM file, filtered for the given color space and
+// resampled to width x height if given: "earth.ppm" -> "earth.mip",
+// "earth.linear.mip", "earth.1024x512.mip", "earth.1024x512.linear.mip"
+std::string getMipFileName(const std::string &ppmFileName, bool srgb = true,
+                           int width = 0, int height = 0);
+
+// Appends levels 1 and below to `levels', which holds level 0 of a width x
+// height image. Each level is area-weighted box filtered from the one above,
+// in linear space if `srgb', otherwise on the stored values. Uses all hardware
+// threads.
+void makeMipChain(int width, int height, bool srgb,
+                  std::vector<std::vector<PackedPixel>> &levels);
+
+// Writes the levels, level 0 first, each as described above. Throws
+// runtime_error on error.
+void writeMipFile(const char *filename, int width, int height,
+                  bool srgbFiltered,
+                  const std::vector<std::vector<PackedPixel>> &levels);
+
+// A container mapped for reading. The levels point into the mapped pages.
+// Throws runtime_error if the file cannot be read or is not a valid container.
+class MipFile : Noncopyable {
+  public:
+    explicit MipFile(const char *filename);
+
+    int getWidth() const { return header_.width; }
+    int getHeight() const { return header_.height; }
+    int getNumLevels() const { return header_.levels; }
+    bool isSrgbFiltered() const {
+        return (header_.flags & MIP_FILE_SRGB_FILTERED) != 0;
+    }
+
+    const PackedPixel *getLevel(int level) const { return levels_[level]; }
+
+  private:
+    MappedFile file_;
+    MipFileHeader header_;
+    std::vector<const PackedPixel *> levels_;
+};
+
+// Container for one image split into square tiles per mip level, made by
+// `mipconvert -tiles' for textures too large to keep resident (see
+// VirtualTexture):
+//
+//   TileFileHeader
+//   the tiles of level 0, level 1, ..., the level that fits in one tile
+//
+// At every level a tile covers tileSize << level texels of level 0, so the
+// tile (x, y) of level l + 1 covers the tiles (2x, 2y) to (2x + 1, 2y + 1) of
+// level l. Tiles of a level are stored row by row, bottom row first, each as
+// (tileSize + 2 * border)^2 RGB8 pixels bottom row first. The border repeats
+// the texels of the neighbouring tiles, clamped at the edges of the image, so
+// that bilinear filtering does not reach into the next tile of an atlas.
+
+struct TileFileHeader {
+    char magic[8];    // "CS175VTX"
+    uint32_t version; // TILE_FILE_VERSION
+    uint32_t flags;   // MIP_FILE_SRGB_FILTERED
+    uint32_t width, height;
+    uint32_t tileSize, border;
+    uint32_t levels;
+    uint32_t reserved;
+};
+
+enum { TILE_FILE_VERSION = 1 };
+
+// Number of tiles across a dimension at the given tile level
+inline int getTileCount(int size, int tileSize, int level) {
+    return (size + (tileSize << level) - 1) / (tileSize << level);
+}
+
+// Number of tile levels, down to the first that is a single tile
+int getTileLevelCount(int width, int height, int tileSize);
+
+// The container next to a PPM file: "earth.ppm" -> "earth.vtex"
+std::string getTileFileName(const std::string &ppmFileName);
+
+// Writes the tiles of `levels', a full mip chain as made by makeMipChain.
+// Throws runtime_error on error.
+void writeTileFile(const char *filename, int width, int height, int tileSize,
+                   int border, bool srgbFiltered,
+                   const std::vector<std::vector<PackedPixel>> &levels);
+
+// A tile container mapped for reading. Tiles point into the mapped pages, and
+// are only paged in when read. Throws runtime_error if the file cannot be read
+// or is not a valid container.
+class TileFile : Noncopyable {
+  public:
+    explicit TileFile(const char *filename);
+
+    int getWidth() const { return header_.width; }
+    int getHeight() const { return header_.height; }
+    int getTileSize() const { return header_.tileSize; }
+    int getBorder() const { return header_.border; }
+    int getNumLevels() const { return header_.levels; }
+    bool isSrgbFiltered() const {
+        return (header_.flags & MIP_FILE_SRGB_FILTERED) != 0;
+    }
+
+    // Tiles across and up at a level
+    int getTilesX(int level) const {
+        return getTileCount(getWidth(), getTileSize(), level);
+    }
+    int getTilesY(int level) const {
+        return getTileCount(getHeight(), getTileSize(), level);
+    }
+
+    // Width and height of a stored tile, border included
+    int getTilePixels() const { return getTileSize() + 2 * getBorder(); }
+
+    const PackedPixel *getTile(int level, int x, int y) const {
+        return tiles_ + (levelOffsets_[level] + size_t(y) * getTilesX(level) +
+                         x) * getTilePixels() * getTilePixels();
+    }
+
+  private:
+    MappedFile file_;
+    TileFileHeader header_;
+    const PackedPixel *tiles_;
+    std::vector<size_t> levelOffsets_; // in tiles
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Runs f(begin, end) over [0, n) split evenly among the hardware threads, and
+// waits for all of them. The calling thread takes the first range.
+template <typename F> void parallelFor(int n, F f) {
+    const int numThreads =
+        std::max(1, std::min(n, int(std::thread::hardware_concurrency())));
+    std::vector<std::thread> threads;
+    for (int t = 1; t < numThreads; ++t) {
+        threads.push_back(std::thread(f, int(long(n) * t / numThreads),
+                                      int(long(n) * (t + 1) / numThreads)));
+    }
+    f(0, int(long(n) / numThreads));
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+}
+
+#endif
@@ -37,7 +37,8 @@ bool Picker::visit(SgShapeNode &node) {
     cerr << idCounter_ << " => " << idColor[0] << ' ' << idColor[1] << ' '
          << idColor[2] << endl;
 
-    drawer_.getUniforms().put("uIdColor", idColor);
+    static const UniformName uIdColor("uIdColor");
+    drawer_.getUniforms().put(uIdColor, idColor);
     return drawer_.visit(node);
 }
 
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -7,108 +8,165 @@
 #include <string>
 #include <vector>
 
-#include "GL/glew.h"
-#include "GL/glfw3.h"
-
 #include "ppm.h"
 
 using namespace std;
 
-void writePpmScreenshot(const int width, const int height,
-                        const char *filename) {
-    vector<char> image(width * height * 3);
+// Character classes for scanning PPM text
+enum { kOther = 0, kSpace, kDigit, kComment };
 
-    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &image[0]);
+struct CharClasses {
+    unsigned char classes[256];
 
-    ofstream f(filename, ios::binary);
-    f << "P6 " << width << " " << height << " 255\n";
-    for (int i = 0; i < height; ++i) {
-        f.write(&image[3 * width * (height - 1 - i)], 3 * width);
+    CharClasses() {
+        memset(classes, kOther, sizeof(classes));
+        for (int c = '0'; c <= '9'; ++c)
+            classes[c] = kDigit;
+        classes[(unsigned char)' '] = classes[(unsigned char)'\t'] = kSpace;
+        classes[(unsigned char)'\r'] = classes[(unsigned char)'\n'] = kSpace;
+        classes[(unsigned char)'#'] = kComment;
     }
+};
+
+// Images are also decoded on TextureStreamer's threads, so this relies on the
+// thread safe initialization of local statics
+static const unsigned char *charClasses() {
+    static const CharClasses table;
+    return table.classes;
 }
 
-// Read one positive integer from a (text) file. Line beginning with
-// "#" are ignored as comments.
-static int ppmReadInteger(istream &is) {
-    unsigned char ch;
-    int got = 0, done = 0, accum = 0, inComment = 0;
-    while (!done) {
-        ch = is.get();
-
-        if (inComment) {
-            if (ch == '\n')
-                inComment = 0;
-            continue;
-        }
+// Read one positive integer from PPM text starting at `p', and advances `p'
+// past it and the one whitespace character that ends it. Lines beginning
+// with "#" are ignored as comments.
+static int ppmReadInteger(const unsigned char *&p, const unsigned char *end) {
+    const unsigned char *classes = charClasses();
+
+    // skip whitespace and comments
+    for (;;) {
+        if (p == end)
+            throw runtime_error("ppmRead: unexpected end of file");
+        const unsigned char c = classes[*p];
+        if (c == kDigit)
+            break;
+        if (c == kSpace)
+            ++p;
+        else if (c == kComment) {
+            const void *eol = memchr(p, '\n', end - p);
+            p = eol ? static_cast<const unsigned char *>(eol) : end;
+        } else
+            throw runtime_error("ppmRead: invalid character");
+    }
 
-        if (isdigit(ch)) {
-            accum = accum * 10 + ch - '0';
-            got = 1;
-        } else if (ch == '#')
-            inComment = 1;
-        else if (!ch || !strchr(" \t\r\n", ch))
+    int accum = 0;
+    do {
+        accum = accum * 10 + (*p++ - '0');
+    } while (p != end && classes[*p] == kDigit);
+
+    if (p != end) {
+        if (classes[*p] == kSpace)
+            ++p;
+        else if (classes[*p] != kComment)
             throw runtime_error("ppmRead: invalid character");
-        else if (got)
-            done = 1;
-        else
-            ; // nothing
     }
     return accum;
 }
 
-// Read the PPM header from the input stream and initialize the width and height
-// to the appropriate values, and throws rumtime_error on invalid width/height
-static void ppmReadHeader(istream &is, int &width, int &height) {
-    if ((width = ppmReadInteger(is)) < 0) {
-        throw runtime_error("ppmRead: invalid width");
-    }
-    if ((height = ppmReadInteger(is)) < 0) {
-        throw runtime_error("ppmRead: invalid height");
-    }
-    if (ppmReadInteger(is) != 255) {
-        cerr << "Warning: maxcolor not 255 : won't work well" << endl;
+// Decodes the P3 samples of a width x height image in `p' into `out', in
+// file order. Each sample is one to three digits followed by whitespace, so
+// the common case is handled with one table lookup per byte and no calls.
+static void ppmDecodeText(const unsigned char *p, const unsigned char *end,
+                          size_t count, unsigned char *out) {
+    const unsigned char *classes = charClasses();
+    for (size_t i = 0; i < count; ++i) {
+        while (p != end && classes[*p] == kSpace)
+            ++p;
+        if (p != end && classes[*p] == kDigit) {
+            unsigned v = *p++ - '0';
+            while (p != end && classes[*p] == kDigit)
+                v = v * 10 + (*p++ - '0');
+            out[i] = (unsigned char)v;
+        } else {
+            // comments between samples, or an error: take the slow path
+            out[i] = ppmReadInteger(p, end);
+        }
     }
 }
 
-// Reads the actual PPM data and stores returns in in a pixels.
-void ppmRead(const char *filename, int &width, int &height,
-             std::vector<PackedPixel> &pixels) {
-    ifstream is(filename, ios::binary);
-    if (!is.is_open())
-        throw runtime_error(string("ppmRead: Cannot open file ") + filename +
-                            " for read");
-
-    // Sets bits to report IO error using exception
-    is.exceptions(ios::eofbit | ios::failbit | ios::badbit);
-
-    char buf[2];
-    is.read(buf, 2);
+PpmImage::PpmImage(const char *filename) : file_(new MappedFile(filename)) {
+    const unsigned char *p = file_->data(), *end = p + file_->size();
 
     bool isbinary = false;
-    if (!memcmp(buf, "P3", 2))
+    if (file_->size() >= 2 && !memcmp(p, "P3", 2))
         isbinary = false;
-    else if (!memcmp(buf, "P6", 2))
+    else if (file_->size() >= 2 && !memcmp(p, "P6", 2))
         isbinary = true;
     else
         throw runtime_error("ppmRead: bad file format");
+    p += 2;
 
-    ppmReadHeader(is, width, height);
-
-    pixels.resize(width * height);
+    if ((width_ = ppmReadInteger(p, end)) <= 0) {
+        throw runtime_error("ppmRead: invalid width");
+    }
+    if ((height_ = ppmReadInteger(p, end)) <= 0) {
+        throw runtime_error("ppmRead: invalid height");
+    }
+    if (ppmReadInteger(p, end) != 255) {
+        cerr << "Warning: maxcolor not 255 : won't work well" << endl;
+    }
 
+    const size_t bytes = size_t(width_) * height_ * 3;
     if (isbinary) {
-        for (int row = height - 1; row >= 0; row--) {
-            is.read(reinterpret_cast<char *>(&pixels[row * width]),
-                    width * sizeof(PackedPixel));
-        }
+        if (size_t(end - p) < bytes)
+            throw runtime_error(string("ppmRead: truncated file ") + filename);
+        top_ = p;
     } else {
-        for (int row = height - 1; row >= 0; row--) {
-            for (int l = 0; l < width; l++) {
-                PackedPixel &p = pixels[row * width + l];
-                p.r = ppmReadInteger(is);
-                p.g = ppmReadInteger(is);
-                p.b = ppmReadInteger(is);
+        decoded_.resize(bytes);
+        ppmDecodeText(p, end, bytes, &decoded_[0]);
+        top_ = &decoded_[0];
+        file_.reset(); // no longer needed
+    }
+}
+
+void PpmImage::copyTo(PackedPixel *dst) const {
+    for (int y = 0; y < height_; ++y) {
+        memcpy(dst + size_t(y) * width_, getRow(y),
+               width_ * sizeof(PackedPixel));
+    }
+}
+
+void PpmImage::resampleTo(int width, int height, PackedPixel *dst) const {
+    const int w = width_, h = height_;
+    for (int y = 0; y < height; ++y) {
+        const float sy = max(0.f, (y + 0.5f) * h / height - 0.5f);
+        const int y0 = min(int(sy), h - 1), y1 = min(y0 + 1, h - 1);
+        const float fy = sy - y0;
+        const PackedPixel *row0 = getRow(y0), *row1 = getRow(y1);
+        for (int x = 0; x < width; ++x) {
+            const float sx = max(0.f, (x + 0.5f) * w / width - 0.5f);
+            const int x0 = min(int(sx), w - 1), x1 = min(x0 + 1, w - 1);
+            const float fx = sx - x0;
+
+            const PackedPixel &p00 = row0[x0], &p01 = row0[x1];
+            const PackedPixel &p10 = row1[x0], &p11 = row1[x1];
+            unsigned char PackedPixel::*const channels[] = {
+                &PackedPixel::r, &PackedPixel::g, &PackedPixel::b};
+            for (int c = 0; c < 3; ++c) {
+                unsigned char PackedPixel::*m = channels[c];
+                const float top = p00.*m + (p01.*m - p00.*m) * fx;
+                const float bottom = p10.*m + (p11.*m - p10.*m) * fx;
+                dst[size_t(y) * width + x].*m =
+                    (unsigned char)(top + (bottom - top) * fy + 0.5f);
             }
         }
     }
 }
+
+// Reads the actual PPM data and stores returns in in a pixels.
+void ppmRead(const char *filename, int &width, int &height,
+             std::vector<PackedPixel> &pixels) {
+    PpmImage image(filename);
+    width = image.getWidth();
+    height = image.getHeight();
+    pixels.resize(size_t(width) * height);
+    image.copyTo(&pixels[0]);
+}
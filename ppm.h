@@ -1,10 +1,10 @@
 #ifndef PPM_H
 #define PPM_H
 
+#include <memory>
 #include <vector>
 
-void writePpmScreenshot(const int width, const int height,
-                        const char *filename);
+#include "mappedfile.h"
 
 // A 3-byte structure storing R,G,B value of a pixel
 struct PackedPixel {
@@ -16,4 +16,36 @@ struct PackedPixel {
 void ppmRead(const char *filename, int &width, int &height,
              std::vector<PackedPixel> &pixels);
 
+// A PPM file opened for reading without copying. The file is memory mapped;
+// the pixels of a binary (P6) file are used in place, while those of a text
+// (P3) file are decoded once into an internal buffer. Rows are numbered bottom
+// up, as GL expects them. Throws runtime_error on error.
+class PpmImage : Noncopyable {
+  public:
+    explicit PpmImage(const char *filename);
+
+    int getWidth() const { return width_; }
+    int getHeight() const { return height_; }
+
+    // Row `y' counted from the bottom, 3 * width bytes of R, G, B
+    const PackedPixel *getRow(int y) const {
+        return reinterpret_cast<const PackedPixel *>(top_) +
+               size_t(height_ - 1 - y) * width_;
+    }
+
+    // Copies the pixels to `dst', bottom row first, rows tightly packed.
+    // This is where the vertical flip happens, so it can write straight into
+    // a mapped pixel buffer object.
+    void copyTo(PackedPixel *dst) const;
+
+    // Same, bilinearly resampled to width x height, sampling at pixel centers
+    void resampleTo(int width, int height, PackedPixel *dst) const;
+
+  private:
+    int width_, height_;
+    std::unique_ptr<MappedFile> file_;
+    std::vector<unsigned char> decoded_; // P3 only
+    const unsigned char *top_;           // top row, in file order
+};
+
 #endif
@@ -0,0 +1,161 @@
+// Times the PPM decoder (PpmImage, see ppm.h) against the stream based reader
+// it replaced, and checks that both decode the same pixels:
+//
+//   ppmbench [-runs n] image.ppm...
+//
+// `make bench' runs it over the textures of the repository. For each image,
+// prints the best of n runs of each decoder, from opening the file to the
+// pixels bottom row first in memory. Exits with -1 if the pixels differ.
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ppm.h"
+
+using namespace std;
+
+// The reader of ppm.cpp before PpmImage, one istream::get per character
+
+static int streamReadInteger(istream &is) {
+    unsigned char ch;
+    int got = 0, done = 0, accum = 0, inComment = 0;
+    while (!done) {
+        ch = is.get();
+
+        if (inComment) {
+            if (ch == '\n')
+                inComment = 0;
+            continue;
+        }
+
+        if (isdigit(ch)) {
+            accum = accum * 10 + ch - '0';
+            got = 1;
+        } else if (ch == '#')
+            inComment = 1;
+        else if (!ch || !strchr(" \t\r\n", ch))
+            throw runtime_error("ppmRead: invalid character");
+        else if (got)
+            done = 1;
+    }
+    return accum;
+}
+
+static void streamRead(const char *filename, int &width, int &height,
+                       vector<PackedPixel> &pixels) {
+    ifstream is(filename, ios::binary);
+    if (!is.is_open())
+        throw runtime_error(string("ppmRead: Cannot open file ") + filename +
+                            " for read");
+    is.exceptions(ios::eofbit | ios::failbit | ios::badbit);
+
+    char buf[2];
+    is.read(buf, 2);
+    bool isbinary = false;
+    if (!memcmp(buf, "P3", 2))
+        isbinary = false;
+    else if (!memcmp(buf, "P6", 2))
+        isbinary = true;
+    else
+        throw runtime_error("ppmRead: bad file format");
+
+    width = streamReadInteger(is);
+    height = streamReadInteger(is);
+    streamReadInteger(is); // maxcolor
+
+    pixels.resize(size_t(width) * height);
+    if (isbinary) {
+        for (int row = height - 1; row >= 0; row--) {
+            is.read(reinterpret_cast<char *>(&pixels[size_t(row) * width]),
+                    width * sizeof(PackedPixel));
+        }
+    } else {
+        for (int row = height - 1; row >= 0; row--) {
+            for (int l = 0; l < width; l++) {
+                PackedPixel &p = pixels[size_t(row) * width + l];
+                p.r = streamReadInteger(is);
+                p.g = streamReadInteger(is);
+                p.b = streamReadInteger(is);
+            }
+        }
+    }
+}
+
+// Best time of `runs' calls of `decode', in milliseconds
+template <typename Decode> static double timeBest(int runs, Decode decode) {
+    double best = 1e30;
+    for (int i = 0; i < runs; ++i) {
+        const chrono::steady_clock::time_point start =
+            chrono::steady_clock::now();
+        decode();
+        const chrono::duration<double, milli> elapsed =
+            chrono::steady_clock::now() - start;
+        best = min(best, elapsed.count());
+    }
+    return best;
+}
+
+static bool samePixels(const vector<PackedPixel> &a,
+                       const vector<PackedPixel> &b) {
+    return a.size() == b.size() &&
+           (a.empty() ||
+            memcmp(&a[0], &b[0], a.size() * sizeof(PackedPixel)) == 0);
+}
+
+int main(int argc, char *argv[]) {
+    int runs = 5, images = 0;
+    bool ok = true;
+    double totalNew = 0, totalOld = 0;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            if (string(argv[i]) == "-runs" && i + 1 < argc) {
+                runs = atoi(argv[++i]);
+                if (runs <= 0)
+                    throw runtime_error("Invalid number of runs");
+                continue;
+            }
+
+            const char *filename = argv[i];
+            vector<PackedPixel> decoded, reference;
+            int width = 0, height = 0;
+            const double newMs = timeBest(runs, [&] {
+                const PpmImage image(filename);
+                decoded.resize(size_t(image.getWidth()) * image.getHeight());
+                image.copyTo(&decoded[0]);
+            });
+            const double oldMs = timeBest(runs, [&] {
+                streamRead(filename, width, height, reference);
+            });
+
+            const bool same = samePixels(decoded, reference);
+            ok &= same;
+            totalNew += newMs;
+            totalOld += oldMs;
+            ++images;
+            cout << left << setw(24) << filename << right << setw(6) << width
+                 << "x" << left << setw(6) << height << right << fixed
+                 << setprecision(2) << setw(9) << newMs << " ms" << setw(9)
+                 << oldMs << " ms  (stream)"
+                 << (same ? "" : "  PIXELS DIFFER") << endl;
+        }
+    } catch (const runtime_error &e) {
+        cerr << "Exception caught: " << e.what() << endl;
+        return -1;
+    }
+    if (images == 0) {
+        cerr << "Usage: " << argv[0] << " [-runs n] image.ppm..." << endl;
+        return -1;
+    }
+    cout << left << setw(37) << "total" << right << fixed << setprecision(2)
+         << setw(9) << totalNew << " ms" << setw(9) << totalOld
+         << " ms  (stream)" << endl;
+    return ok ? 0 : -1;
+}
@@ -10,9 +10,9 @@
 
 // Forward declarations used in the definition of Quat;
 class Quat;
-double dot(const Quat &q, const Quat &p);
-double norm2(const Quat &q);
-Quat inv(const Quat &q);
+constexpr double dot(const Quat &q, const Quat &p);
+constexpr double norm2(const Quat &q);
+constexpr Quat inv(const Quat &q);
 Quat normalize(const Quat &q);
 Matrix4 quatToMatrix(const Quat &q);
 
@@ -20,86 +20,96 @@ class Quat {
     Cvec4 q_; // layout is: q_[0]==w, q_[1]==x, q_[2]==y, q_[3]==z
 
   public:
-    double operator[](const int i) const { return q_[i]; }
+    constexpr double operator[](const int i) const { return q_[i]; }
 
-    double &operator[](const int i) { return q_[i]; }
+    constexpr double &operator[](const int i) { return q_[i]; }
 
-    double operator()(const int i) const { return q_[i]; }
+    constexpr double operator()(const int i) const { return q_[i]; }
 
-    double &operator()(const int i) { return q_[i]; }
+    constexpr double &operator()(const int i) { return q_[i]; }
 
-    Quat() : q_(1, 0, 0, 0) {}
-    Quat(const double w, const Cvec3 &v) : q_(w, v[0], v[1], v[2]) {}
-    Quat(const double w, const double x, const double y, const double z)
+    constexpr Quat() : q_(1, 0, 0, 0) {}
+    constexpr Quat(const double w, const Cvec3 &v)
+        : q_(w, v[0], v[1], v[2]) {}
+    constexpr Quat(const double w, const double x, const double y,
+                   const double z)
         : q_(w, x, y, z) {}
 
-    Quat &operator+=(const Quat &a) {
+    constexpr Quat &operator+=(const Quat &a) {
         q_ += a.q_;
         return *this;
     }
 
-    Quat &operator-=(const Quat &a) {
+    constexpr Quat &operator-=(const Quat &a) {
         q_ -= a.q_;
         return *this;
     }
 
-    Quat &operator*=(const double a) {
+    constexpr Quat &operator*=(const double a) {
         q_ *= a;
         return *this;
     }
 
-    Quat &operator/=(const double a) {
+    constexpr Quat &operator/=(const double a) {
         q_ /= a;
         return *this;
     }
 
-    Quat operator+(const Quat &a) const { return Quat(*this) += a; }
+    constexpr Quat operator+(const Quat &a) const { return Quat(*this) += a; }
 
-    Quat operator-() const { return Quat(-q_[0], -q_[1], -q_[2], -q_[3]); }
+    constexpr Quat operator-() const {
+        return Quat(-q_[0], -q_[1], -q_[2], -q_[3]);
+    }
 
-    Quat operator-(const Quat &a) const { return Quat(*this) -= a; }
+    constexpr Quat operator-(const Quat &a) const { return Quat(*this) -= a; }
 
-    Quat operator*(const double a) const { return Quat(*this) *= a; }
+    constexpr Quat operator*(const double a) const { return Quat(*this) *= a; }
 
-    Quat operator/(const double a) const { return Quat(*this) /= a; }
+    constexpr Quat operator/(const double a) const { return Quat(*this) /= a; }
 
-    Quat operator*(const Quat &a) const {
+    constexpr Quat operator*(const Quat &a) const {
         const Cvec3 u(q_[1], q_[2], q_[3]), v(a.q_[1], a.q_[2], a.q_[3]);
         return Quat(q_[0] * a.q_[0] - dot(u, v),
                     (v * q_[0] + u * a.q_[0]) + cross(u, v));
     }
 
-    Cvec4 operator*(const Cvec4 &a) const {
+    constexpr Cvec4 operator*(const Cvec4 &a) const {
         const Quat r = *this * (Quat(0, a[0], a[1], a[2]) * inv(*this));
         return Cvec4(r[1], r[2], r[3], a[3]);
     }
 
     static Quat makeXRotation(const double ang) {
-        Quat r;
         const double h = 0.5 * ang * CS175_PI / 180;
-        r.q_[1] = std::sin(h);
-        r.q_[0] = std::cos(h);
-        return r;
+        return makeXRotation(std::cos(h), std::sin(h));
     }
 
     static Quat makeYRotation(const double ang) {
-        Quat r;
         const double h = 0.5 * ang * CS175_PI / 180;
-        r.q_[2] = std::sin(h);
-        r.q_[0] = std::cos(h);
-        return r;
+        return makeYRotation(std::cos(h), std::sin(h));
     }
 
     static Quat makeZRotation(const double ang) {
-        Quat r;
         const double h = 0.5 * ang * CS175_PI / 180;
-        r.q_[3] = std::sin(h);
-        r.q_[0] = std::cos(h);
-        return r;
+        return makeZRotation(std::cos(h), std::sin(h));
+    }
+
+    // From the cosine and sine of half the angle, which constant rotations
+    // can give without trigonometry, e.g., CS175_SQRT1_2 for both is a
+    // quarter turn
+    static constexpr Quat makeXRotation(const double c, const double s) {
+        return Quat(c, s, 0, 0);
+    }
+
+    static constexpr Quat makeYRotation(const double c, const double s) {
+        return Quat(c, 0, s, 0);
+    }
+
+    static constexpr Quat makeZRotation(const double c, const double s) {
+        return Quat(c, 0, 0, s);
     }
 };
 
-inline double dot(const Quat &q, const Quat &p) {
+constexpr double dot(const Quat &q, const Quat &p) {
     double s = 0.0;
     for (int i = 0; i < 4; ++i) {
         s += q(i) * p(i);
@@ -107,9 +117,9 @@ inline double dot(const Quat &q, const Quat &p) {
     return s;
 }
 
-inline double norm2(const Quat &q) { return dot(q, q); }
+constexpr double norm2(const Quat &q) { return dot(q, q); }
 
-inline Quat inv(const Quat &q) {
+constexpr Quat inv(const Quat &q) {
     const double n = norm2(q);
     assert(n > CS175_EPS2);
     return Quat(q(0), -q(1), -q(2), -q(3)) * (1.0 / n);
@@ -138,7 +148,7 @@ inline Matrix4 quatToMatrix(const Quat &q) {
     return r;
 }
 
-inline Quat shortRotation(const Quat &q) { return q[0] < 0 ? -q : q; }
+constexpr Quat shortRotation(const Quat &q) { return q[0] < 0 ? -q : q; }
 
 inline Quat pow(const Quat &q, double exponent) {
     // normalize to unit quaternion just to make sure
@@ -159,14 +169,78 @@ inline Quat slerp(const Quat &q0, const Quat &q1, const double t) {
     return pow(shortRotation(q1 * inv(q0)), t) * q0;
 }
 
+namespace _slerp {
+// Eberly's u_i = 1 / (i (2i + 1)) and v_i = i / (2i + 1), for i = 1..8, with
+// the last pair scaled by 1 + mu to spread the truncation error
+static const double ONE_PLUS_MU = 1.85298109240830;
+static const double U[8] = {1 / 3.0,  1 / 10.0, 1 / 21.0,  1 / 36.0,
+                            1 / 55.0, 1 / 78.0, 1 / 105.0, ONE_PLUS_MU / 136};
+static const double V[8] = {1 / 3.0,  2 / 5.0,  3 / 7.0,  4 / 9.0,
+                            5 / 11.0, 6 / 13.0, 7 / 15.0, ONE_PLUS_MU * 8 / 17};
+} // namespace _slerp
+
+// sin(t a) / sin(a) without trigonometry, for cos(a) = xm1 + 1 in [0, 1]:
+// the series in t and cos(a) of Eberly, "A Fast and Accurate Algorithm for
+// Computing SLERP", truncated after 8 terms and written out so that the
+// batch kernels vectorize. Within 2e-5 of the exact weight. T is double or
+// float, the latter for the batch kernels.
+template <class T> inline T slerpWeight(const T t, const T xm1) {
+    using namespace _slerp;
+    const T t2 = t * t;
+    T b = 1 + (T(U[7]) * t2 - T(V[7])) * xm1;
+    b = 1 + (T(U[6]) * t2 - T(V[6])) * xm1 * b;
+    b = 1 + (T(U[5]) * t2 - T(V[5])) * xm1 * b;
+    b = 1 + (T(U[4]) * t2 - T(V[4])) * xm1 * b;
+    b = 1 + (T(U[3]) * t2 - T(V[3])) * xm1 * b;
+    b = 1 + (T(U[2]) * t2 - T(V[2])) * xm1 * b;
+    b = 1 + (T(U[1]) * t2 - T(V[1])) * xm1 * b;
+    b = 1 + (T(U[0]) * t2 - T(V[0])) * xm1 * b;
+    return t * b;
+}
+
+// slerp along the shorter arc with slerpWeight in place of pow. For unit
+// quaternions the result is unit and its rotation is within 2e-5 radians
+// (0.001 degrees) of slerp's, for any t in [0, 1].
+inline Quat fastSlerp(const Quat &q0, const Quat &q1, const double t) {
+    double x = dot(q0, q1);
+    const double sign = x < 0 ? -1 : 1;
+    x *= sign;
+    return normalize(q0 * slerpWeight(1 - t, x - 1) +
+                     q1 * (sign * slerpWeight(t, x - 1)));
+}
+
+// The cubic Bezier control points of the Catmull-Rom segment from q1 to q2.
+// They depend only on the key frames, so an animation can make them once
+// per segment and evaluate them at every frame with interpolateBezier.
+struct QuatBezier {
+    Quat b[4];
+};
+
+inline QuatBezier makeCatmullRomBezier(const Quat &q0, const Quat &q1,
+                                       const Quat &q2, const Quat &q3) {
+    QuatBezier c;
+    c.b[0] = q1;
+    c.b[1] = pow(shortRotation(q2 * inv(q0)), 1 / 6.0) * q1;
+    c.b[2] = inv(pow(shortRotation(q3 * inv(q1)), 1 / 6.0)) * q2;
+    c.b[3] = q2;
+    return c;
+}
+
+// De Casteljau with fastSlerp
+inline Quat interpolateBezier(const QuatBezier &c, const double t) {
+    const Quat p01 = fastSlerp(c.b[0], c.b[1], t);
+    const Quat p12 = fastSlerp(c.b[1], c.b[2], t);
+    const Quat p23 = fastSlerp(c.b[2], c.b[3], t);
+    return fastSlerp(fastSlerp(p01, p12, t), fastSlerp(p12, p23, t), t);
+}
+
 inline Quat interpolateCatmullRom(const Quat &q0, const Quat &q1,
                                   const Quat &q2, const Quat &q3,
                                   const double t) {
-    const Quat i1 = pow(shortRotation(q2 * inv(q0)), 1 / 6.0) * q1;
-    const Quat i2 = inv(pow(shortRotation(q3 * inv(q1)), 1 / 6.0)) * q2;
-    const Quat p01 = slerp(q1, i1, t);
-    const Quat p12 = slerp(i1, i2, t);
-    const Quat p23 = slerp(i2, q2, t);
+    const QuatBezier c = makeCatmullRomBezier(q0, q1, q2, q3);
+    const Quat p01 = slerp(c.b[0], c.b[1], t);
+    const Quat p12 = slerp(c.b[1], c.b[2], t);
+    const Quat p23 = slerp(c.b[2], c.b[3], t);
     return slerp(slerp(p01, p12, t), slerp(p12, p23, t),
                  t); // 3rd order Bezier interpolation version
 }
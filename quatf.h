@@ -0,0 +1,147 @@
+#ifndef QUATF_H
+#define QUATF_H
+
+#include <cassert>
+#include <cmath>
+
+#include "cvec.h"
+#include "matrix4f.h"
+#include "quat.h"
+
+#ifdef CS175_SSE
+// Lane helpers for the SSE kernels of Quatf and RigTFormf
+namespace _simd {
+// Lanes x, y, z of a vector; lane 3 is ignored and comes out 0
+inline __m128 cross(__m128 a, __m128 b) {
+    const __m128 aYzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)),
+                 bYzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    const __m128 c = _mm_sub_ps(_mm_mul_ps(a, bYzx), _mm_mul_ps(aYzx, b));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+// Rotates the x, y, z lanes of `v' by the unit quaternion `q' (lanes w, x,
+// y, z): v + w t + u x t, with u the vector part of q and t = 2 u x v
+inline __m128 rotate(__m128 q, __m128 v) {
+    const __m128 u = _mm_shuffle_ps(q, q, _MM_SHUFFLE(0, 3, 2, 1));
+    const __m128 w = _mm_shuffle_ps(q, q, _MM_SHUFFLE(0, 0, 0, 0));
+    const __m128 t = _mm_add_ps(cross(u, v), cross(u, v));
+    return _mm_add_ps(v, _mm_add_ps(_mm_mul_ps(w, t), cross(u, t)));
+}
+
+// Lanes of q * p, both w, x, y, z
+inline __m128 multiply(__m128 q, __m128 p) {
+    const __m128 signsX = _mm_setr_ps(-0.f, 0.f, -0.f, 0.f),
+                 signsY = _mm_setr_ps(-0.f, 0.f, 0.f, -0.f),
+                 signsZ = _mm_setr_ps(-0.f, -0.f, 0.f, 0.f);
+    __m128 r = _mm_mul_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(0, 0, 0, 0)), p);
+    // x * (-px, pw, -pz, py)
+    r = _mm_add_ps(
+        r, _mm_mul_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(1, 1, 1, 1)),
+                      _mm_xor_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 3, 0, 1)),
+                                 signsX)));
+    // y * (-py, pz, pw, -px)
+    r = _mm_add_ps(
+        r, _mm_mul_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(2, 2, 2, 2)),
+                      _mm_xor_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 0, 3, 2)),
+                                 signsY)));
+    // z * (-pz, -py, px, pw)
+    r = _mm_add_ps(
+        r, _mm_mul_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(3, 3, 3, 3)),
+                      _mm_xor_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(0, 1, 2, 3)),
+                                 signsZ)));
+    return r;
+}
+} // namespace _simd
+#endif
+
+// A float quaternion, the single precision counterpart of Quat for the
+// render path. The kernels assume unit quaternions, which a rotation stays
+// when it is only multiplied by others.
+class Quatf {
+    alignas(16) float q_[4]; // layout is: q_[0]==w, q_[1]==x, ...
+
+  public:
+    float operator[](const int i) const { return q_[i]; }
+
+    float &operator[](const int i) { return q_[i]; }
+
+    // w, x, y, z, 16 byte aligned
+    const float *data() const { return q_; }
+
+    Quatf() {
+        q_[0] = 1;
+        q_[1] = q_[2] = q_[3] = 0;
+    }
+
+    Quatf(const float w, const float x, const float y, const float z) {
+        q_[0] = w;
+        q_[1] = x;
+        q_[2] = y;
+        q_[3] = z;
+    }
+
+    // Normalized, as double rotations drift a little from unit length
+    explicit Quatf(const Quat &q) {
+        const double n = std::sqrt(norm2(q));
+        assert(n > CS175_EPS);
+        for (int i = 0; i < 4; ++i) {
+            q_[i] = float(q[i] / n);
+        }
+    }
+
+    Quat toQuat() const { return Quat(q_[0], q_[1], q_[2], q_[3]); }
+
+    Quatf operator*(const Quatf &a) const {
+        Quatf r;
+#ifdef CS175_SSE
+        _mm_store_ps(r.q_,
+                     _simd::multiply(_mm_load_ps(q_), _mm_load_ps(a.q_)));
+#else
+        const float *p = a.q_;
+        r.q_[0] = q_[0] * p[0] - q_[1] * p[1] - q_[2] * p[2] - q_[3] * p[3];
+        r.q_[1] = q_[0] * p[1] + q_[1] * p[0] + q_[2] * p[3] - q_[3] * p[2];
+        r.q_[2] = q_[0] * p[2] - q_[1] * p[3] + q_[2] * p[0] + q_[3] * p[1];
+        r.q_[3] = q_[0] * p[3] + q_[1] * p[2] - q_[2] * p[1] + q_[3] * p[0];
+#endif
+        return r;
+    }
+
+    Cvec3f rotate(const Cvec3f &v) const {
+#ifdef CS175_SSE
+        alignas(16) float r[4];
+        _mm_store_ps(r, _simd::rotate(_mm_load_ps(q_),
+                                      _mm_setr_ps(v[0], v[1], v[2], 0)));
+        return Cvec3f(r[0], r[1], r[2]);
+#else
+        const Cvec3f u(q_[1], q_[2], q_[3]);
+        const Cvec3f t = cross(u, v) * 2.f;
+        return v + t * q_[0] + cross(u, t);
+#endif
+    }
+
+    // Rotates the vector part; w is kept
+    Cvec4f operator*(const Cvec4f &a) const {
+        const Cvec3f r = rotate(Cvec3f(a[0], a[1], a[2]));
+        return Cvec4f(r[0], r[1], r[2], a[3]);
+    }
+};
+
+// The inverse of a unit quaternion is its conjugate
+inline Quatf inv(const Quatf &q) { return Quatf(q[0], -q[1], -q[2], -q[3]); }
+
+inline Matrix4f quatToMatrix(const Quatf &q) {
+    Matrix4f r;
+    const float w = q[0], x = q[1], y = q[2], z = q[3];
+    r(0, 0) = 1 - 2 * (y * y + z * z);
+    r(0, 1) = 2 * (x * y - w * z);
+    r(0, 2) = 2 * (x * z + y * w);
+    r(1, 0) = 2 * (x * y + w * z);
+    r(1, 1) = 1 - 2 * (x * x + z * z);
+    r(1, 2) = 2 * (y * z - x * w);
+    r(2, 0) = 2 * (x * z - y * w);
+    r(2, 1) = 2 * (y * z + x * w);
+    r(2, 2) = 1 - 2 * (x * x + y * y);
+    return r;
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdexcept>
 
+#include "glstate.h"
 #include "glsupport.h"
 #include "renderstates.h"
 
@@ -67,46 +68,13 @@ RenderStates &RenderStates::disable(GLenum target) {
 }
 
 void RenderStates::apply() const {
-    static bool firstRun = false;
-    static RenderStates currentRs;
-    if (firstRun) {
-        currentRs.captureFromGl();
-        firstRun = false;
-    }
-
-    if (glFrontAndBack != currentRs.glFrontAndBack) {
-        ::glPolygonMode(GL_FRONT_AND_BACK, glFrontAndBack);
-        currentRs.glFrontAndBack = glFrontAndBack;
-    }
-    if (glBlendSrcFactor != currentRs.glBlendSrcFactor ||
-        glBlendDstFactor != currentRs.glBlendDstFactor) {
-        ::glBlendFunc(glBlendSrcFactor, glBlendDstFactor);
-        currentRs.glBlendSrcFactor = glBlendSrcFactor;
-        currentRs.glBlendDstFactor = glBlendDstFactor;
-    }
-
-    if (glCullFaceMode != currentRs.glCullFaceMode) {
-        ::glCullFace(glCullFaceMode);
-        currentRs.glCullFaceMode = glCullFaceMode;
-    }
-
-    if ((flags & kBlendBit) != (currentRs.flags & kBlendBit)) {
-        if (flags & kBlendBit)
-            ::glEnable(GL_BLEND);
-        else
-            ::glDisable(GL_BLEND);
-        currentRs.flags =
-            (currentRs.flags & (~kBlendBit)) | (flags & kBlendBit);
-    }
-
-    if ((flags & kCullFaceBit) != (currentRs.flags & kCullFaceBit)) {
-        if (flags & kCullFaceBit)
-            ::glEnable(GL_CULL_FACE);
-        else
-            ::glDisable(GL_CULL_FACE);
-        currentRs.flags =
-            (currentRs.flags & (~kCullFaceBit)) | (flags & kCullFaceBit);
-    }
+    // GlState skips whatever is already current
+    GlState &gl = GlState::get();
+    gl.polygonMode(glFrontAndBack);
+    gl.blendFunc(glBlendSrcFactor, glBlendDstFactor);
+    gl.cullFace(glCullFaceMode);
+    gl.setEnabled(GL_BLEND, (flags & kBlendBit) != 0);
+    gl.setEnabled(GL_CULL_FACE, (flags & kCullFaceBit) != 0);
 }
 
 void RenderStates::captureFromGl() {
@@ -13,47 +13,49 @@ class RigTForm {
     Quat r_;  // rotation component represented as a quaternion
 
   public:
-    RigTForm() : t_(0) { assert(norm2(Quat(1, 0, 0, 0) - r_) < CS175_EPS2); }
+    constexpr RigTForm() : t_(0) {
+        assert(norm2(Quat(1, 0, 0, 0) - r_) < CS175_EPS2);
+    }
 
-    RigTForm(const Cvec3 &t, const Quat &r) : t_(t), r_(r) {}
-    explicit RigTForm(const Cvec3 &t)
+    constexpr RigTForm(const Cvec3 &t, const Quat &r) : t_(t), r_(r) {}
+    constexpr explicit RigTForm(const Cvec3 &t)
         : t_(t), r_() {} // only set translation part (rotation is identity)
-    explicit RigTForm(const Quat &r)
+    constexpr explicit RigTForm(const Quat &r)
         : t_(0), r_(r) {} // only set rotation part (translation is 0)
 
-    Cvec3 getTranslation() const { return t_; }
+    constexpr Cvec3 getTranslation() const { return t_; }
 
-    Quat getRotation() const { return r_; }
+    constexpr Quat getRotation() const { return r_; }
 
-    RigTForm &setTranslation(const Cvec3 &t) {
+    constexpr RigTForm &setTranslation(const Cvec3 &t) {
         t_ = t;
         return *this;
     }
 
-    RigTForm &setRotation(const Quat &r) {
+    constexpr RigTForm &setRotation(const Quat &r) {
         r_ = r;
         return *this;
     }
 
-    Cvec4 operator*(const Cvec4 &a) const {
+    constexpr Cvec4 operator*(const Cvec4 &a) const {
         return Cvec4(t_, 0.0) * a[3] + r_ * a;
     }
 
-    RigTForm operator*(const RigTForm &a) const {
+    constexpr RigTForm operator*(const RigTForm &a) const {
         return RigTForm(t_ + Cvec3(r_ * Cvec4(a.t_, 0)), r_ * a.r_);
     }
 };
 
-inline RigTForm inv(const RigTForm &tform) {
-    Quat invRot = inv(tform.getRotation());
+constexpr RigTForm inv(const RigTForm &tform) {
+    const Quat invRot = inv(tform.getRotation());
     return RigTForm(Cvec3(invRot * Cvec4(-tform.getTranslation(), 1)), invRot);
 }
 
-inline RigTForm transFact(const RigTForm &tform) {
+constexpr RigTForm transFact(const RigTForm &tform) {
     return RigTForm(tform.getTranslation());
 }
 
-inline RigTForm linFact(const RigTForm &tform) {
+constexpr RigTForm linFact(const RigTForm &tform) {
     return RigTForm(tform.getRotation());
 }
 
@@ -0,0 +1,426 @@
+#ifndef RIGTFORMARRAY_H
+#define RIGTFORMARRAY_H
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include "cvec.h"
+#include "quat.h"
+#include "rigtform.h"
+
+// Many float rigid body transforms stored as a structure of arrays: one lane
+// per component, tx, ty, tz, qw, qx, qy, qz. The batch kernels below work on
+// RIGTFORM_BATCH transforms at a time with plain fixed-length loops, which the
+// compiler turns into one SSE (4 floats) or AVX (8 floats) instruction per
+// operation. The lanes are padded with identities to a multiple of the batch,
+// so no kernel has a remainder loop. Being float, it is meant for data derived
+// anew each frame from double state, such as poses or instance matrices, not
+// for state that is composed onto itself frame after frame.
+static const int RIGTFORM_BATCH = 8;
+
+class RigTFormArray {
+  public:
+    enum Lane { TX, TY, TZ, QW, QX, QY, QZ, NUM_LANES };
+
+    explicit RigTFormArray(const int size = 0) : size_(0) { resize(size); }
+
+    int size() const { return size_; }
+
+    // Transforms added at the end are identities
+    void resize(const int size) {
+        assert(size >= 0);
+        const int padded =
+            (size + RIGTFORM_BATCH - 1) / RIGTFORM_BATCH * RIGTFORM_BATCH;
+        const int oldPadded = int(lanes_[TX].size());
+        for (int i = 0; i < NUM_LANES; ++i) {
+            lanes_[i].resize(padded, i == QW ? 1.f : 0.f);
+        }
+        // The kernels store whole batches, so the old padding may hold
+        // results computed there, and slots past the old size may hold
+        // transforms no longer part of the array. Either way, once inside
+        // the new size or padding they are reset.
+        for (int i = std::min(size, size_); i < oldPadded && i < padded; ++i) {
+            set(i, RigTForm());
+        }
+        size_ = size;
+    }
+
+    float *lane(const Lane l) { return lanes_[l].empty() ? 0 : &lanes_[l][0]; }
+
+    const float *lane(const Lane l) const {
+        return lanes_[l].empty() ? 0 : &lanes_[l][0];
+    }
+
+    RigTForm get(const int i) const {
+        assert(i >= 0 && i < size_);
+        return RigTForm(Cvec3(lanes_[TX][i], lanes_[TY][i], lanes_[TZ][i]),
+                        Quat(lanes_[QW][i], lanes_[QX][i], lanes_[QY][i],
+                             lanes_[QZ][i]));
+    }
+
+    // The rotation is normalized on the way in, as the kernels assume unit
+    // quaternions
+    void set(const int i, const RigTForm &tform) {
+        assert(i >= 0 && i < int(lanes_[TX].size()));
+        const Cvec3 t = tform.getTranslation();
+        const Quat q = tform.getRotation();
+        const double n = std::sqrt(norm2(q));
+        assert(n > CS175_EPS);
+        lanes_[TX][i] = float(t[0]);
+        lanes_[TY][i] = float(t[1]);
+        lanes_[TZ][i] = float(t[2]);
+        lanes_[QW][i] = float(q[0] / n);
+        lanes_[QX][i] = float(q[1] / n);
+        lanes_[QY][i] = float(q[2] / n);
+        lanes_[QZ][i] = float(q[3] / n);
+    }
+
+  private:
+    int size_;
+    std::vector<float> lanes_[NUM_LANES];
+
+    friend struct RigTFormBatch;
+};
+
+// One batch of transforms copied out of the lanes. The kernels compute on
+// these local copies, so the output may be one of the inputs.
+struct RigTFormBatch {
+    float t[3][RIGTFORM_BATCH]; // x, y, z
+    float q[4][RIGTFORM_BATCH]; // w, x, y, z
+
+    void load(const RigTFormArray &a, const int base) {
+        for (int c = 0; c < 3; ++c) {
+            const float *l = &a.lanes_[RigTFormArray::TX + c][base];
+            for (int i = 0; i < RIGTFORM_BATCH; ++i) {
+                t[c][i] = l[i];
+            }
+        }
+        for (int c = 0; c < 4; ++c) {
+            const float *l = &a.lanes_[RigTFormArray::QW + c][base];
+            for (int i = 0; i < RIGTFORM_BATCH; ++i) {
+                q[c][i] = l[i];
+            }
+        }
+    }
+
+    // Every slot holds the same transform
+    void broadcast(const RigTForm &tform) {
+        const Cvec3 tt = tform.getTranslation();
+        const Quat qq = tform.getRotation();
+        const double n = std::sqrt(norm2(qq));
+        assert(n > CS175_EPS);
+        for (int i = 0; i < RIGTFORM_BATCH; ++i) {
+            for (int c = 0; c < 3; ++c) {
+                t[c][i] = float(tt[c]);
+            }
+            for (int c = 0; c < 4; ++c) {
+                q[c][i] = float(qq[c] / n);
+            }
+        }
+    }
+
+    void store(RigTFormArray &a, const int base) const {
+        for (int c = 0; c < 3; ++c) {
+            float *l = &a.lanes_[RigTFormArray::TX + c][base];
+            for (int i = 0; i < RIGTFORM_BATCH; ++i) {
+                l[i] = t[c][i];
+            }
+        }
+        for (int c = 0; c < 4; ++c) {
+            float *l = &a.lanes_[RigTFormArray::QW + c][base];
+            for (int i = 0; i < RIGTFORM_BATCH; ++i) {
+                l[i] = q[c][i];
+            }
+        }
+    }
+};
+
+namespace _batch {
+// r = a * b for each slot, as RigTForm::operator*: the translation of b is
+// rotated by a and added to a's, and the rotations multiply
+inline void compose(const RigTFormBatch &a, const RigTFormBatch &b,
+                    RigTFormBatch &r) {
+    for (int i = 0; i < RIGTFORM_BATCH; ++i) {
+        const float w = a.q[0][i], x = a.q[1][i], y = a.q[2][i],
+                    z = a.q[3][i];
+        const float vx = b.t[0][i], vy = b.t[1][i], vz = b.t[2][i];
+        // v + w t + u x t, with u = (x, y, z) and t = 2 u x v
+        const float cx = 2 * (y * vz - z * vy), cy = 2 * (z * vx - x * vz),
+                    cz = 2 * (x * vy - y * vx);
+        const float rx = vx + w * cx + (y * cz - z * cy),
+                    ry = vy + w * cy + (z * cx - x * cz),
+                    rz = vz + w * cz + (x * cy - y * cx);
+
+        const float pw = b.q[0][i], px = b.q[1][i], py = b.q[2][i],
+                    pz = b.q[3][i];
+        r.q[0][i] = w * pw - x * px - y * py - z * pz;
+        r.q[1][i] = w * px + x * pw + y * pz - z * py;
+        r.q[2][i] = w * py - x * pz + y * pw + z * px;
+        r.q[3][i] = w * pz + x * py - y * px + z * pw;
+        r.t[0][i] = a.t[0][i] + rx;
+        r.t[1][i] = a.t[1][i] + ry;
+        r.t[2][i] = a.t[2][i] + rz;
+    }
+}
+
+// Rotations of r = fastSlerp(a, b, alpha) for each slot; r may be a or b.
+// Each loop runs over the slots only, so that all of them vectorize.
+inline void slerp(const RigTFormBatch &a, const RigTFormBatch &b,
+                  const float alpha, RigTFormBatch &r) {
+    float s0[RIGTFORM_BATCH], s1[RIGTFORM_BATCH], n2[RIGTFORM_BATCH];
+    for (int i = 0; i < RIGTFORM_BATCH; ++i) {
+        const float d = a.q[0][i] * b.q[0][i] + a.q[1][i] * b.q[1][i] +
+                        a.q[2][i] * b.q[2][i] + a.q[3][i] * b.q[3][i];
+        const float sign = d < 0 ? -1.f : 1.f;
+        const float xm1 = sign * d - 1;
+        s0[i] = slerpWeight(1 - alpha, xm1);
+        s1[i] = sign * slerpWeight(alpha, xm1);
+        n2[i] = 0;
+    }
+    for (int c = 0; c < 4; ++c) {
+        for (int i = 0; i < RIGTFORM_BATCH; ++i) {
+            r.q[c][i] = s0[i] * a.q[c][i] + s1[i] * b.q[c][i];
+            n2[i] += r.q[c][i] * r.q[c][i];
+        }
+    }
+    // Off unit length by about the weights' error, so one Newton step for
+    // 1 / sqrt(n2) from 1 renormalizes, with no sqrt
+    for (int i = 0; i < RIGTFORM_BATCH; ++i) {
+        n2[i] = 1.5f - 0.5f * n2[i];
+    }
+    for (int c = 0; c < 4; ++c) {
+        for (int i = 0; i < RIGTFORM_BATCH; ++i) {
+            r.q[c][i] *= n2[i];
+        }
+    }
+}
+} // namespace _batch
+
+// r[i] = a[i] * b[i]. r may be a or b.
+inline void compose(const RigTFormArray &a, const RigTFormArray &b,
+                    RigTFormArray &r) {
+    assert(a.size() == b.size());
+    r.resize(a.size());
+    RigTFormBatch x, y;
+    for (int base = 0; base < a.size(); base += RIGTFORM_BATCH) {
+        x.load(a, base);
+        y.load(b, base);
+        _batch::compose(x, y, x);
+        x.store(r, base);
+    }
+}
+
+// r[i] = a * b[i], e.g., a parent frame applied to all of its children
+inline void compose(const RigTForm &a, const RigTFormArray &b,
+                    RigTFormArray &r) {
+    r.resize(b.size());
+    RigTFormBatch x, y;
+    x.broadcast(a);
+    for (int base = 0; base < b.size(); base += RIGTFORM_BATCH) {
+        y.load(b, base);
+        _batch::compose(x, y, y);
+        y.store(r, base);
+    }
+}
+
+// r[i] = a[i] * b, e.g., the same step applied to many frames
+inline void compose(const RigTFormArray &a, const RigTForm &b,
+                    RigTFormArray &r) {
+    r.resize(a.size());
+    RigTFormBatch x, y;
+    y.broadcast(b);
+    for (int base = 0; base < a.size(); base += RIGTFORM_BATCH) {
+        x.load(a, base);
+        _batch::compose(x, y, x);
+        x.store(r, base);
+    }
+}
+
+// r[i] = inv(a[i]): the conjugate rotation, and the translation rotated back
+// and negated. r may be a.
+inline void inv(const RigTFormArray &a, RigTFormArray &r) {
+    r.resize(a.size());
+    RigTFormBatch x, y;
+    for (int base = 0; base < a.size(); base += RIGTFORM_BATCH) {
+        x.load(a, base);
+        for (int i = 0; i < RIGTFORM_BATCH; ++i) {
+            y.q[0][i] = x.q[0][i];
+            y.q[1][i] = -x.q[1][i];
+            y.q[2][i] = -x.q[2][i];
+            y.q[3][i] = -x.q[3][i];
+            y.t[0][i] = y.t[1][i] = y.t[2][i] = 0;
+            x.t[0][i] = -x.t[0][i];
+            x.t[1][i] = -x.t[1][i];
+            x.t[2][i] = -x.t[2][i];
+            // With the identity rotation on x, compose only rotates -t by y
+            x.q[0][i] = 1;
+            x.q[1][i] = x.q[2][i] = x.q[3][i] = 0;
+        }
+        _batch::compose(y, x, x);
+        x.store(r, base);
+    }
+}
+
+// Applies a[i] to the point (x[i], y[i], z[i]) and writes it to (rx[i],
+// ry[i], rz[i]). The outputs may be the inputs.
+inline void transformPoints(const RigTFormArray &a, const float *x,
+                            const float *y, const float *z, float *rx,
+                            float *ry, float *rz) {
+    RigTFormBatch b, p;
+    const int n = a.size();
+    for (int base = 0; base < n; base += RIGTFORM_BATCH) {
+        b.load(a, base);
+        const int count =
+            n - base < RIGTFORM_BATCH ? n - base : RIGTFORM_BATCH;
+        for (int i = 0; i < RIGTFORM_BATCH; ++i) {
+            p.t[0][i] = i < count ? x[base + i] : 0;
+            p.t[1][i] = i < count ? y[base + i] : 0;
+            p.t[2][i] = i < count ? z[base + i] : 0;
+            p.q[0][i] = 1;
+            p.q[1][i] = p.q[2][i] = p.q[3][i] = 0;
+        }
+        _batch::compose(b, p, p);
+        for (int i = 0; i < count; ++i) {
+            rx[base + i] = p.t[0][i];
+            ry[base + i] = p.t[1][i];
+            rz[base + i] = p.t[2][i];
+        }
+    }
+}
+
+// Writes a.size() column-major 4x4 matrices, one after the other, ready for
+// upload as an array uniform or an instance buffer
+inline void writeColumnMajorMatrices(const RigTFormArray &a, float *m) {
+    RigTFormBatch b;
+    float c[16][RIGTFORM_BATCH];
+    const int n = a.size();
+    for (int base = 0; base < n; base += RIGTFORM_BATCH) {
+        b.load(a, base);
+        for (int i = 0; i < RIGTFORM_BATCH; ++i) {
+            const float w = b.q[0][i], x = b.q[1][i], y = b.q[2][i],
+                        z = b.q[3][i];
+            // Element (row, col) goes to c[col * 4 + row], as in quatToMatrix
+            c[0][i] = 1 - 2 * (y * y + z * z);
+            c[1][i] = 2 * (x * y + w * z);
+            c[2][i] = 2 * (x * z - y * w);
+            c[3][i] = 0;
+            c[4][i] = 2 * (x * y - w * z);
+            c[5][i] = 1 - 2 * (x * x + z * z);
+            c[6][i] = 2 * (y * z + x * w);
+            c[7][i] = 0;
+            c[8][i] = 2 * (x * z + y * w);
+            c[9][i] = 2 * (y * z - x * w);
+            c[10][i] = 1 - 2 * (x * x + y * y);
+            c[11][i] = 0;
+            c[12][i] = b.t[0][i];
+            c[13][i] = b.t[1][i];
+            c[14][i] = b.t[2][i];
+            c[15][i] = 1;
+        }
+        // Transposing the batch out is the only strided part
+        const int count =
+            n - base < RIGTFORM_BATCH ? n - base : RIGTFORM_BATCH;
+        for (int i = 0; i < count; ++i) {
+            float *out = m + 16 * (base + i);
+            for (int e = 0; e < 16; ++e) {
+                out[e] = c[e][i];
+            }
+        }
+    }
+}
+
+// r[i] = lerp(a[i], b[i], alpha), with fastSlerp for the rotations. r may
+// be a or b.
+inline void lerp(const RigTFormArray &a, const RigTFormArray &b,
+                 const float alpha, RigTFormArray &r) {
+    assert(a.size() == b.size());
+    r.resize(a.size());
+    RigTFormBatch x, y;
+    for (int base = 0; base < a.size(); base += RIGTFORM_BATCH) {
+        x.load(a, base);
+        y.load(b, base);
+        for (int c = 0; c < 3; ++c) {
+            for (int i = 0; i < RIGTFORM_BATCH; ++i) {
+                x.t[c][i] += alpha * (y.t[c][i] - x.t[c][i]);
+            }
+        }
+        _batch::slerp(x, y, alpha, x);
+        x.store(r, base);
+    }
+}
+
+// The Catmull-Rom segments of many tracks, e.g., every animated node between
+// two key frames, as the four arrays of their Bezier control points. The
+// control points cost a pow each and only change with the key frames;
+// interpolate then evaluates all tracks at once.
+class CatmullRomArray {
+  public:
+    explicit CatmullRomArray(const int size = 0) { resize(size); }
+
+    int size() const { return b_[0].size(); }
+
+    void resize(const int size) {
+        for (int k = 0; k < 4; ++k) {
+            b_[k].resize(size);
+        }
+    }
+
+    // Track i from tform1 to tform2, with tform0 and tform3 the key frames
+    // around them
+    void setSegment(const int i, const RigTForm &tform0,
+                    const RigTForm &tform1, const RigTForm &tform2,
+                    const RigTForm &tform3) {
+        const Cvec3 t0 = tform0.getTranslation(),
+                    t1 = tform1.getTranslation(),
+                    t2 = tform2.getTranslation(),
+                    t3 = tform3.getTranslation();
+        const QuatBezier c = makeCatmullRomBezier(
+            tform0.getRotation(), tform1.getRotation(), tform2.getRotation(),
+            tform3.getRotation());
+        b_[0].set(i, RigTForm(t1, c.b[0]));
+        b_[1].set(i, RigTForm(t1 + (t2 - t0) * (1 / 6.0), c.b[1]));
+        b_[2].set(i, RigTForm(t2 - (t3 - t1) * (1 / 6.0), c.b[2]));
+        b_[3].set(i, RigTForm(t2, c.b[3]));
+    }
+
+    const RigTFormArray &getControlPoints(const int k) const { return b_[k]; }
+
+  private:
+    RigTFormArray b_[4];
+};
+
+// r[i] = interpolateCatmullRom of track i at t in [0, 1], up to the error of
+// fastSlerp
+inline void interpolate(const CatmullRomArray &c, const float t,
+                        RigTFormArray &r) {
+    r.resize(c.size());
+    const float s = 1 - t;
+    const float w0 = s * s * s, w1 = 3 * s * s * t, w2 = 3 * s * t * t,
+                w3 = t * t * t;
+    RigTFormBatch b0, b1, b2, b3;
+    for (int base = 0; base < c.size(); base += RIGTFORM_BATCH) {
+        b0.load(c.getControlPoints(0), base);
+        b1.load(c.getControlPoints(1), base);
+        b2.load(c.getControlPoints(2), base);
+        b3.load(c.getControlPoints(3), base);
+        for (int k = 0; k < 3; ++k) {
+            for (int i = 0; i < RIGTFORM_BATCH; ++i) {
+                b0.t[k][i] = w0 * b0.t[k][i] + w1 * b1.t[k][i] +
+                             w2 * b2.t[k][i] + w3 * b3.t[k][i];
+            }
+        }
+        // De Casteljau on the rotations, in place: b0, b1, b2 become p01,
+        // p12, p23, then b0, b1 the next level, then b0 the result
+        _batch::slerp(b0, b1, t, b0);
+        _batch::slerp(b1, b2, t, b1);
+        _batch::slerp(b2, b3, t, b2);
+        _batch::slerp(b0, b1, t, b0);
+        _batch::slerp(b1, b2, t, b1);
+        _batch::slerp(b0, b1, t, b0);
+        b0.store(r, base);
+    }
+}
+
+#endif
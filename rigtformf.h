@@ -0,0 +1,79 @@
+#ifndef RIGTFORMF_H
+#define RIGTFORMF_H
+
+#include "cvec.h"
+#include "matrix4f.h"
+#include "quatf.h"
+#include "rigtform.h"
+
+// A float rigid body transform, the single precision counterpart of RigTForm
+// for the render path
+class RigTFormf {
+    alignas(16) float t_[4]; // translation component; t_[3] is 0
+    Quatf r_;                // rotation component, unit length
+
+  public:
+    RigTFormf() { t_[0] = t_[1] = t_[2] = t_[3] = 0; }
+
+    RigTFormf(const Cvec3f &t, const Quatf &r) : r_(r) {
+        setTranslation(t);
+    }
+
+    explicit RigTFormf(const RigTForm &tform) : r_(tform.getRotation()) {
+        const Cvec3 t = tform.getTranslation();
+        setTranslation(Cvec3f(float(t[0]), float(t[1]), float(t[2])));
+    }
+
+    Cvec3f getTranslation() const { return Cvec3f(t_[0], t_[1], t_[2]); }
+
+    Quatf getRotation() const { return r_; }
+
+    RigTFormf &setTranslation(const Cvec3f &t) {
+        t_[0] = t[0];
+        t_[1] = t[1];
+        t_[2] = t[2];
+        t_[3] = 0;
+        return *this;
+    }
+
+    RigTFormf &setRotation(const Quatf &r) {
+        r_ = r;
+        return *this;
+    }
+
+    Cvec4f operator*(const Cvec4f &a) const {
+        const Cvec4f r = r_ * a;
+        return Cvec4f(r[0] + t_[0] * a[3], r[1] + t_[1] * a[3],
+                      r[2] + t_[2] * a[3], a[3]);
+    }
+
+    RigTFormf operator*(const RigTFormf &a) const {
+        RigTFormf r;
+#ifdef CS175_SSE
+        const __m128 q = _mm_load_ps(r_.data());
+        _mm_store_ps(r.t_, _mm_add_ps(_mm_load_ps(t_),
+                                      _simd::rotate(q, _mm_load_ps(a.t_))));
+        _mm_store_ps(&r.r_[0], _simd::multiply(q, _mm_load_ps(a.r_.data())));
+#else
+        r.setTranslation(getTranslation() + r_.rotate(a.getTranslation()));
+        r.r_ = r_ * a.r_;
+#endif
+        return r;
+    }
+};
+
+inline RigTFormf inv(const RigTFormf &tform) {
+    const Quatf invRot = inv(tform.getRotation());
+    return RigTFormf(-invRot.rotate(tform.getTranslation()), invRot);
+}
+
+inline Matrix4f rigTFormToMatrix(const RigTFormf &tform) {
+    Matrix4f m = quatToMatrix(tform.getRotation());
+    const Cvec3f t = tform.getTranslation();
+    for (int i = 0; i < 3; ++i) {
+        m(i, 3) = t[i];
+    }
+    return m;
+}
+
+#endif
@@ -5,6 +5,7 @@
 #include <stdexcept>
 #include <vector>
 
+#include "affinetform.h"
 #include "asstcommon.h"
 #include "geometry.h"
 #include "glsupport.h" // for Noncopyable
@@ -58,7 +59,12 @@ class SgShapeNode : public SgNode {
   public:
     virtual bool accept(SgNodeVisitor &visitor);
 
-    virtual Matrix4 getAffineMatrix() = 0;
+    virtual AffineTForm getAffineTForm() = 0;
+
+    Matrix4 getAffineMatrix() {
+        return affineTFormToMatrix<Matrix4>(getAffineTForm());
+    }
+
     virtual void draw(const Uniforms &uniforms) = 0;
 };
 
@@ -107,7 +113,7 @@ class SgGeometryShapeNode : public SgShapeNode {
   public:
     std::shared_ptr<Geometry> geometry;
     std::shared_ptr<Material> material;
-    Matrix4 affineMatrix;
+    AffineTForm affineTForm;
 
     SgGeometryShapeNode(std::shared_ptr<Geometry> _geometry,
                         std::shared_ptr<Material> _material,
@@ -115,22 +121,23 @@ class SgGeometryShapeNode : public SgShapeNode {
                         const Cvec3 &eulerAngles = Cvec3(0, 0, 0),
                         const Cvec3 &scales = Cvec3(1, 1, 1))
         : geometry(_geometry), material(_material),
-          affineMatrix(Matrix4::makeTranslation(translation) *
-                       Matrix4::makeXRotation(eulerAngles[0]) *
-                       Matrix4::makeYRotation(eulerAngles[1]) *
-                       Matrix4::makeZRotation(eulerAngles[2]) *
-                       Matrix4::makeScale(scales)) {}
+          affineTForm(
+              AffineTForm::makeFromEuler(translation, eulerAngles, scales)) {}
+
+    // For transforms known at compile time, with no Euler angles to convert
+    SgGeometryShapeNode(std::shared_ptr<Geometry> _geometry,
+                        std::shared_ptr<Material> _material,
+                        const AffineTForm &_affineTForm)
+        : geometry(_geometry), material(_material), affineTForm(_affineTForm) {
+    }
 
-    virtual Matrix4 getAffineMatrix() { return affineMatrix; }
+    virtual AffineTForm getAffineTForm() { return affineTForm; }
 
     void setAffineMatrix(const Cvec3 &translation = Cvec3(0, 0, 0),
                          const Cvec3 &eulerAngles = Cvec3(0, 0, 0),
                          const Cvec3 &scales = Cvec3(1, 1, 1)) {
-        affineMatrix = Matrix4::makeTranslation(translation) *
-                       Matrix4::makeXRotation(eulerAngles[0]) *
-                       Matrix4::makeYRotation(eulerAngles[1]) *
-                       Matrix4::makeZRotation(eulerAngles[2]) *
-                       Matrix4::makeScale(scales);
+        affineTForm =
+            AffineTForm::makeFromEuler(translation, eulerAngles, scales);
     }
 
     virtual void draw(const Uniforms &uniforms) {
@@ -0,0 +1,204 @@
+#ifndef SUBDIVISION_H
+#define SUBDIVISION_H
+
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "cvec.h"
+#include "mesh.h"
+#include "parallel.h"
+
+// Catmull-Clark subdivision as stencils: each vertex of the mesh refined N
+// times is a fixed weighted sum of the control vertices, however they move.
+// The refined topology and the stencils are made once; an animated control
+// cage then costs one apply per frame, a sparse matrix times the control
+// positions. The rules are those of the Mesh setters' usual use:
+//   face:   the average of its vertices
+//   edge:   the average of its two vertices and two face points
+//   vertex: (n - 2) / n v + 1 / n^2 (sum of neighbors + sum of face points),
+//           with n the valence
+class SubdivisionStencils {
+  public:
+    SubdivisionStencils() : numControlVertices_(0) { offset_.push_back(0); }
+
+    // Subdivides the closed manifold `mesh' `levels' times, leaving the
+    // refined topology in it with its positions from the stencils
+    SubdivisionStencils(Mesh &mesh, const int levels) {
+        // refine() walks the vertex rings, which needs what subdivide checks
+        if (!mesh.isManifold())
+            throw std::runtime_error(
+                "Subdivision does not support non manifold mesh yet.");
+        if (mesh.hasBoundary())
+            throw std::runtime_error(
+                "Subdivision does not support mesh with boundaries yet.");
+        numControlVertices_ = mesh.getNumVertices();
+        std::vector<Cvec3> control(numControlVertices_);
+        for (int i = 0; i < numControlVertices_; ++i) {
+            control[i] = mesh.getVertex(i).getPosition();
+        }
+
+        // Stencils of the current level's vertices, over the control ones
+        std::vector<Stencil> stencils(numControlVertices_);
+        for (int i = 0; i < numControlVertices_; ++i) {
+            stencils[i].push_back(Entry(i, 1));
+        }
+        Accumulator acc(numControlVertices_);
+        for (int level = 0; level < levels; ++level) {
+            std::vector<Stencil> refined;
+            refine(mesh, stencils, acc, refined);
+            stencils.swap(refined);
+            // Only the topology is needed from the Mesh
+            for (int i = 0; i < mesh.getNumFaces(); ++i) {
+                mesh.setNewFaceVertex(mesh.getFace(i), Cvec3());
+            }
+            for (int i = 0; i < mesh.getNumEdges(); ++i) {
+                mesh.setNewEdgeVertex(mesh.getEdge(i), Cvec3());
+            }
+            for (int i = 0; i < mesh.getNumVertices(); ++i) {
+                mesh.setNewVertexVertex(mesh.getVertex(i), Cvec3());
+            }
+            mesh.subdivide();
+        }
+
+        offset_.assign(1, 0);
+        for (std::size_t i = 0; i < stencils.size(); ++i) {
+            for (std::size_t k = 0; k < stencils[i].size(); ++k) {
+                index_.push_back(stencils[i][k].first);
+                weight_.push_back(stencils[i][k].second);
+            }
+            offset_.push_back(index_.size());
+        }
+        apply(control, mesh);
+    }
+
+    int getNumControlVertices() const { return numControlVertices_; }
+
+    int getNumVertices() const { return offset_.size() - 1; }
+
+    // Weights over all stencils, the cost of an apply
+    int getNumWeights() const { return weight_.size(); }
+
+    // refined[i] = sum of weight * control over stencil i. The stencils are
+    // split among the hardware threads.
+    void apply(const std::vector<Cvec3> &control,
+               std::vector<Cvec3> &refined) const {
+        if (int(control.size()) != numControlVertices_)
+            throw std::runtime_error("Wrong number of control vertices");
+        refined.resize(getNumVertices());
+        const int *offset = &offset_[0];
+        const int *index = index_.empty() ? 0 : &index_[0];
+        const double *weight = weight_.empty() ? 0 : &weight_[0];
+        const Cvec3 *c = control.empty() ? 0 : &control[0];
+        Cvec3 *r = refined.empty() ? 0 : &refined[0];
+        const auto rows = [=](const int begin, const int end) {
+            for (int i = begin; i < end; ++i) {
+                double x = 0, y = 0, z = 0;
+                for (int k = offset[i]; k < offset[i + 1]; ++k) {
+                    const Cvec3 &p = c[index[k]];
+                    x += weight[k] * p[0];
+                    y += weight[k] * p[1];
+                    z += weight[k] * p[2];
+                }
+                r[i] = Cvec3(x, y, z);
+            }
+        };
+        // Threads only pay off for the larger meshes
+        if (getNumWeights() < (1 << 16))
+            rows(0, getNumVertices());
+        else
+            parallelFor(getNumVertices(), rows);
+    }
+
+    // Sets the positions of the refined mesh made by the constructor
+    void apply(const std::vector<Cvec3> &control, Mesh &refined) const {
+        if (refined.getNumVertices() != getNumVertices())
+            throw std::runtime_error("Mesh does not match the stencils");
+        std::vector<Cvec3> p;
+        apply(control, p);
+        for (int i = 0; i < getNumVertices(); ++i) {
+            refined.getVertex(i).setPosition(p[i]);
+        }
+    }
+
+  private:
+    typedef std::pair<int, double> Entry; // control vertex, weight
+    typedef std::vector<Entry> Stencil;
+
+    // Sums of scaled stencils, dense over the control vertices but only
+    // visited where touched
+    struct Accumulator {
+        std::vector<double> weight;
+        std::vector<int> touched;
+
+        explicit Accumulator(const int n) : weight(n, 0) {}
+
+        void add(const Stencil &s, const double w) {
+            for (std::size_t k = 0; k < s.size(); ++k) {
+                if (weight[s[k].first] == 0)
+                    touched.push_back(s[k].first);
+                weight[s[k].first] += w * s[k].second;
+            }
+        }
+
+        void take(Stencil &s) {
+            s.clear();
+            s.reserve(touched.size());
+            for (std::size_t k = 0; k < touched.size(); ++k) {
+                // A weight that cancels to 0 may be listed twice; keep one
+                if (weight[touched[k]] != 0)
+                    s.push_back(Entry(touched[k], weight[touched[k]]));
+                weight[touched[k]] = 0;
+            }
+            touched.clear();
+        }
+    };
+
+    // The stencils of the next level's vertices, in the order subdivide__
+    // makes them: vertex, then edge, then face vertices
+    static void refine(Mesh &mesh, const std::vector<Stencil> &stencils,
+                       Accumulator &acc, std::vector<Stencil> &refined) {
+        const int nv = mesh.getNumVertices(), ne = mesh.getNumEdges(),
+                  nf = mesh.getNumFaces();
+        refined.resize(nv + ne + nf);
+        Stencil *faces = &refined[nv + ne];
+        for (int i = 0; i < nf; ++i) {
+            const Mesh::Face f = mesh.getFace(i);
+            const int n = f.getNumVertices();
+            for (int j = 0; j < n; ++j) {
+                acc.add(stencils[f.getVertex(j).getIndex()], 1.0 / n);
+            }
+            acc.take(faces[i]);
+        }
+        for (int i = 0; i < ne; ++i) {
+            const Mesh::Edge e = mesh.getEdge(i);
+            for (int j = 0; j < 2; ++j) {
+                acc.add(stencils[e.getVertex(j).getIndex()], 0.25);
+                acc.add(faces[e.getFace(j).f_], 0.25);
+            }
+            acc.take(refined[nv + i]);
+        }
+        for (int i = 0; i < nv; ++i) {
+            const Mesh::Vertex v = mesh.getVertex(i);
+            int n = 0;
+            Mesh::VertexIterator it(v.getIterator()), it0(it);
+            do {
+                ++n;
+            } while (++it != it0);
+            const double w = 1.0 / (n * n);
+            acc.add(stencils[i], (n - 2.0) / n);
+            do {
+                acc.add(stencils[it.getVertex().getIndex()], w);
+                acc.add(faces[it.getFace().f_], w);
+            } while (++it != it0);
+            acc.take(refined[i]);
+        }
+    }
+
+    int numControlVertices_;
+    std::vector<int> offset_; // stencil i is [offset_[i], offset_[i + 1])
+    std::vector<int> index_;  // control vertex of each weight
+    std::vector<double> weight_;
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "parallel.h"
+#include "texcompress.h"
+
+using namespace std;
+
+// The texels of one block, one channel after another so that the loops over
+// the 16 texels of a channel vectorize
+struct Block {
+    int c[3][16];
+};
+
+static size_t getBlockBytes(GLenum format) {
+    switch (format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+        return 8;
+    case GL_COMPRESSED_RG_RGTC2:
+        return 16;
+    default:;
+    }
+    throw invalid_argument("unsupported compressed texture format");
+}
+
+size_t getCompressedImageSize(GLenum format, int width, int height) {
+    return size_t((width + 3) / 4) * ((height + 3) / 4) *
+           getBlockBytes(format);
+}
+
+static void loadBlock(const PackedPixel *pixels, int width, int height,
+                      int bx, int by, Block &block) {
+    for (int y = 0; y < 4; ++y) {
+        const PackedPixel *row =
+            pixels + size_t(min(by * 4 + y, height - 1)) * width;
+        for (int x = 0; x < 4; ++x) {
+            const PackedPixel &p = row[min(bx * 4 + x, width - 1)];
+            block.c[0][y * 4 + x] = p.r;
+            block.c[1][y * 4 + x] = p.g;
+            block.c[2][y * 4 + x] = p.b;
+        }
+    }
+}
+
+static int packRgb565(const int rgb[3]) {
+    const int r = (rgb[0] * 31 + 127) / 255, g = (rgb[1] * 63 + 127) / 255,
+              b = (rgb[2] * 31 + 127) / 255;
+    return (r << 11) | (g << 5) | b;
+}
+
+static void unpackRgb565(int c, int rgb[3]) {
+    const int r = c >> 11, g = (c >> 5) & 63, b = c & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+// BC1 in four color mode. The endpoints are the extremes of the texels along
+// their principal axis, found by power iteration on the covariance matrix.
+static void encodeBc1Block(const Block &block, unsigned char *out) {
+    float mean[3];
+    for (int c = 0; c < 3; ++c) {
+        int sum = 0;
+        for (int i = 0; i < 16; ++i)
+            sum += block.c[c][i];
+        mean[c] = sum / 16.f;
+    }
+
+    float cov[6] = {0, 0, 0, 0, 0, 0}; // rr rg rb gg gb bb
+    for (int i = 0; i < 16; ++i) {
+        const float r = block.c[0][i] - mean[0], g = block.c[1][i] - mean[1],
+                    b = block.c[2][i] - mean[2];
+        cov[0] += r * r;
+        cov[1] += r * g;
+        cov[2] += r * b;
+        cov[3] += g * g;
+        cov[4] += g * b;
+        cov[5] += b * b;
+    }
+
+    float axis[3] = {1, 1, 1};
+    for (int iter = 0; iter < 8; ++iter) {
+        const float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                    y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                    z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+        const float m = max(fabsf(x), max(fabsf(y), fabsf(z)));
+        if (m == 0)
+            break; // all texels equal the mean
+        axis[0] = x / m;
+        axis[1] = y / m;
+        axis[2] = z / m;
+    }
+
+    float lo = 0, hi = 0;
+    for (int i = 0; i < 16; ++i) {
+        const float t = (block.c[0][i] - mean[0]) * axis[0] +
+                        (block.c[1][i] - mean[1]) * axis[1] +
+                        (block.c[2][i] - mean[2]) * axis[2];
+        lo = min(lo, t);
+        hi = max(hi, t);
+    }
+    const float len2 =
+        axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    int e0[3], e1[3];
+    for (int c = 0; c < 3; ++c) {
+        const float d = len2 > 0 ? axis[c] / len2 : 0;
+        e0[c] = min(255, max(0, int(mean[c] + d * hi + 0.5f)));
+        e1[c] = min(255, max(0, int(mean[c] + d * lo + 0.5f)));
+    }
+
+    int c0 = packRgb565(e0), c1 = packRgb565(e1);
+    if (c0 < c1)
+        swap(c0, c1);
+
+    unsigned indices = 0;
+    if (c0 != c1) {
+        int palette[4][3];
+        unpackRgb565(c0, palette[0]);
+        unpackRgb565(c1, palette[1]);
+        for (int c = 0; c < 3; ++c) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        for (int i = 0; i < 16; ++i) {
+            int best = 0, bestDist = 1 << 30;
+            for (int p = 0; p < 4; ++p) {
+                const int dr = block.c[0][i] - palette[p][0],
+                          dg = block.c[1][i] - palette[p][1],
+                          db = block.c[2][i] - palette[p][2];
+                const int dist = dr * dr + dg * dg + db * db;
+                if (dist < bestDist) {
+                    bestDist = dist;
+                    best = p;
+                }
+            }
+            indices |= unsigned(best) << (2 * i);
+        }
+    } // else a flat block: all texels take c0
+
+    out[0] = c0 & 255;
+    out[1] = c0 >> 8;
+    out[2] = c1 & 255;
+    out[3] = c1 >> 8;
+    for (int i = 0; i < 4; ++i)
+        out[4 + i] = (indices >> (8 * i)) & 255;
+}
+
+// One channel of RGTC, in eight value mode: the endpoints are the channel's
+// minimum and maximum, with six values evenly spaced in between
+static void encodeRgtcChannel(const int *values, unsigned char *out) {
+    int lo = 255, hi = 0;
+    for (int i = 0; i < 16; ++i) {
+        lo = min(lo, values[i]);
+        hi = max(hi, values[i]);
+    }
+
+    unsigned long long indices = 0;
+    if (hi > lo) {
+        const int range = hi - lo;
+        for (int i = 0; i < 16; ++i) {
+            // Steps from lo towards hi, 0 to 7
+            const int step = ((values[i] - lo) * 14 + range) / (2 * range);
+            // Index 0 is hi, 1 is lo, and 2 to 7 go from hi to lo
+            const int index = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+            indices |= (unsigned long long)index << (3 * i);
+        }
+    } // else a flat block: all texels take index 0
+
+    out[0] = hi;
+    out[1] = lo;
+    for (int i = 0; i < 6; ++i)
+        out[2 + i] = (indices >> (8 * i)) & 255;
+}
+
+void compressImage(GLenum format, const PackedPixel *pixels, int width,
+                   int height, unsigned char *dst) {
+    const size_t blockBytes = getBlockBytes(format);
+    const bool rgtc = format == GL_COMPRESSED_RG_RGTC2;
+    const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+
+    parallelFor(blocksY, [&](int begin, int end) {
+        Block block;
+        for (int by = begin; by < end; ++by) {
+            unsigned char *out = dst + size_t(by) * blocksX * blockBytes;
+            for (int bx = 0; bx < blocksX; ++bx, out += blockBytes) {
+                loadBlock(pixels, width, height, bx, by, block);
+                if (rgtc) {
+                    encodeRgtcChannel(block.c[0], out);
+                    encodeRgtcChannel(block.c[1], out + 8);
+                } else {
+                    encodeBc1Block(block, out);
+                }
+            }
+        }
+    });
+}
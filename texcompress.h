@@ -0,0 +1,30 @@
+#ifndef TEXCOMPRESS_H
+#define TEXCOMPRESS_H
+
+#include <cstddef>
+
+#include "glsupport.h"
+#include "ppm.h"
+
+// CPU encoders for block compressed formats that GL samples directly, so that
+// textures take a fraction of the memory on the GPU. Supported formats:
+//
+// - GL_COMPRESSED_RGB_S3TC_DXT1_EXT and GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+//   (BC1), 4 bits per texel, for color maps. Both are encoded the same way.
+// - GL_COMPRESSED_RG_RGTC2 (BC5), 8 bits per texel, keeping the red and green
+//   channels at higher precision, for tangent space normal maps. The shader
+//   rebuilds blue as sqrt(1 - x^2 - y^2).
+//
+// Images are RGB8, bottom row first with rows tightly packed, as uploaded.
+// Blocks are 4 x 4 texels; partial blocks at the right and top edges repeat
+// the last column and row.
+
+// Bytes of a width x height image in `format'
+size_t getCompressedImageSize(GLenum format, int width, int height);
+
+// Encodes the image into `dst', which must hold getCompressedImageSize bytes.
+// Rows of blocks are encoded on all hardware threads.
+void compressImage(GLenum format, const PackedPixel *pixels, int width,
+                   int height, unsigned char *dst);
+
+#endif
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "glstate.h"
+#include "texstream.h"
+#include "texture.h"
+
+using namespace std;
+
+TextureStreamer &TextureStreamer::getSingleton() {
+    static TextureStreamer ts;
+    return ts;
+}
+
+TextureStreamer::TextureStreamer()
+    : pending_(0), stopping_(false), bytesPerFrame_(4 << 20), frames_(0) {}
+
+TextureStreamer::~TextureStreamer() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (size_t i = 0; i < workers_.size(); ++i)
+        workers_[i].join();
+}
+
+void TextureStreamer::submit(const shared_ptr<StoredTexture> &tex,
+                             const Decoder &decode) {
+    JobPtr job(new Job());
+    job->tex = tex;
+    job->decode = decode;
+    job->nextLevel = job->nextLayer = 0;
+    job->allocated = false;
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        // Started on first use. The GL thread keeps a core to itself.
+        if (workers_.empty()) {
+            const int n = max(1, int(thread::hardware_concurrency()) - 1);
+            for (int i = 0; i < n; ++i)
+                workers_.push_back(thread(&TextureStreamer::work, this));
+        }
+        queued_.push_back(job);
+        ++pending_;
+    }
+    wake_.notify_one();
+}
+
+void TextureStreamer::work() {
+    for (;;) {
+        JobPtr job;
+        {
+            unique_lock<mutex> lock(mutex_);
+            while (queued_.empty() && !stopping_)
+                wake_.wait(lock);
+            if (stopping_)
+                return;
+            job = queued_.front();
+            queued_.pop_front();
+        }
+
+        // Skip textures dropped while waiting
+        if (!job->tex.expired()) {
+            try {
+                job->decode(job->image);
+            } catch (const exception &e) {
+                job->error = e.what();
+            }
+        }
+        job->decode = Decoder(); // release what it captured
+
+        lock_guard<mutex> lock(mutex_);
+        decoded_.push_back(job);
+    }
+}
+
+int TextureStreamer::getPending() const {
+    lock_guard<mutex> lock(mutex_);
+    return pending_;
+}
+
+void TextureStreamer::update() {
+    int finished = 0;
+    {
+        lock_guard<mutex> lock(mutex_);
+        uploading_.insert(uploading_.end(), decoded_.begin(), decoded_.end());
+        decoded_.clear();
+    }
+    if (uploading_.empty())
+        return;
+    ++frames_;
+
+    size_t budget = bytesPerFrame_;
+    bool force = true; // always make some progress
+    for (size_t i = 0; i < uploading_.size();) {
+        Job &job = *uploading_[i];
+        const shared_ptr<StoredTexture> tex = job.tex.lock();
+        bool done = true;
+        if (tex && !job.error.empty()) {
+            cerr << "Cannot stream texture: " << job.error << endl;
+        } else if (tex && budget > 0) {
+            done = upload(job, *tex, budget, force);
+            force = false;
+        } else if (tex) {
+            done = false;
+        }
+
+        if (done) {
+            uploading_.erase(uploading_.begin() + i);
+            ++finished;
+        } else {
+            ++i;
+        }
+    }
+
+    bool allIn;
+    {
+        lock_guard<mutex> lock(mutex_);
+        pending_ -= finished;
+        allIn = finished && pending_ == 0;
+    }
+    if (allIn) {
+        cerr << "Textures streamed in " << frames_ << " frames" << endl;
+        frames_ = 0;
+        // Now with the storage of the streamed textures
+        TextureLibrary::getSingleton().printStats(cerr);
+    }
+}
+
+bool TextureStreamer::upload(Job &job, StoredTexture &tex, size_t &budget,
+                             bool force) {
+    DecodedTexture &image = job.image;
+    const int numLevels = image.levels.size();
+
+    if (!job.allocated) {
+        // The placeholder may be smaller, or immutable, so the texels go to a
+        // new texture object. It has no texels until the smallest level is
+        // in, which is forced below, so it is never drawn empty.
+        GlState::get().forgetTexture(*tex.tex_);
+        tex.tex_.reset(new GlTexture());
+        tex.allocate(image.width, image.height, image.layers, tex.srgb_);
+        tex.finishUpload(false);
+        job.allocated = true;
+        job.nextLevel = numLevels - 1;
+        job.nextLayer = 0;
+        force = true;
+    }
+
+    while (job.nextLevel >= 0) {
+        const int level = job.nextLevel, layer = job.nextLayer;
+        const size_t layerPixels = image.levels[level].size() / image.layers;
+        const size_t bytes = layerPixels * sizeof(PackedPixel);
+        if (bytes > budget && !force)
+            return false;
+        budget -= min(budget, bytes);
+        force = false;
+
+        const PackedPixel *src = &image.levels[level][layerPixels * layer];
+        tex.upload(level, layer, 1, [src, bytes](PackedPixel *dst) {
+            memcpy(dst, src, bytes);
+        });
+
+        if (++job.nextLayer == image.layers) {
+            tex.setBaseLevel(level);
+            vector<PackedPixel>().swap(image.levels[level]);
+            job.nextLayer = 0;
+            --job.nextLevel;
+        }
+    }
+    return true;
+}
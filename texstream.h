@@ -0,0 +1,96 @@
+#ifndef TEXSTREAM_H
+#define TEXSTREAM_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "glsupport.h"
+#include "ppm.h"
+
+class StoredTexture;
+
+// The texels of a texture decoded off the GL thread: all mip levels, level 0
+// first, each holding the layers one after another, bottom row first with
+// rows tightly packed
+struct DecodedTexture {
+    int width, height, layers;
+    std::vector<std::vector<PackedPixel>> levels;
+};
+
+// Fills in textures in the background, so that the window can come up before
+// the images are loaded. Files are decoded on worker threads; the GL thread
+// then uploads a bounded number of bytes per frame through pixel unpack
+// buffers, one layer of one mip level at a time, coarsest level first. Each
+// texture's GL_TEXTURE_BASE_LEVEL follows the finest complete level, so it
+// sharpens as the levels arrive.
+//
+// Until its smallest level is uploaded, a texture shows whatever it was made
+// with (see ImageTexture::stream).
+class TextureStreamer : Noncopyable {
+  public:
+    typedef std::function<void(DecodedTexture &)> Decoder;
+
+    static TextureStreamer &getSingleton();
+
+    ~TextureStreamer();
+
+    // Runs `decode' on a worker thread, and uploads its result into `tex'
+    // during the update() calls that follow. Nothing happens if `tex' is
+    // destroyed before that. Exceptions thrown by `decode' are reported on
+    // cerr, and leave `tex' as it is.
+    void submit(const std::shared_ptr<StoredTexture> &tex,
+                const Decoder &decode);
+
+    // Uploads decoded texels, up to the byte budget. Call once per frame on
+    // the GL thread, before drawing.
+    void update();
+
+    // 4 MB by default. A single layer of a level larger than that still goes
+    // up whole, in a frame of its own.
+    void setBytesPerFrame(size_t bytes) { bytesPerFrame_ = bytes; }
+
+    // Number of textures not yet completely uploaded
+    int getPending() const;
+
+  private:
+    struct Job {
+        std::weak_ptr<StoredTexture> tex;
+        Decoder decode;
+        DecodedTexture image;
+        std::string error;
+        int nextLevel, nextLayer; // next part to upload; level -1 when done
+        bool allocated;
+    };
+    typedef std::shared_ptr<Job> JobPtr;
+
+    std::vector<std::thread> workers_;
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<JobPtr> queued_;  // waiting for a worker
+    std::deque<JobPtr> decoded_; // waiting for update()
+    int pending_;
+    bool stopping_;
+
+    // Used by the GL thread only
+    std::vector<JobPtr> uploading_;
+    size_t bytesPerFrame_;
+    int frames_; // update() calls that had something to upload
+
+    TextureStreamer();
+
+    void work();
+
+    // Uploads parts of `job' into `tex' within `budget', or at least one part
+    // if `force'. Returns whether all of it is uploaded.
+    static bool upload(Job &job, StoredTexture &tex, size_t &budget,
+                       bool force);
+};
+
+#endif
@@ -1,33 +1,739 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
 #include <vector>
 
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
 #include "asstcommon.h"
 #include "glsupport.h"
+#include "mipfile.h"
 #include "ppm.h"
+#include "texcompress.h"
+#include "texstream.h"
 #include "texture.h"
 
 
 using namespace std;
 
-ImageTexture::ImageTexture(const char *ppmFileName, bool srgb) {
-    int width, height;
-    vector<PackedPixel> pixData;
-    ppmRead(ppmFileName, width, height, pixData);
+// Whether immutable storage (glTexStorage*) is available
+static bool hasTextureStorage() {
+    static const bool has =
+        hasGlVersion(4, 2) || hasGlExtension("GL_ARB_texture_storage");
+    return has;
+}
+
+static bool hasS3tc() {
+    static const bool has = hasGlExtension("GL_EXT_texture_compression_s3tc");
+    return has;
+}
+
+// Compressed mip chains are kept in texcache/, one file per texture, named
+// after a hash of the format and the level 0 pixels, so editing an image just
+// misses the cache. CS175_NO_TEXTURE_CACHE disables it.
+class CompressedTextureCache {
+    static const char *dir() { return "texcache"; }
+
+    // Bump when the encoders, the mip filter or the file layout change
+    static const uint32_t VERSION = 1;
+
+    struct Header {
+        uint32_t version, format, width, height, layers, levels;
+    };
+
+    // 64 bit FNV-1a
+    static uint64_t hash(uint64_t h, const void *data, size_t len) {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < len; ++i) {
+            h ^= p[i];
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+    static Header makeHeader(GLenum format, int width, int height,
+                             int layers) {
+        Header header = {VERSION, format, uint32_t(width), uint32_t(height),
+                         uint32_t(layers),
+                         uint32_t(getMipLevelCount(width, height))};
+        return header;
+    }
+
+  public:
+    // Where the texture compressed from the given pixels is cached, or empty
+    // if caching is disabled
+    static string getPath(GLenum format, int width, int height, int layers,
+                          const vector<PackedPixel> &pixels) {
+        if (getenv("CS175_NO_TEXTURE_CACHE") != NULL)
+            return string();
+
+        const Header header = makeHeader(format, width, height, layers);
+        uint64_t h = 14695981039346656037ull;
+        h = hash(h, &header, sizeof(header));
+        h = hash(h, &pixels[0], pixels.size() * sizeof(PackedPixel));
+
+        ostringstream s;
+        s << dir() << "/" << hex << setw(16) << setfill('0') << h << ".bin";
+        return s.str();
+    }
+
+    // Fills `levels' with each level of all layers, and returns true on a hit
+    static bool load(const string &path, GLenum format, int width, int height,
+                     int layers, vector<vector<unsigned char>> &levels) {
+        if (path.empty())
+            return false;
+        ifstream ifs(path.c_str(), ios::binary);
+        if (!ifs)
+            return false;
+
+        const Header expected = makeHeader(format, width, height, layers);
+        Header header;
+        ifs.read(reinterpret_cast<char *>(&header), sizeof(header));
+        if (!ifs || memcmp(&header, &expected, sizeof(header)) != 0)
+            return false;
+
+        levels.resize(header.levels);
+        for (int i = 0; i < int(header.levels); ++i) {
+            levels[i].resize(getCompressedImageSize(
+                                 format, getMipLevelSize(width, i),
+                                 getMipLevelSize(height, i)) *
+                             layers);
+            ifs.read(reinterpret_cast<char *>(&levels[i][0]),
+                     levels[i].size());
+        }
+        if (!ifs) {
+            cerr << "Ignoring truncated cached texture " << path << endl;
+            return false;
+        }
+        return true;
+    }
+
+    static void save(const string &path, GLenum format, int width, int height,
+                     int layers, const vector<vector<unsigned char>> &levels) {
+        if (path.empty())
+            return;
+
+#ifdef _WIN32
+        _mkdir(dir());
+#else
+        mkdir(dir(), 0755);
+#endif
+        {
+            const Header header = makeHeader(format, width, height, layers);
+            ofstream ofs(path.c_str(), ios::binary);
+            ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            for (size_t i = 0; i < levels.size(); ++i)
+                ofs.write(reinterpret_cast<const char *>(&levels[i][0]),
+                          levels[i].size());
+            if (ofs)
+                return;
+        }
+        remove(path.c_str()); // do not leave a truncated file behind
+    }
+};
+
+// Sampling parameters shared by all image textures
+template <typename SetParameter>
+static void setSamplingParameters(SetParameter set) {
+    set(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    set(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    set(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    set(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+struct TexParameter {
+    GLenum target;
+    void operator()(GLenum pname, GLint param) const {
+        glTexParameteri(target, pname, param);
+    }
+};
+
+StoredTexture::~StoredTexture() {
+    if (tex_.use_count() == 1)
+        GlState::get().forgetTexture(*tex_);
+}
+
+bool StoredTexture::canCompress(bool srgb) {
+    // RGTC is core since GL 3.0
+    return !srgb || hasS3tc();
+}
+
+void StoredTexture::allocate(int width, int height, int layers, bool srgb) {
+    width_ = width;
+    height_ = height;
+    srgb_ = srgb;
+    layers_ = layers;
+    levels_ = getMipLevelCount(width, height);
+    storageBytes_ = 0;
+    for (int level = 0; level < levels_; ++level) {
+        storageBytes_ += size_t(getMipLevelSize(width, level)) *
+                         getMipLevelSize(height, level) * layers * 3;
+    }
+    uncompressedBytes_ = storageBytes_;
+
+    bindForEdit();
 
-    glBindTexture(GL_TEXTURE_2D, tex);
+    const bool array = target_ == GL_TEXTURE_2D_ARRAY;
+    if (hasTextureStorage()) {
+        immutable_ = true;
+        const GLenum format = srgb ? GL_SRGB8 : GL_RGB8;
+        if (array)
+            glTexStorage3D(target_, levels_, format, width, height, layers);
+        else
+            glTexStorage2D(target_, levels_, format, width, height);
+    } else {
+        // Every level has to be specified for the texture to be complete
+        const GLenum format = srgb ? GL_SRGB : GL_RGB;
+        for (int level = 0; level < levels_; ++level) {
+            const int w = getMipLevelSize(width, level),
+                      h = getMipLevelSize(height, level);
+            if (array)
+                glTexImage3D(target_, level, format, w, h, layers, 0, GL_RGB,
+                             GL_UNSIGNED_BYTE, NULL);
+            else
+                glTexImage2D(target_, level, format, w, h, 0, GL_RGB,
+                             GL_UNSIGNED_BYTE, NULL);
+        }
+    }
+}
+
+void StoredTexture::upload(int level, int firstLayer, int numLayers,
+                           const void *pixels) {
+    bindForEdit();
+    const int w = getMipLevelSize(width_, level),
+              h = getMipLevelSize(height_, level);
+    if (target_ == GL_TEXTURE_2D_ARRAY)
+        glTexSubImage3D(target_, level, 0, 0, firstLayer, w, h, numLayers,
+                        GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    else
+        glTexSubImage2D(target_, level, 0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE,
+                        pixels);
+}
+
+// Pixel unpack buffers that uploads stage their pixels in, used in turn
+struct StagingBuffer {
+    GlBufferObject pbo;
+    size_t capacity;
+    GLsync fence; // after the last upload from it, NULL when idle
+
+    StagingBuffer() : capacity(0), fence(NULL) {}
+};
+
+static const int NUM_STAGING_BUFFERS = 4;
+
+// Buffers grown past this by a large upload are shrunk back after it. Streamed
+// uploads are one layer of one level, and stay below it.
+static const size_t MAX_STAGING_BYTES = 4 << 20;
+
+static StagingBuffer &nextStagingBuffer() {
+    // Never destroyed, as the GL context may be gone by static destruction
+    static StagingBuffer *ring = new StagingBuffer[NUM_STAGING_BUFFERS];
+    static int next = 0;
+    StagingBuffer &buffer = ring[next];
+    next = (next + 1) % NUM_STAGING_BUFFERS;
+    return buffer;
+}
+
+void StoredTexture::upload(int level, int firstLayer, int numLayers,
+                           const PixelWriter &writePixels) {
+    // Stage the pixels in a pixel unpack buffer, written by writePixels in
+    // place. The driver can then copy them to the texture asynchronously.
+    const size_t bytes = size_t(getMipLevelSize(width_, level)) *
+                         getMipLevelSize(height_, level) * numLayers *
+                         sizeof(PackedPixel);
+    StagingBuffer &staging = nextStagingBuffer();
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.pbo);
+    if (staging.fence) {
+        // Uploads from the other buffers went in since, so the copy out of
+        // this one is normally done
+        glClientWaitSync(staging.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                         GL_TIMEOUT_IGNORED);
+        glDeleteSync(staging.fence);
+        staging.fence = NULL;
+    }
+    if (bytes > staging.capacity) {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+        staging.capacity = bytes;
+    }
+    // The fence above already synchronized
+    void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                    GL_MAP_WRITE_BIT |
+                                        GL_MAP_INVALIDATE_RANGE_BIT |
+                                        GL_MAP_UNSYNCHRONIZED_BIT);
+
+    if (mapped) {
+        writePixels(static_cast<PackedPixel *>(mapped));
+        if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+            const void *offset = NULL; // into the buffer
+            upload(level, firstLayer, numLayers, offset);
+            if (staging.capacity > MAX_STAGING_BYTES) {
+                // The GL keeps the old storage until the copy is done
+                glBufferData(GL_PIXEL_UNPACK_BUFFER, 0, NULL, GL_STREAM_DRAW);
+                staging.capacity = 0;
+            } else {
+                staging.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return;
+        }
+        // The contents got lost (rare); upload them from memory instead
+        staging.capacity = 0; // respecify the storage next time
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    vector<PackedPixel> pixels(bytes / sizeof(PackedPixel));
+    writePixels(&pixels[0]);
+    upload(level, firstLayer, numLayers, &pixels[0]);
+}
 
-    glTexImage2D(GL_TEXTURE_2D, 0,
+void StoredTexture::setBaseLevel(int level) {
+    bindForEdit();
+    glTexParameteri(target_, GL_TEXTURE_BASE_LEVEL, level);
+}
+
+void StoredTexture::makePlaceholder(bool srgb) {
+    static const PackedPixel gray = {128, 128, 128}, flat = {128, 128, 255};
+    allocate(1, 1, 1, srgb);
+    upload(0, 0, 1, srgb ? &gray : &flat);
+    finishUpload(false);
+}
 
-                 (!srgb) ? GL_RGB : GL_SRGB, width, height,
-                 0, GL_RGB, GL_UNSIGNED_BYTE, &pixData[0]);
+void StoredTexture::uploadMipFile(const MipFile &mips, int layer) {
+    assert(mips.getWidth() == width_ && mips.getHeight() == height_);
+    for (int level = 0; level < levels_; ++level)
+        upload(level, layer, 1, mips.getLevel(level));
+}
 
+// makeMipChain for each of `layers' layers, with each level holding all layers
+// one after another
+static void makeLayeredMipChain(int width, int height, int layers, bool srgb,
+                                vector<vector<PackedPixel>> &levels) {
+    if (layers == 1) {
+        makeMipChain(width, height, srgb, levels);
+        return;
+    }
+
+    const int numLevels = getMipLevelCount(width, height);
+    levels.resize(numLevels);
+    for (int i = 1; i < numLevels; ++i) {
+        levels[i].resize(size_t(getMipLevelSize(width, i)) *
+                         getMipLevelSize(height, i) * layers);
+    }
+
+    const size_t layerPixels = size_t(width) * height;
+    for (int layer = 0; layer < layers; ++layer) {
+        vector<vector<PackedPixel>> mips(
+            1, vector<PackedPixel>(levels[0].begin() + layerPixels * layer,
+                                   levels[0].begin() +
+                                       layerPixels * (layer + 1)));
+        makeMipChain(width, height, srgb, mips);
+        for (int i = 1; i < numLevels; ++i)
+            copy(mips[i].begin(), mips[i].end(),
+                 levels[i].begin() + mips[i].size() * layer);
+    }
+}
 
-        glGenerateMipmap(GL_TEXTURE_2D);
+void StoredTexture::compressAndUpload(int width, int height, int layers,
+                                      bool srgb,
+                                      const vector<PackedPixel> &pixels) {
+    const GLenum format =
+        srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RG_RGTC2;
+    const int numLevels = getMipLevelCount(width, height);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                    GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // levels[i] holds level i of all layers, one after another
+    vector<vector<unsigned char>> levels;
+    const string cachePath = CompressedTextureCache::getPath(
+        format, width, height, layers, pixels);
+    if (!CompressedTextureCache::load(cachePath, format, width, height, layers,
+                                      levels)) {
+        vector<vector<PackedPixel>> mips(1, pixels);
+        makeLayeredMipChain(width, height, layers, srgb, mips);
+
+        levels.resize(numLevels);
+        for (int i = 0; i < numLevels; ++i) {
+            const int w = getMipLevelSize(width, i),
+                      h = getMipLevelSize(height, i);
+            const size_t layerBytes = getCompressedImageSize(format, w, h);
+            levels[i].resize(layerBytes * layers);
+            for (int layer = 0; layer < layers; ++layer) {
+                compressImage(format, &mips[i][size_t(w) * h * layer], w, h,
+                              &levels[i][layerBytes * layer]);
+            }
+        }
+        CompressedTextureCache::save(cachePath, format, width, height, layers,
+                                     levels);
+    }
+
+    width_ = width;
+    height_ = height;
+    srgb_ = srgb;
+    layers_ = layers;
+    levels_ = numLevels;
+    compressedFormat_ = format;
+    storageBytes_ = uncompressedBytes_ = 0;
+    for (int i = 0; i < numLevels; ++i) {
+        storageBytes_ += levels[i].size();
+        uncompressedBytes_ += size_t(getMipLevelSize(width, i)) *
+                              getMipLevelSize(height, i) * layers * 3;
+    }
+
+    bindForEdit();
+
+    const bool array = target_ == GL_TEXTURE_2D_ARRAY;
+    immutable_ = hasTextureStorage();
+    if (immutable_) {
+        if (array)
+            glTexStorage3D(target_, levels_, format, width, height, layers);
+        else
+            glTexStorage2D(target_, levels_, format, width, height);
+    }
+    for (int i = 0; i < numLevels; ++i) {
+        const int w = getMipLevelSize(width, i), h = getMipLevelSize(height, i);
+        const GLsizei size = levels[i].size();
+        if (immutable_ && array)
+            glCompressedTexSubImage3D(target_, i, 0, 0, 0, w, h, layers,
+                                      format, size, &levels[i][0]);
+        else if (immutable_)
+            glCompressedTexSubImage2D(target_, i, 0, 0, w, h, format, size,
+                                      &levels[i][0]);
+        else if (array)
+            glCompressedTexImage3D(target_, i, format, w, h, layers, 0, size,
+                                   &levels[i][0]);
+        else
+            glCompressedTexImage2D(target_, i, format, w, h, 0, size,
+                                   &levels[i][0]);
+    }
+
+    finishUpload(false);
+}
+
+void StoredTexture::finishUpload(bool generateMipmaps) {
+    bindForEdit();
+    if (generateMipmaps)
+        glGenerateMipmap(target_);
+
+    TexParameter set = {target_};
+    setSamplingParameters(set);
 
     checkGlErrors();
 }
+
+// Returns the mip chain of `ppmFileName' converted for the color space, or
+// NULL if there is none. Given a width and height, only returns one of that
+// size: converted at it (mipconvert -size), or of an image that has it.
+static unique_ptr<MipFile> openMipFile(const string &ppmFileName, bool srgb,
+                                       int width = 0, int height = 0) {
+    const bool sized = width > 0 && height > 0;
+    string mipFileName = getMipFileName(ppmFileName, srgb, width, height);
+    if (sized && !ifstream(mipFileName.c_str()))
+        mipFileName = getMipFileName(ppmFileName, srgb);
+    if (!ifstream(mipFileName.c_str()))
+        return unique_ptr<MipFile>();
+
+    unique_ptr<MipFile> mips(new MipFile(mipFileName.c_str()));
+    if (mips->isSrgbFiltered() != srgb ||
+        (sized && (mips->getWidth() != width || mips->getHeight() != height)))
+        return unique_ptr<MipFile>();
+    return mips;
+}
+
+// Opens the converted mip chains of the layers, as openMipFile. Returns false
+// and leaves `mips' empty unless all layers have one, of the same size.
+static bool openLayerMipFiles(const vector<string> &ppmFileNames, bool srgb,
+                              int width, int height,
+                              vector<unique_ptr<MipFile>> &mips) {
+    mips.resize(ppmFileNames.size());
+    for (size_t i = 0; i < mips.size(); ++i) {
+        mips[i] = openMipFile(ppmFileNames[i], srgb, width, height);
+        if (!mips[i] || mips[i]->getWidth() != mips[0]->getWidth() ||
+            mips[i]->getHeight() != mips[0]->getHeight()) {
+            mips.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+ImageTexture::ImageTexture(const char *ppmFileName, bool srgb, bool compress)
+    : StoredTexture(GL_TEXTURE_2D, GL_SAMPLER_2D) {
+    if (compress && canCompress(srgb)) {
+        const PpmImage image(ppmFileName);
+        vector<PackedPixel> pixels(size_t(image.getWidth()) *
+                                   image.getHeight());
+        image.copyTo(&pixels[0]);
+        compressAndUpload(image.getWidth(), image.getHeight(), 1, srgb,
+                          pixels);
+        return;
+    }
+
+    const unique_ptr<MipFile> mips = openMipFile(ppmFileName, srgb);
+    if (mips) {
+        allocate(mips->getWidth(), mips->getHeight(), 1, srgb);
+        uploadMipFile(*mips, 0);
+        finishUpload(false);
+        return;
+    }
+
+    const PpmImage image(ppmFileName);
+    allocate(image.getWidth(), image.getHeight(), 1, srgb);
+    upload(0, 0, 1, [&image](PackedPixel *dst) { image.copyTo(dst); });
+    finishUpload(true);
+}
+
+// Reads the converted mip chain if there is one, otherwise decodes the image
+// and makes the chain
+static void decodeImage(const string &ppmFileName, bool srgb,
+                        DecodedTexture &out) {
+    out.layers = 1;
+    const unique_ptr<MipFile> mips = openMipFile(ppmFileName, srgb);
+    if (mips) {
+        out.width = mips->getWidth();
+        out.height = mips->getHeight();
+        out.levels.resize(mips->getNumLevels());
+        for (int i = 0; i < mips->getNumLevels(); ++i) {
+            const PackedPixel *level = mips->getLevel(i);
+            out.levels[i].assign(level,
+                                 level + size_t(getMipLevelSize(out.width, i)) *
+                                             getMipLevelSize(out.height, i));
+        }
+        return;
+    }
+
+    const PpmImage image(ppmFileName.c_str());
+    out.width = image.getWidth();
+    out.height = image.getHeight();
+    out.levels.assign(1, vector<PackedPixel>(size_t(out.width) * out.height));
+    image.copyTo(&out.levels[0][0]);
+    makeMipChain(out.width, out.height, srgb, out.levels);
+}
+
+shared_ptr<ImageTexture> ImageTexture::stream(const string &ppmFileName,
+                                              bool srgb) {
+    shared_ptr<ImageTexture> tex(new ImageTexture());
+    tex->makePlaceholder(srgb);
+    TextureStreamer::getSingleton().submit(
+        tex, [=](DecodedTexture &out) { decodeImage(ppmFileName, srgb, out); });
+    return tex;
+}
+
+// Maps the images to be stored as layers. If `width' or `height' is 0, sets
+// both to the size of the largest image, so that the layers keep its aspect
+// ratio.
+static vector<unique_ptr<PpmImage>>
+openLayers(const vector<string> &ppmFileNames, int &width, int &height) {
+    vector<unique_ptr<PpmImage>> images(ppmFileNames.size());
+    const bool pickSize = width == 0 || height == 0;
+    size_t maxPixels = 0;
+    for (size_t i = 0; i < images.size(); ++i) {
+        images[i].reset(new PpmImage(ppmFileNames[i].c_str()));
+        const size_t pixels =
+            size_t(images[i]->getWidth()) * images[i]->getHeight();
+        if (pickSize && pixels > maxPixels) {
+            maxPixels = pixels;
+            width = images[i]->getWidth();
+            height = images[i]->getHeight();
+        }
+    }
+    return images;
+}
+
+// Writes the images as width x height layers, resampling those of other sizes
+static void readLayers(const vector<unique_ptr<PpmImage>> &images, int width,
+                       int height, PackedPixel *dst) {
+    for (size_t i = 0; i < images.size(); ++i) {
+        const PpmImage &image = *images[i];
+        PackedPixel *layer = dst + size_t(width) * height * i;
+        if (image.getWidth() == width && image.getHeight() == height)
+            image.copyTo(layer);
+        else
+            image.resampleTo(width, height, layer);
+    }
+}
+
+ImageTextureArray::ImageTextureArray(const vector<string> &ppmFileNames,
+                                     bool srgb, int width, int height,
+                                     bool compress)
+    : StoredTexture(GL_TEXTURE_2D_ARRAY, GL_SAMPLER_2D_ARRAY) {
+    const int numLayers = ppmFileNames.size();
+    if (numLayers == 0)
+        throw runtime_error("ImageTextureArray: no images given");
+    compress = compress && canCompress(srgb);
+
+    // Compression makes its own mip chain from level 0
+    vector<unique_ptr<MipFile>> mips;
+    if (!compress &&
+        openLayerMipFiles(ppmFileNames, srgb, width, height, mips)) {
+        allocate(mips[0]->getWidth(), mips[0]->getHeight(), numLayers, srgb);
+        for (int i = 0; i < numLayers; ++i)
+            uploadMipFile(*mips[i], i);
+        finishUpload(false);
+        return;
+    }
+
+    // Only maps the files; the pixels are read once, into the upload buffer
+    const vector<unique_ptr<PpmImage>> images =
+        openLayers(ppmFileNames, width, height);
+    const PixelWriter writeLayers = [&](PackedPixel *dst) {
+        readLayers(images, width, height, dst);
+    };
+
+    if (compress) {
+        vector<PackedPixel> pixels(size_t(width) * height * numLayers);
+        writeLayers(&pixels[0]);
+        compressAndUpload(width, height, numLayers, srgb, pixels);
+        return;
+    }
+
+    allocate(width, height, numLayers, srgb);
+    upload(0, 0, numLayers, writeLayers);
+    finishUpload(true);
+}
+
+// Reads the converted mip chains if all layers have one, otherwise decodes
+// level 0 of the layers, then makes their mip chains. Streamed textures cannot
+// use glGenerateMipmap, since their finer levels go up last.
+static void decodeImageArray(const vector<string> &ppmFileNames, bool srgb,
+                             int width, int height, DecodedTexture &out) {
+    vector<unique_ptr<MipFile>> mips;
+    if (openLayerMipFiles(ppmFileNames, srgb, width, height, mips)) {
+        out.width = mips[0]->getWidth();
+        out.height = mips[0]->getHeight();
+        out.layers = mips.size();
+        out.levels.resize(mips[0]->getNumLevels());
+        for (int i = 0; i < int(out.levels.size()); ++i) {
+            const size_t layerPixels = size_t(getMipLevelSize(out.width, i)) *
+                                       getMipLevelSize(out.height, i);
+            out.levels[i].resize(layerPixels * out.layers);
+            for (int layer = 0; layer < out.layers; ++layer) {
+                const PackedPixel *level = mips[layer]->getLevel(i);
+                copy(level, level + layerPixels,
+                     out.levels[i].begin() + layerPixels * layer);
+            }
+        }
+        return;
+    }
+
+    const vector<unique_ptr<PpmImage>> images =
+        openLayers(ppmFileNames, width, height);
+    out.width = width;
+    out.height = height;
+    out.layers = images.size();
+    out.levels.assign(
+        1, vector<PackedPixel>(size_t(width) * height * out.layers));
+    readLayers(images, width, height, &out.levels[0][0]);
+    makeLayeredMipChain(width, height, out.layers, srgb, out.levels);
+}
+
+shared_ptr<ImageTextureArray>
+ImageTextureArray::stream(const vector<string> &ppmFileNames, bool srgb,
+                          int width, int height) {
+    if (ppmFileNames.empty())
+        throw runtime_error("ImageTextureArray: no images given");
+
+    shared_ptr<ImageTextureArray> tex(new ImageTextureArray());
+    tex->makePlaceholder(srgb);
+    TextureStreamer::getSingleton().submit(
+        tex, [=](DecodedTexture &out) {
+            decodeImageArray(ppmFileNames, srgb, width, height, out);
+        });
+    return tex;
+}
+
+TextureLibrary &TextureLibrary::getSingleton() {
+    static TextureLibrary tl;
+    return tl;
+}
+
+shared_ptr<ImageTexture>
+TextureLibrary::getImageTexture(const string &ppmFileName, bool srgb) {
+    return get<ImageTexture>(
+        Key(vector<string>(1, ppmFileName), make_pair(0, 0)), srgb);
+}
+
+shared_ptr<ImageTextureArray>
+TextureLibrary::getImageTextureArray(const vector<string> &ppmFileNames,
+                                     bool srgb, int width, int height) {
+    return get<ImageTextureArray>(Key(ppmFileNames, make_pair(width, height)),
+                                  srgb);
+}
+
+shared_ptr<ImageTexture> TextureLibrary::load(const Key &key, bool srgb,
+                                              ImageTexture *) const {
+    if (stream_ && !compress_)
+        return ImageTexture::stream(key.first[0], srgb);
+    return shared_ptr<ImageTexture>(
+        new ImageTexture(key.first[0].c_str(), srgb, compress_));
+}
+
+shared_ptr<ImageTextureArray> TextureLibrary::load(const Key &key, bool srgb,
+                                                   ImageTextureArray *) const {
+    if (stream_ && !compress_)
+        return ImageTextureArray::stream(key.first, srgb, key.second.first,
+                                         key.second.second);
+    return shared_ptr<ImageTextureArray>(new ImageTextureArray(
+        key.first, srgb, key.second.first, key.second.second, compress_));
+}
+
+template <typename T>
+shared_ptr<T> TextureLibrary::get(const Key &key, bool srgb) {
+    ++requests_;
+
+    shared_ptr<StoredTexture> tex = textures_[make_pair(key, srgb)].lock();
+    if (tex)
+        return static_pointer_cast<T>(tex);
+
+    tex = load(key, srgb, (T *)NULL);
+    filesRead_ += key.first.size();
+
+    if (tex->getCompressedFormat()) {
+        const size_t saved =
+            tex->getUncompressedBytes() - tex->getStorageBytes();
+        cerr << "Compressed " << key.first[0];
+        if (key.first.size() > 1)
+            cerr << " and " << key.first.size() - 1 << " more";
+        cerr << (srgb ? " as BC1: " : " as RGTC2: ")
+             << tex->getUncompressedBytes() << " -> " << tex->getStorageBytes()
+             << " bytes, " << saved << " saved" << endl;
+    }
+
+    textures_[make_pair(key, srgb)] = tex;
+    return static_pointer_cast<T>(tex);
+}
+
+void TextureLibrary::printStats(ostream &os) const {
+    // Streamed textures get their storage when their images are decoded, so
+    // the sizes are those of the textures as they are now
+    size_t storageBytes = 0, savedBytes = 0;
+    for (TextureMap::const_iterator i = textures_.begin(); i != textures_.end();
+         ++i) {
+        const shared_ptr<StoredTexture> tex = i->second.lock();
+        if (!tex)
+            continue;
+        storageBytes += tex->getStorageBytes();
+        savedBytes += tex->getUncompressedBytes() - tex->getStorageBytes();
+    }
+
+    os << "Textures: " << requests_ << " requested, " << filesRead_
+       << " image files read, about " << (storageBytes + 512 * 1024) / 1048576
+       << " MB of texture storage";
+    if (savedBytes)
+        os << ", " << (savedBytes + 512 * 1024) / 1048576
+           << " MB saved by compression";
+    const int streaming = TextureStreamer::getSingleton().getPending();
+    if (streaming)
+        os << ", " << streaming << " still streaming";
+    os << endl;
+}
@@ -1,39 +1,252 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include <functional>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "glstate.h"
 #include "glsupport.h"
 
+class MipFile;
+class Uniforms;
+struct PackedPixel;
+
 class Texture {
   public:
     // Must return one of GL_SAMPLER_1D, GL_SAMPLER_2D, GL_SAMPLER_3D,
-    // GL_SAMPLER_CUBE, GL_SAMPLER_1D_SHADOW, or GL_SAMPLER_2D_SHADOW, as its
-    // intended usage by GLSL shader
+    // GL_SAMPLER_CUBE, GL_SAMPLER_1D_SHADOW, GL_SAMPLER_2D_SHADOW, or
+    // GL_SAMPLER_2D_ARRAY, as its intended usage by GLSL shader
     virtual GLenum getSamplerType() const = 0;
 
-    // Binds the texture. (The caller is responsible for setting the active
-    // texture unit)
+    // Binds the texture through GlState. (The caller is responsible for
+    // selecting the texture unit with GlState::activeTexture)
     virtual void bind() const = 0;
 
+    // Called by Material::draw before binding the texture, with the uniforms
+    // of the shape being drawn, for textures whose contents depend on how
+    // they are seen (see VirtualTexture)
+    virtual void prepareDraw(const Uniforms &extraUniforms) const {}
+
     virtual ~Texture() {}
 };
 
+//------------------------------------------------------------------
+// Base of the image textures below: a GL texture object and the storage
+// allocated for its images and their mipmaps
+//------------------------------------------------------------------
+
+class StoredTexture : public Texture {
+  public:
+    virtual GLenum getSamplerType() const { return samplerType_; }
+
+    // Also unbinds any sampler object, so that the texture's own parameters
+    // are used
+    virtual void bind() const {
+        GlState &gl = GlState::get();
+        gl.bindTexture(target_, *tex_);
+        gl.bindSampler(0);
+    }
+
+    virtual ~StoredTexture();
+
+    bool isSrgb() const { return srgb_; }
+
+    // Bytes of GL storage, including mipmaps, allocated for this texture
+    size_t getStorageBytes() const { return storageBytes_; }
+
+    // Block compressed format of the storage, or 0 if uncompressed RGB
+    GLenum getCompressedFormat() const { return compressedFormat_; }
+
+    // Bytes the storage would take uncompressed
+    size_t getUncompressedBytes() const { return uncompressedBytes_; }
+
+    // Whether textures with the given color space can be block compressed.
+    // sRGB ones are compressed as BC1 (S3TC), which the context may lack, and
+    // linear ones as RGTC2, which GL 3 always has (see texcompress.h).
+    static bool canCompress(bool srgb);
+
+  protected:
+    GLenum target_, samplerType_;
+    bool srgb_, immutable_;
+    int levels_, layers_;
+    size_t storageBytes_, uncompressedBytes_;
+    GLenum compressedFormat_;
+
+    std::shared_ptr<GlTexture> tex_;
+
+    StoredTexture(GLenum target, GLenum samplerType)
+        : target_(target), samplerType_(samplerType), srgb_(false),
+          immutable_(false), levels_(1), layers_(1), storageBytes_(0),
+          uncompressedBytes_(0), compressedFormat_(0), tex_(new GlTexture()),
+          width_(0), height_(0) {}
+
+    // Binds the texture for the glTex* calls that follow (see
+    // GlState::bindForEdit)
+    void bindForEdit() const { GlState::get().bindForEdit(target_, *tex_); }
+
+    // Writes the pixels of one mip level of all layers to `dst', layer after
+    // layer, each bottom row first with rows tightly packed. May be called
+    // twice.
+    typedef std::function<void(PackedPixel *dst)> PixelWriter;
+
+    // Allocates (immutable if possible) RGB storage for all mip levels, and leaves the texture bound for the uploads below
+    void allocate(int width, int height, int layers, bool srgb);
+
+    // Uploads `pixels', laid out as above, into layers [firstLayer,
+    // firstLayer + numLayers) of mip `level'. `pixels' may be a mapped file.
+    void upload(int level, int firstLayer, int numLayers, const void *pixels);
+
+    // Same, with the pixels written by `writePixels' into a mapped pixel
+    // unpack buffer directly, so they are not staged in an intermediate copy
+    // on our side. The buffers are a small ring, reused from one upload to
+    // the next.
+    void upload(int level, int firstLayer, int numLayers,
+                const PixelWriter &writePixels);
+
+    // Makes `level' the finest level sampled (GL_TEXTURE_BASE_LEVEL)
+    void setBaseLevel(int level);
+
+    // One texel standing in for the image until it is streamed in: mid gray
+    // for sRGB (color) textures, and a flat normal for linear ones
+    void makePlaceholder(bool srgb);
+
+    // Generates the levels below level 0 from it, unless they were all
+    // uploaded, and sets the sampling parameters
+    void finishUpload(bool generateMipmaps);
+
+    // Uploads all levels of layer `layer' from a precomputed mip chain
+    void uploadMipFile(const MipFile &mips, int layer);
+
+    // Block compresses level 0 of all layers, laid out as for PixelWriter,
+    // along with the mip levels generated from it on the CPU, and allocates
+    // and uploads all of them. The compressed levels are cached on disk, so
+    // this is only slow the first time for given pixels.
+    void compressAndUpload(int width, int height, int layers, bool srgb,
+                           const std::vector<PackedPixel> &pixels);
+
+  private:
+    friend class TextureStreamer;
+
+    int width_, height_;
+};
+
 //----------------------------------------
 // One concrete implementation of Texture
 //----------------------------------------
 
-class ImageTexture : public Texture {
-    GlTexture tex;
-
+class ImageTexture : public StoredTexture {
   public:
     // Loades a PPM image files with three channels, and create
     // a 2D texture off it. if `srgb' is true, the image is assumed
-    // to be in SRGB color space
-    ImageTexture(const char *ppmFileName,
-                 bool srgb); // implemented in texture.cpp
+    // to be in SRGB color space. If the image has been converted with
+    // mipconvert, the converted mip chain is uploaded instead. If `compress'
+    // is true and canCompress(srgb), the texture is block compressed.
+    ImageTexture(const char *ppmFileName, bool srgb,
+                 bool compress = false); // implemented in texture.cpp
+
+    // Returns a placeholder right away (see makePlaceholder), and has
+    // TextureStreamer load the image in the background. Not compressed.
+    static std::shared_ptr<ImageTexture> stream(const std::string &ppmFileName,
+                                                bool srgb);
+
+  protected:
+    friend class StoredTexture;
+    ImageTexture() : StoredTexture(GL_TEXTURE_2D, GL_SAMPLER_2D) {}
+};
+
+//------------------------------------------------------------------
+// Several images packed as the layers of a single GL_TEXTURE_2D_ARRAY
+//------------------------------------------------------------------
+
+// Lets materials that only differ in their images share one texture binding,
+// and pick the image with a layer index in the shader instead. All layers
+// have to be the same size, so images of other sizes are bilinearly resampled
+// on load.
+class ImageTextureArray : public StoredTexture {
+  public:
+    // Loads the PPM files as consecutive layers. `width' and `height' give
+    // the layer size; if 0, that of the largest image is used. if `srgb' is
+    // true, the images are assumed to be in SRGB color space
+    // Converted mip chains (see ImageTexture) are used if all images have one
+    // of the layer size. `compress' is as for ImageTexture.
+    ImageTextureArray(const std::vector<std::string> &ppmFileNames, bool srgb,
+                      int width = 0, int height = 0, bool compress = false);
+
+    // As ImageTexture::stream. The placeholder has a single layer, which GL
+    // samples for any layer index.
+    static std::shared_ptr<ImageTextureArray>
+    stream(const std::vector<std::string> &ppmFileNames, bool srgb,
+           int width = 0, int height = 0);
+
+    int getNumLayers() const { return layers_; }
+
+  protected:
+    friend class StoredTexture;
+    ImageTextureArray()
+        : StoredTexture(GL_TEXTURE_2D_ARRAY, GL_SAMPLER_2D_ARRAY) {}
+};
+
+//------------------------------------------------------------------
+// Hands out shared image textures, loading each image file once
+//------------------------------------------------------------------
+
+// Textures are cached by (file names, srgb), so each is loaded once however
+// many materials use it. The sRGB and the linear version of the same images
+// are stored separately: a linear texture viewing sRGB storage would read
+// mipmaps averaged in linear light, which are wrong for normal maps and other
+// data.
+class TextureLibrary {
+  public:
+    static TextureLibrary &getSingleton();
+
+    std::shared_ptr<ImageTexture> getImageTexture(const std::string &ppmFileName,
+                                                  bool srgb);
+
+    // Arrays of different layer sizes are cached separately
+    std::shared_ptr<ImageTextureArray>
+    getImageTextureArray(const std::vector<std::string> &ppmFileNames,
+                         bool srgb, int width = 0, int height = 0);
+
+    // Whether textures loaded from now on are block compressed where
+    // possible. Off by default. Each compressed texture is reported on cerr
+    // with the bytes it saves.
+    void setCompression(bool compress) { compress_ = compress; }
+    bool getCompression() const { return compress_; }
+
+    // Whether textures loaded from now on are streamed in the background (see
+    // ImageTexture::stream). Off by default; compression takes precedence.
+    // TextureStreamer::update has to be called every frame.
+    void setStreaming(bool stream) { stream_ = stream; }
+
+    // Prints the number of textures handed out, image files read, and bytes
+    // of storage allocated for the textures still in use. Textures still
+    // streaming only count their placeholder, so this is printed again when
+    // they are all in.
+    void printStats(std::ostream &os) const;
+
+  private:
+    typedef std::pair<std::vector<std::string>, std::pair<int, int>> Key;
+    typedef std::map<std::pair<Key, bool>, std::weak_ptr<StoredTexture>>
+        TextureMap;
+
+    TextureMap textures_;
+    int requests_, filesRead_;
+    bool compress_, stream_;
+
+    TextureLibrary()
+        : requests_(0), filesRead_(0), compress_(false), stream_(false) {}
 
-    virtual GLenum getSamplerType() const { return GL_SAMPLER_2D; }
+    template <typename T>
+    std::shared_ptr<T> get(const Key &key, bool srgb);
 
-    virtual void bind() const { glBindTexture(GL_TEXTURE_2D, tex); }
+    std::shared_ptr<ImageTexture> load(const Key &key, bool srgb,
+                                       ImageTexture *) const;
+    std::shared_ptr<ImageTextureArray> load(const Key &key, bool srgb,
+                                            ImageTextureArray *) const;
 };
 
 #endif
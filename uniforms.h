@@ -1,6 +1,9 @@
 #ifndef UNIFORMS_H
 #define UNIFORMS_H
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 #include <map>
 #include <memory>
 #include <stdexcept>
@@ -10,56 +13,12 @@
 #include "cvec.h"
 #include "glsupport.h"
 #include "matrix4.h"
+#include "matrix4f.h"
 #include "texture.h"
 
 // Private namespace for some helper functions. You should ignore this unless
 // you are interested in the internal implementation.
 namespace _helper {
-inline void genericGlUniformi(GLint location, int i) {
-    ::glUniform1i(location, i);
-}
-inline void genericGlUniformf(GLint location, float f) {
-    ::glUniform1f(location, f);
-}
-inline void genericGlUniformv(GLint location, int size, const GLint *v) {
-    ::glUniform1iv(location, size, v);
-}
-inline void genericGlUniformv(GLint location, int size, const GLfloat *v) {
-    ::glUniform1fv(location, size, v);
-}
-inline void genericGlUniformv(GLint location, int size, const Cvec<int, 1> *v) {
-    ::glUniform1iv(location, size, &v[0][0]);
-}
-inline void genericGlUniformv(GLint location, int size, const Cvec<int, 2> *v) {
-    ::glUniform2iv(location, size, &v[0][0]);
-}
-inline void genericGlUniformv(GLint location, int size, const Cvec<int, 3> *v) {
-    ::glUniform3iv(location, size, &v[0][0]);
-}
-inline void genericGlUniformv(GLint location, int size, const Cvec<int, 4> *v) {
-    ::glUniform4iv(location, size, &v[0][0]);
-}
-inline void genericGlUniformv(GLint location, int size,
-                              const Cvec<float, 1> *v) {
-    ::glUniform1fv(location, size, &v[0][0]);
-}
-inline void genericGlUniformv(GLint location, int size,
-                              const Cvec<float, 2> *v) {
-    ::glUniform2fv(location, size, &v[0][0]);
-}
-inline void genericGlUniformv(GLint location, int size,
-                              const Cvec<float, 3> *v) {
-    ::glUniform3fv(location, size, &v[0][0]);
-}
-inline void genericGlUniformv(GLint location, int size,
-                              const Cvec<float, 4> *v) {
-    ::glUniform4fv(location, size, &v[0][0]);
-}
-inline void genericGlUniformMatrix4v(GLint location, int size,
-                                     const Cvec<float, 16> *m) {
-    ::glUniformMatrix4fv(location, size, GL_FALSE, &m[0][0]);
-}
-
 template <typename T, int n>
 inline GLenum getTypeForCvec(); // should replace with STATIC_ASSERT
 
@@ -71,13 +30,56 @@ template <> inline GLenum getTypeForCvec<float, 1>() { return GL_FLOAT; }
 template <> inline GLenum getTypeForCvec<float, 2>() { return GL_FLOAT_VEC2; }
 template <> inline GLenum getTypeForCvec<float, 3>() { return GL_FLOAT_VEC3; }
 template <> inline GLenum getTypeForCvec<float, 4>() { return GL_FLOAT_VEC4; }
-template <> inline GLenum getTypeForCvec<bool, 1>() { return GL_BOOL; }
-template <> inline GLenum getTypeForCvec<bool, 2>() { return GL_BOOL_VEC2; }
-template <> inline GLenum getTypeForCvec<bool, 3>() { return GL_BOOL_VEC3; }
-template <> inline GLenum getTypeForCvec<bool, 4>() { return GL_BOOL_VEC4; }
+template <> inline GLenum getTypeForCvec<double, 1>() { return GL_FLOAT; }
+template <> inline GLenum getTypeForCvec<double, 2>() { return GL_FLOAT_VEC2; }
+template <> inline GLenum getTypeForCvec<double, 3>() { return GL_FLOAT_VEC3; }
+template <> inline GLenum getTypeForCvec<double, 4>() { return GL_FLOAT_VEC4; }
+
+// Returns a new, never before returned, stamp. Stamps are used to tell whether
+// a uniform value or the set of names in a Uniforms has changed.
+inline unsigned long long nextUniformStamp() {
+    static unsigned long long stamp = 0;
+    return ++stamp;
+}
 } // namespace _helper
 
-// The Uniforms keeps a map from strings to values
+// An interned uniform name. Constructing one looks the string up in a global
+// table; afterwards the name is just a small integer id. Code that puts the
+// same name every frame should keep a static UniformName around, e.g.,
+//
+//   static const UniformName uModelViewMatrix("uModelViewMatrix");
+//   uniforms.put(uModelViewMatrix, MVM);
+class UniformName {
+    int id_;
+
+    static std::vector<std::string> &names() {
+        static std::vector<std::string> names;
+        return names;
+    }
+
+    static int intern(const std::string &name) {
+        static std::map<std::string, int> ids;
+        std::map<std::string, int>::const_iterator i = ids.find(name);
+        if (i != ids.end())
+            return i->second;
+        const int id = names().size();
+        names().push_back(name);
+        ids[name] = id;
+        return id;
+    }
+
+  public:
+    UniformName(const char *name) : id_(intern(name)) {}
+    UniformName(const std::string &name) : id_(intern(name)) {}
+
+    int getId() const { return id_; }
+    const std::string &getString() const { return names()[id_]; }
+
+    bool operator==(const UniformName &n) const { return id_ == n.id_; }
+    bool operator!=(const UniformName &n) const { return id_ != n.id_; }
+};
+
+// The Uniforms keeps a map from names to values
 //
 // Currently the value can be of the following type:
 // - Single int, float, or Matrix4
@@ -90,252 +92,327 @@ template <> inline GLenum getTypeForCvec<bool, 4>() { return GL_BOOL_VEC4; }
 //
 // A Uniforms instance will start off empty, and you can use
 // its put member function to populate it.
+//
+// Values are stored inline in a table indexed by the interned name id, and a
+// put over an existing value of the same type and size overwrites it in place,
+// so steady state puts do not touch the heap. (Arrays larger than a Matrix4
+// spill into a vector, which is reused as long as its size does not grow.)
+//
+// Every put stamps the stored value, and every put that adds a name or changes
+// the type/size stored under a name also changes the layout stamp. Material
+// uses these to cache its uniform bindings and skip redundant uploads.
 
 class Uniforms {
   public:
-    Uniforms &put(const std::string &name, int value) {
-        Cvec<int, 1> v(value);
-        valueMap[name].reset(new CvecsValue<int, 1>(&v, 1));
+    Uniforms() : layoutStamp_(_helper::nextUniformStamp()) {}
+
+    // A copy has its own values, hence its own layout
+    Uniforms(const Uniforms &u)
+        : values_(u.values_), layoutStamp_(_helper::nextUniformStamp()) {}
+
+    Uniforms &operator=(const Uniforms &u) {
+        values_ = u.values_;
+        layoutStamp_ = _helper::nextUniformStamp();
         return *this;
     }
 
-    Uniforms &put(const std::string &name, float value) {
-        Cvec<float, 1> v(value);
-        valueMap[name].reset(new CvecsValue<float, 1>(&v, 1));
+    Uniforms &put(const UniformName &name, int value) {
+        *prepare(name, GL_INT, 1).ints(1) = value;
         return *this;
     }
 
-    Uniforms &put(const std::string &name, const Matrix4 &value) {
-        valueMap[name].reset(new Matrix4sValue(&value, 1));
+    Uniforms &put(const UniformName &name, float value) {
+        *prepare(name, GL_FLOAT, 1).floats(1) = value;
         return *this;
     }
 
-    Uniforms &put(const std::string &name,
+    Uniforms &put(const UniformName &name, const Matrix4 &value) {
+        return put(name, &value, 1);
+    }
+
+    Uniforms &put(const UniformName &name, const Matrix4f &value) {
+        return put(name, &value, 1);
+    }
+
+    Uniforms &put(const UniformName &name,
                   const std::shared_ptr<Texture> &value) {
-        valueMap[name].reset(new TexturesValue(&value, 1));
-        return *this;
+        return put(name, &value, 1);
     }
 
     template <int n>
-    Uniforms &put(const std::string &name, const Cvec<int, n> &v) {
-        valueMap[name].reset(new CvecsValue<int, n>(&v, 1));
-        return *this;
+    Uniforms &put(const UniformName &name, const Cvec<int, n> &v) {
+        return put(name, &v, 1);
     }
 
     template <int n>
-    Uniforms &put(const std::string &name, const Cvec<float, n> &v) {
-        valueMap[name].reset(new CvecsValue<float, n>(&v, 1));
-        return *this;
+    Uniforms &put(const UniformName &name, const Cvec<float, n> &v) {
+        return put(name, &v, 1);
     }
 
     template <int n>
-    Uniforms &put(const std::string &name, const Cvec<double, n> &v) {
-        Cvec<float, n> u;
-        for (int i = 0; i < n; ++i) {
-            u[i] = float(v[i]);
-        }
-        valueMap[name].reset(new CvecsValue<float, n>(&u, 1));
+    Uniforms &put(const UniformName &name, const Cvec<double, n> &v) {
+        return put(name, &v, 1);
+    }
+
+    Uniforms &put(const UniformName &name, const int *values, int count) {
+        assert(count > 0);
+        std::memcpy(prepare(name, GL_INT, count).ints(count), values,
+                    sizeof(int) * count);
         return *this;
     }
 
-    Uniforms &put(const std::string &name, const int *values, int count) {
-        valueMap[name].reset(new CvecsValue<int, 1>(
-            reinterpret_cast<const Cvec<int, 1> *>(values), count));
+    Uniforms &put(const UniformName &name, const float *values, int count) {
+        assert(count > 0);
+        std::memcpy(prepare(name, GL_FLOAT, count).floats(count), values,
+                    sizeof(float) * count);
         return *this;
     }
 
-    Uniforms &put(const std::string &name, const float *values, int count) {
-        valueMap[name].reset(new CvecsValue<float, 1>(
-            reinterpret_cast<const Cvec<float, 1> *>(values), count));
+    Uniforms &put(const UniformName &name, const Matrix4 *values, int count) {
+        assert(count > 0);
+        GLfloat *d = prepare(name, GL_FLOAT_MAT4, count).floats(16 * count);
+        for (int i = 0; i < count; ++i) {
+            values[i].writeToColumnMajorMatrix(d + 16 * i);
+        }
         return *this;
     }
 
-    Uniforms &put(const std::string &name, const Matrix4 *values, int count) {
-        valueMap[name].reset(new Matrix4sValue(values, count));
+    // Already column-major floats, so copied as they are
+    Uniforms &put(const UniformName &name, const Matrix4f *values, int count) {
+        assert(count > 0);
+        GLfloat *d = prepare(name, GL_FLOAT_MAT4, count).floats(16 * count);
+        for (int i = 0; i < count; ++i) {
+            std::memcpy(d + 16 * i, values[i].data(), sizeof(float) * 16);
+        }
         return *this;
     }
 
-    Uniforms &put(const std::string &name,
+    Uniforms &put(const UniformName &name,
                   const std::shared_ptr<Texture> *values, int count) {
-        valueMap[name].reset(new TexturesValue(values, count));
+        assert(count > 0);
+        const GLenum type = values[0]->getSamplerType();
+        for (int i = 0; i < count; ++i) {
+            assert(values[i]->getSamplerType() == type);
+        }
+        std::shared_ptr<Texture> *d = prepare(name, type, count).textures(count);
+        std::copy(values, values + count, d);
         return *this;
     }
 
     template <int n>
-    Uniforms &put(const std::string &name, const Cvec<int, n> *v, int count) {
-        valueMap[name].reset(new CvecsValue<int, n>(v, count));
+    Uniforms &put(const UniformName &name, const Cvec<int, n> *v, int count) {
+        assert(count > 0);
+        GLint *d = prepare(name, _helper::getTypeForCvec<int, n>(), count)
+                       .ints(n * count);
+        for (int i = 0; i < count; ++i) {
+            for (int j = 0; j < n; ++j) {
+                d[n * i + j] = v[i][j];
+            }
+        }
         return *this;
     }
 
     template <int n>
-    Uniforms &put(const std::string &name, const Cvec<float, n> *v, int count) {
-        valueMap[name].reset(new CvecsValue<float, n>(v, count));
+    Uniforms &put(const UniformName &name, const Cvec<float, n> *v, int count) {
+        assert(count > 0);
+        GLfloat *d = prepare(name, _helper::getTypeForCvec<float, n>(), count)
+                         .floats(n * count);
+        for (int i = 0; i < count; ++i) {
+            for (int j = 0; j < n; ++j) {
+                d[n * i + j] = v[i][j];
+            }
+        }
         return *this;
     }
 
     template <int n>
-    Uniforms &put(const std::string &name, const Cvec<double, n> *v,
+    Uniforms &put(const UniformName &name, const Cvec<double, n> *v,
                   int count) {
-        valueMap[name].reset(new CvecsValue<float, n>(v, count));
+        assert(count > 0);
+        GLfloat *d = prepare(name, _helper::getTypeForCvec<double, n>(), count)
+                         .floats(n * count);
+        for (int i = 0; i < count; ++i) {
+            for (int j = 0; j < n; ++j) {
+                d[n * i + j] = float(v[i][j]);
+            }
+        }
         return *this;
     }
 
+    // Read back a value put as a single float or Matrix4. Return false if
+    // nothing was put under `name', or something of another type.
+    bool get(const UniformName &name, float &value) const {
+        const Value *v = get(name);
+        if (v == NULL || v->type != GL_FLOAT || v->size != 1)
+            return false;
+        value = v->floats()[0];
+        return true;
+    }
+
+    bool get(const UniformName &name, Matrix4 &value) const {
+        const Value *v = get(name);
+        if (v == NULL || v->type != GL_FLOAT_MAT4 || v->size != 1)
+            return false;
+        value.readFromColumnMajorMatrix(v->floats());
+        return true;
+    }
+
     // Future work: add put for different sized matrices, and array of basic
     // types
   protected:
     // Ghastly implementation details follow. Viewer be warned.
 
     friend class Material;
-    class ValueHolder;
-    class Value;
-
-    typedef std::map<std::string, ValueHolder> ValueMap;
-
-    ValueMap valueMap;
-
-    const Value *get(const std::string &name) const {
-        std::map<std::string, ValueHolder>::const_iterator i =
-            valueMap.find(name);
-        return i == valueMap.end() ? NULL : i->second.get();
-    }
-
-    class ValueHolder {
-        Value *value_;
-
-      public:
-        ValueHolder() : value_(NULL) {}
-        ValueHolder(Value *value) : value_(value) {}
-        ValueHolder(const ValueHolder &u)
-            : value_(u.value_ ? u.value_->clone() : NULL) {}
-        ~ValueHolder() {
-            if (value_)
-                delete value_;
-        }
-        void reset(Value *value) {
-            if (value_)
-                delete value_;
-            value_ = value;
-        }
-
-        Value *get() const { return value_; }
-
-        ValueHolder &operator=(const ValueHolder &u) {
-            reset(u.value_ ? u.value_->clone() : NULL);
-            return *this;
-        }
-    };
 
     class Value {
       public:
         // One of the uniform type as returned by glGetActiveUniform, used for
-        // matching
-        const GLenum type;
+        // matching. 0 if nothing has been put.
+        GLenum type;
 
         // 1 for non-array type, otherwise the number of elements in the array
-        const GLint size;
+        GLint size;
 
-        virtual Value *clone() const = 0;
-        virtual ~Value() {}
+        // Unique to each put. Copies share the stamp since they hold the same
+        // value.
+        unsigned long long stamp;
 
-        // If type is one of GL_SAMPLER_*, the getTextures should provide a
-        // pointer to the array of shared_ptr<Texture> stored by the uniform.
-        // And apply should use the boundTexUnits argument as the argument for
-        // glUniform*.
-        //
-        // Otherwise, boundTexUnit should be ignored and whatever values
-        // contained in the Value instance should be set to given location.
+        Value() : type(0), size(0), stamp(0) {}
+
+        // If type is one of GL_SAMPLER_*, apply uses the boundTexUnits
+        // argument as the argument for glUniform*. Otherwise, boundTexUnit is
+        // ignored and the stored values are set to given location.
         //
         // `count' specifies how many actural uniforms are specified by the
         // shader, and should be used as input parameter to glUniform*
-        virtual void apply(GLint location, GLsizei count,
-                           const GLint *boundTexUnits) const = 0;
-        virtual const std::shared_ptr<Texture> *getTextures() const {
-            return NULL;
-        };
-
-      protected:
-        Value(GLenum aType, GLint aSize) : type(aType), size(aSize) {}
-    };
-
-    template <typename T, int n> class CvecsValue : public Value {
-        std::vector<Cvec<T, n>> vs_;
+        void apply(GLint location, GLsizei count,
+                   const GLint *boundTexUnits) const {
+            assert(count <= size);
+            switch (type) {
+            case GL_INT:
+                ::glUniform1iv(location, count, ints());
+                break;
+            case GL_INT_VEC2:
+                ::glUniform2iv(location, count, ints());
+                break;
+            case GL_INT_VEC3:
+                ::glUniform3iv(location, count, ints());
+                break;
+            case GL_INT_VEC4:
+                ::glUniform4iv(location, count, ints());
+                break;
+            case GL_FLOAT:
+                ::glUniform1fv(location, count, floats());
+                break;
+            case GL_FLOAT_VEC2:
+                ::glUniform2fv(location, count, floats());
+                break;
+            case GL_FLOAT_VEC3:
+                ::glUniform3fv(location, count, floats());
+                break;
+            case GL_FLOAT_VEC4:
+                ::glUniform4fv(location, count, floats());
+                break;
+            case GL_FLOAT_MAT4:
+                ::glUniformMatrix4fv(location, count, GL_FALSE, floats());
+                break;
+            default: // one of the samplers
+                assert(getTextures() != NULL);
+                ::glUniform1iv(location, count, boundTexUnits);
+            }
+        }
 
-      public:
-        CvecsValue(const Cvec<T, n> *vs, int size)
-            : Value(_helper::getTypeForCvec<T, n>(), size), vs_(vs, vs + size) {
-            assert(size > 0);
+        // If type is one of GL_SAMPLER_*, returns a pointer to the array of
+        // textures stored by the uniform, otherwise NULL
+        const std::shared_ptr<Texture> *getTextures() const {
+            if (!texture_ && textures_.empty())
+                return NULL;
+            return size == 1 ? &texture_ : &textures_[0];
         }
 
-        // construct from Cvecs of another type
-        template <typename S>
-        CvecsValue(const Cvec<S, n> *vs, int size)
-            : Value(_helper::getTypeForCvec<T, n>(), size), vs_(size) {
-            assert(size > 0);
-            for (int i = 0; i < size; ++i) {
-                for (int d = 0; d < n; ++d) {
-                    vs_[i][d] = T(vs[i][d]);
-                }
-            }
+        // The stored values of float and int based types respectively
+        const GLfloat *floats() const {
+            return floats_.empty() ? inline_.f : &floats_[0];
+        }
+        const GLint *ints() const {
+            return ints_.empty() ? inline_.i : &ints_[0];
         }
 
-        virtual Value *clone() const { return new CvecsValue(*this); }
+      private:
+        friend class Uniforms;
 
-        virtual void apply(GLint location, GLsizei count,
-                           const GLint *boundTexUnit) const {
-            assert(count <= size);
-            _helper::genericGlUniformv(location, count, &vs_[0]);
-        }
-    };
+        // Large enough for a Matrix4, or four vec4
+        static const int INLINE_WORDS = 16;
 
-    class Matrix4sValue : public Value {
-        // we use cvecs here instead of matrix4s here since matrix4
-        // doesn't allow double element (yet), and to pass the data
-        // into glUniformMatrix4fv, we need to have the internal buffer
-        // to be typed float.
-        std::vector<Cvec<float, 16>> ms_;
+        union {
+            GLfloat f[INLINE_WORDS];
+            GLint i[INLINE_WORDS];
+        } inline_;
+        std::vector<GLfloat> floats_;
+        std::vector<GLint> ints_;
 
-      public:
-        Matrix4sValue(const Matrix4 *m, int size)
-            : Value(GL_FLOAT_MAT4, size), ms_(size) {
-            assert(size > 0);
-            for (int i = 0; i < size; ++i) {
-                m[i].writeToColumnMajorMatrix(&ms_[i][0]);
+        std::shared_ptr<Texture> texture_;
+        std::vector<std::shared_ptr<Texture>> textures_;
+
+        // Returns storage for `words' floats/ints/textures to be overwritten.
+        GLfloat *floats(int words) {
+            if (words <= INLINE_WORDS) {
+                floats_.clear();
+                return inline_.f;
             }
+            floats_.resize(words);
+            return &floats_[0];
         }
-
-        virtual Value *clone() const { return new Matrix4sValue(*this); }
-
-        virtual void apply(GLint location, GLsizei count,
-                           const GLint *boundTexUnit) const {
-            assert(count <= size);
-            _helper::genericGlUniformMatrix4v(location, count, &ms_[0]);
+        GLint *ints(int words) {
+            if (words <= INLINE_WORDS) {
+                ints_.clear();
+                return inline_.i;
+            }
+            ints_.resize(words);
+            return &ints_[0];
+        }
+        std::shared_ptr<Texture> *textures(int count) {
+            if (count == 1) {
+                textures_.clear();
+                return &texture_;
+            }
+            texture_.reset();
+            textures_.resize(count);
+            return &textures_[0];
         }
     };
 
-    class TexturesValue : public Value {
-        std::vector<std::shared_ptr<Texture>> texs_;
+    // Indexed by UniformName id. Entries with type 0 are unset.
+    std::vector<Value> values_;
 
-      public:
-        TexturesValue(const std::shared_ptr<Texture> *tex, int size)
-            : Value(tex[0]->getSamplerType(), size), texs_(tex, tex + size) {
-            assert(size > 0);
-            for (int i = 0; i < size; ++i) {
-                assert(tex[i]->getSamplerType() == type);
-            }
-        }
+    // Changes whenever a name is added, or the type/size under a name changes
+    unsigned long long layoutStamp_;
 
-        virtual Value *clone() const { return new TexturesValue(*this); }
+    const Value *get(const UniformName &name) const {
+        return get(name.getId());
+    }
 
-        virtual void apply(GLint location, GLsizei count,
-                           const GLint *boundTexUnits) const {
-            assert(count <= size);
-            _helper::genericGlUniformv(location, count, boundTexUnits);
-        }
+    const Value *get(int id) const {
+        if (id >= (int)values_.size() || values_[id].type == 0)
+            return NULL;
+        return &values_[id];
+    }
 
-        virtual const std::shared_ptr<Texture> *getTextures() const {
-            return &texs_[0];
+    // Returns the value under `name' to be overwritten, after stamping it as
+    // holding `count' elements of `type'.
+    Value &prepare(const UniformName &name, GLenum type, GLint count) {
+        const int id = name.getId();
+        if (id >= (int)values_.size())
+            values_.resize(id + 1);
+        Value &v = values_[id];
+        if (v.type != type || v.size != count) {
+            layoutStamp_ = _helper::nextUniformStamp();
+            v.type = type;
+            v.size = count;
         }
-    };
+        v.stamp = _helper::nextUniformStamp();
+        return v;
+    }
 };
 
 #endif
@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include "material.h"
+#include "matrix4.h"
+#include "uniforms.h"
+#include "vtexture.h"
+
+using namespace std;
+
+namespace {
+// The indirection texture, read with texelFetch
+class IndirectionTexture : public Texture {
+  public:
+    GlTexture tex;
+
+    virtual GLenum getSamplerType() const { return GL_SAMPLER_2D; }
+
+    virtual void bind() const {
+        GlState &gl = GlState::get();
+        gl.bindTexture(GL_TEXTURE_2D, tex);
+        gl.bindSampler(0);
+    }
+
+    void bindForEdit() const { GlState::get().bindForEdit(GL_TEXTURE_2D, tex); }
+
+    virtual ~IndirectionTexture() { GlState::get().forgetTexture(tex); }
+};
+} // namespace
+
+static void setTextureParameters(GLenum filter) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+}
+
+VirtualTexture::VirtualTexture(const char *tileFileName, int atlasTiles)
+    : file_(tileFileName), atlasTiles_(atlasTiles), tilesPerFrame_(8),
+      atlas_(new GlTexture()), indirection_(new IndirectionTexture()),
+      frame_(0), dirty_(true) {
+    const int numLevels = file_.getNumLevels();
+    if (numLevels > MAX_LEVELS)
+        throw runtime_error(string("Too many levels in ") + tileFileName);
+    // The slots and levels are stored as bytes in the indirection texture
+    if (atlasTiles < 2 || atlasTiles > 256)
+        throw runtime_error("VirtualTexture: invalid atlas size");
+
+    // The atlas is sampled at a single level: the tiles are the mip levels
+    const int atlasSize = atlasTiles * file_.getTilePixels();
+    GlState::get().bindForEdit(GL_TEXTURE_2D, *atlas_);
+    glTexImage2D(GL_TEXTURE_2D, 0, file_.isSrgbFiltered() ? GL_SRGB8 : GL_RGB8,
+                 atlasSize, atlasSize, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    setTextureParameters(GL_LINEAR);
+
+    int rows = 0;
+    for (int level = 0; level < numLevels; ++level) {
+        levelRows_.push_back(rows);
+        rows += file_.getTilesY(level);
+    }
+    const int columns = file_.getTilesX(0);
+    entries_.assign(size_t(columns) * rows * 4, 0);
+    static_cast<IndirectionTexture &>(*indirection_).bindForEdit();
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, columns, rows, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, NULL);
+    setTextureParameters(GL_NEAREST);
+    checkGlErrors();
+
+    Slot empty = {-1, 0, false};
+    slots_.assign(size_t(atlasTiles) * atlasTiles, empty);
+    load(makeKey(numLevels - 1, 0, 0), true);
+    updateIndirection();
+}
+
+VirtualTexture::~VirtualTexture() { GlState::get().forgetTexture(*atlas_); }
+
+void VirtualTexture::bind() const {
+    GlState &gl = GlState::get();
+    gl.bindTexture(GL_TEXTURE_2D, *atlas_);
+    gl.bindSampler(0);
+}
+
+void VirtualTexture::putUniforms(Uniforms &uniforms) {
+    const int numLevels = file_.getNumLevels();
+    uniforms.put("uVtAtlas", shared_ptr<Texture>(shared_from_this()))
+        .put("uVtIndirection", indirection_)
+        .put("uVtSize", Cvec<int, 2>(file_.getWidth(), file_.getHeight()))
+        .put("uVtTileSize", file_.getTileSize())
+        .put("uVtBorder", file_.getBorder())
+        .put("uVtLevels", numLevels)
+        .put("uVtLevelRow", &levelRows_[0], numLevels)
+        .put("uVtAtlasSize", float(atlasTiles_ * file_.getTilePixels()));
+}
+
+void VirtualTexture::prepareDraw(const Uniforms &extraUniforms) const {
+    static const UniformName mvmName("uModelViewMatrix"),
+        screenRadiusName(Material::SCREEN_RADIUS);
+    Matrix4 modelView;
+    float screenRadius;
+    if (!extraUniforms.get(mvmName, modelView) ||
+        !extraUniforms.get(screenRadiusName, screenRadius))
+        return;
+
+    // The eye in object space, where the sphere has radius 1
+    const Cvec4 eye4 = inv(modelView) * Cvec4(0, 0, 0, 1);
+    const Cvec3 eye(eye4[0], eye4[1], eye4[2]);
+    const double dist = norm(eye);
+    if (dist < CS175_EPS)
+        return;
+    const Cvec3 view = eye / dist;
+    // Points of the sphere with dot(n, view) above this face the eye. Some
+    // slack for the tiles at the limb, and for the eye inside the sphere.
+    const double horizon = min(1.0, 1.0 / dist) - 0.05;
+
+    // Along the sphere's equator, pi radians span the texture's height and
+    // about screenRadius pixels each, which gives the level with about one
+    // texel per pixel where the sphere faces the eye
+    const double r = max(1e-3, double(screenRadius));
+    const double lod = log2(file_.getHeight() / (CS175_PI * r));
+    const int numLevels = file_.getNumLevels();
+    const int finest = min(numLevels - 1, max(0, int(floor(lod))));
+
+    double viewLon = atan2(view[1], view[0]);
+    if (viewLon < 0)
+        viewLon += 2 * CS175_PI;
+    const double viewColat = acos(max(-1.0, min(1.0, view[2])));
+
+    // The finest level, and all coarser ones to fall back on while it loads
+    // and while zooming out. They hold a fraction of its tiles.
+    const double width = file_.getWidth(), height = file_.getHeight();
+    for (int level = finest; level < numLevels; ++level) {
+        const double span = double(file_.getTileSize() << level);
+        const int tilesX = file_.getTilesX(level),
+                  tilesY = file_.getTilesY(level);
+        for (int ty = 0; ty < tilesY; ++ty) {
+            const double colat0 = CS175_PI * ty * span / height,
+                         colat1 = CS175_PI * min(1.0, (ty + 1) * span / height);
+            const double colat = min(colat1, max(colat0, viewColat));
+            for (int tx = 0; tx < tilesX; ++tx) {
+                // The point of the tile closest to the view direction, with
+                // longitudes wrapping around
+                const double lon0 = 2 * CS175_PI * tx * span / width,
+                             lon1 = 2 * CS175_PI *
+                                    min(1.0, (tx + 1) * span / width);
+                double lon = viewLon;
+                if (lon < lon0 || lon > lon1) {
+                    const double d0 = fmod(lon0 - viewLon + 2 * CS175_PI,
+                                           2 * CS175_PI),
+                                 d1 = fmod(viewLon - lon1 + 2 * CS175_PI,
+                                           2 * CS175_PI);
+                    lon = d0 < d1 ? lon0 : lon1;
+                }
+                const Cvec3 n(cos(lon) * sin(colat), sin(lon) * sin(colat),
+                              cos(colat));
+                if (dot(n, view) > horizon)
+                    wanted_.push_back(makeKey(level, tx, ty));
+            }
+        }
+    }
+}
+
+void VirtualTexture::update() {
+    ++frame_;
+    if (wanted_.empty())
+        return;
+
+    // Coarsest first, so the fallbacks of finer tiles arrive before them
+    sort(wanted_.begin(), wanted_.end(), greater<TileKey>());
+    wanted_.erase(unique(wanted_.begin(), wanted_.end()), wanted_.end());
+
+    // Keep what is wanted from being evicted by what is loaded below
+    for (size_t i = 0; i < wanted_.size(); ++i) {
+        const unordered_map<TileKey, int>::const_iterator it =
+            resident_.find(wanted_[i]);
+        if (it != resident_.end())
+            slots_[it->second].frame = frame_;
+    }
+
+    int loaded = 0;
+    for (size_t i = 0; i < wanted_.size() && loaded < tilesPerFrame_; ++i) {
+        if (resident_.count(wanted_[i]))
+            continue;
+        if (!load(wanted_[i], false))
+            break; // the atlas is full of wanted tiles
+        ++loaded;
+    }
+    wanted_.clear();
+
+    if (dirty_)
+        updateIndirection();
+}
+
+bool VirtualTexture::load(TileKey key, bool pin) {
+    int slot = -1;
+    for (int i = 0, n = slots_.size(); i < n; ++i) {
+        const Slot &s = slots_[i];
+        if (s.key < 0) {
+            slot = i;
+            break;
+        }
+        if (!s.pinned && s.frame != frame_ &&
+            (slot < 0 || s.frame < slots_[slot].frame))
+            slot = i;
+    }
+    if (slot < 0)
+        return false;
+
+    Slot &s = slots_[slot];
+    if (s.key >= 0)
+        resident_.erase(s.key);
+    s.key = key;
+    s.frame = frame_;
+    s.pinned = pin;
+    resident_[key] = slot;
+    dirty_ = true;
+
+    const int level = int(key >> 48), y = int((key >> 24) & 0xffffff),
+              x = int(key & 0xffffff);
+    const int tilePixels = file_.getTilePixels();
+    GlState::get().bindForEdit(GL_TEXTURE_2D, *atlas_);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % atlasTiles_) * tilePixels,
+                    (slot / atlasTiles_) * tilePixels, tilePixels, tilePixels,
+                    GL_RGB, GL_UNSIGNED_BYTE, file_.getTile(level, x, y));
+    return true;
+}
+
+void VirtualTexture::updateIndirection() {
+    const int columns = file_.getTilesX(0);
+    const int numLevels = file_.getNumLevels();
+
+    // Coarse to fine, so that a tile that is not resident can copy the entry
+    // of its parent
+    for (int level = numLevels - 1; level >= 0; --level) {
+        for (int ty = 0; ty < file_.getTilesY(level); ++ty) {
+            for (int tx = 0; tx < file_.getTilesX(level); ++tx) {
+                unsigned char *e =
+                    &entries_[4 * (size_t(levelRows_[level] + ty) * columns +
+                                   tx)];
+                const unordered_map<TileKey, int>::const_iterator it =
+                    resident_.find(makeKey(level, tx, ty));
+                if (it != resident_.end()) {
+                    e[0] = it->second % atlasTiles_;
+                    e[1] = it->second / atlasTiles_;
+                    e[2] = level;
+                    e[3] = 255;
+                } else {
+                    // The root is pinned, so only finer levels get here
+                    const unsigned char *p =
+                        &entries_[4 * (size_t(levelRows_[level + 1] + ty / 2) *
+                                           columns +
+                                       tx / 2)];
+                    copy(p, p + 4, e);
+                }
+            }
+        }
+    }
+
+    static_cast<IndirectionTexture &>(*indirection_).bindForEdit();
+    const int rows = entries_.size() / 4 / columns;
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, columns, rows, GL_RGBA,
+                    GL_UNSIGNED_BYTE, &entries_[0]);
+    dirty_ = false;
+}
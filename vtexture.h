@@ -0,0 +1,98 @@
+#ifndef VTEXTURE_H
+#define VTEXTURE_H
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "mipfile.h"
+#include "texture.h"
+
+class Uniforms;
+
+// A texture too large to keep resident, such as a 32k x 16k planet map, read
+// from a tile container (see TileFile) and drawn with
+// shaders/normal-vt-gl3.fshader. GPU memory stays fixed whatever the size of
+// the image:
+//
+// - the atlas, a GL_TEXTURE_2D of atlasTiles x atlasTiles slots, holds the
+//   resident tiles, with their borders, and is what bind() binds. With 128 x
+//   128 tiles the default is 3120 x 3120 texels, about 29 MB;
+// - the indirection texture has one texel per tile of every level, levels
+//   stacked bottom up, telling the shader which slot to read and from which
+//   level. A tile that is not resident points to its closest resident
+//   ancestor, and the single tile of the coarsest level is always resident,
+//   so a lookup always finds something, only blurrier.
+//
+// Which tiles are wanted is estimated analytically on every draw, from the
+// shape's screen radius and the eye position relative to it, assuming the
+// geometry is the unit sphere of geometrymaker.h (u around the z axis, v from
+// +z to -z). update() then pages them in from the mapped file, coarsest first
+// and a bounded number per frame, evicting the least recently wanted.
+class VirtualTexture : public Texture,
+                       public std::enable_shared_from_this<VirtualTexture> {
+  public:
+    // Throws runtime_error if the file cannot be read, or has more levels
+    // than the shader handles
+    explicit VirtualTexture(const char *tileFileName, int atlasTiles = 24);
+
+    virtual ~VirtualTexture();
+
+    virtual GLenum getSamplerType() const { return GL_SAMPLER_2D; }
+
+    // Binds the atlas
+    virtual void bind() const;
+
+    // Records the tiles the shape drawn with `extraUniforms' wants
+    virtual void prepareDraw(const Uniforms &extraUniforms) const;
+
+    // Puts the atlas, the indirection texture and the parameters of the
+    // lookup under the names normal-vt-gl3.fshader uses
+    void putUniforms(Uniforms &uniforms);
+
+    // Pages in the tiles wanted since the last call, up to the tiles per frame,
+    // and updates the indirection texture. Call once per frame on the GL
+    // thread, before drawing.
+    void update();
+
+    // 8 by default. A 128 x 128 tile is 50 KB.
+    void setTilesPerFrame(int tiles) { tilesPerFrame_ = tiles; }
+
+    int getNumResidentTiles() const { return resident_.size(); }
+
+    // Most levels normal-vt-gl3.fshader handles
+    static const int MAX_LEVELS = 16;
+
+  private:
+    typedef long long TileKey; // level, y and x; coarser levels sort higher
+
+    struct Slot {
+        TileKey key;     // -1 if free
+        unsigned frame;  // last update() that wanted it
+        bool pinned;
+    };
+
+    TileFile file_;
+    int atlasTiles_, tilesPerFrame_;
+    std::shared_ptr<GlTexture> atlas_;
+    std::shared_ptr<Texture> indirection_;
+    std::vector<int> levelRows_; // first indirection row of each level
+    std::vector<unsigned char> entries_; // RGBA8 indirection texels
+    std::vector<Slot> slots_;
+    std::unordered_map<TileKey, int> resident_; // to slot
+    mutable std::vector<TileKey> wanted_;
+    unsigned frame_;
+    bool dirty_; // entries_ out of date
+
+    static TileKey makeKey(int level, int x, int y) {
+        return (TileKey(level) << 48) | (TileKey(y) << 24) | x;
+    }
+
+    // Loads a tile into a free or least recently wanted slot. Returns false
+    // if every slot is pinned or wanted this frame.
+    bool load(TileKey key, bool pin);
+
+    void updateIndirection();
+};
+
+#endif